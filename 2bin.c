@@ -0,0 +1,246 @@
+/* @brief Convert the DBC model into a compiled image, see 'image.h'.
+ * @license MIT */
+#include "2bin.h"
+#include "image.h"
+#include "util.h"
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+	char *data;
+	size_t used, max;
+	bool overflow; /**< image is larger than 32-bit offsets can address */
+} builder_t;
+
+#define AT(B, TYPE, OFFSET) ((TYPE*)((B)->data + (OFFSET)))
+
+/* make room for 'size' zeroed bytes and return their offset, any pointers
+ * into the image are invalidated */
+static uint32_t reserve(builder_t *b, size_t size, size_t align)
+{
+	assert(b);
+	const size_t offset = (b->used + align - 1) & ~(align - 1);
+	if (offset + size > UINT32_MAX) {
+		b->overflow = true;
+		return 0;
+	}
+	if (offset + size > b->max) {
+		const size_t max = (offset + size) * 2 + 4096;
+		b->data = reallocator(b->data, max);
+		memset(b->data + b->max, 0, max - b->max);
+		b->max = max;
+	}
+	b->used = offset + size;
+	return offset;
+}
+
+static uint32_t array(builder_t *b, size_t count, size_t size)
+{
+	return count ? reserve(b, count * size, 8) : 0;
+}
+
+static uint32_t string(builder_t *b, const char *s)
+{
+	if (!s)
+		return 0;
+	const size_t length = strlen(s) + 1;
+	const uint32_t offset = reserve(b, length, 1);
+	if (!b->overflow)
+		memcpy(b->data + offset, s, length);
+	return offset;
+}
+
+typedef struct {
+	const val_list_t *val;
+	uint32_t offset;
+} val_offset_t;
+
+static int val_offset_compare(const void *a, const void *b)
+{
+	const val_offset_t *x = a, *y = b;
+	if (x->val < y->val) return -1;
+	if (x->val > y->val) return  1;
+	return 0;
+}
+
+typedef struct {
+	unsigned long id;
+	uint32_t message;
+} index_t;
+
+static int index_compare(const void *a, const void *b)
+{
+	const index_t *x = a, *y = b;
+	if (x->id != y->id)
+		return x->id < y->id ? -1 : 1;
+	return x->message < y->message ? -1 : x->message > y->message;
+}
+
+static uint32_t signal_flags(const signal_t *sig)
+{
+	assert(sig);
+	uint32_t f = 0;
+	if (sig->endianess == endianess_intel_e) f |= IMAGE_SIGNAL_INTEL;
+	if (sig->is_signed)                      f |= IMAGE_SIGNAL_SIGNED;
+	if (sig->is_floating)                    f |= IMAGE_SIGNAL_FLOATING;
+	if (sig->is_multiplexor)                 f |= IMAGE_SIGNAL_MULTIPLEXOR;
+	if (sig->is_multiplexed)                 f |= IMAGE_SIGNAL_MULTIPLEXED;
+	return f;
+}
+
+static void signal2bin(builder_t *b, uint32_t offset, const signal_t *sig, const val_offset_t *vals, size_t val_count)
+{
+	assert(b);
+	assert(sig);
+	const uint32_t name = string(b, sig->name), units = string(b, sig->units), comment = string(b, sig->comment);
+	const uint32_t ecus = array(b, sig->ecu_count, sizeof(uint32_t));
+	for (size_t i = 0; i < sig->ecu_count; i++) {
+		const uint32_t ecu = string(b, sig->ecus[i]);
+		if (!b->overflow)
+			AT(b, uint32_t, ecus)[i] = ecu;
+	}
+	if (b->overflow)
+		return;
+	uint32_t val_list = 0;
+	if (sig->val_list) {
+		const val_offset_t key = { .val = sig->val_list };
+		const val_offset_t *v = bsearch(&key, vals, val_count, sizeof(*vals), val_offset_compare);
+		assert(v);
+		val_list = v->offset;
+	}
+	image_signal_t *s = AT(b, image_signal_t, offset);
+	s->scaling    = sig->scaling;
+	s->offset     = sig->offset;
+	s->minimum    = sig->minimum;
+	s->maximum    = sig->maximum;
+	s->name       = name;
+	s->units      = units;
+	s->comment    = comment;
+	s->ecu_count  = sig->ecu_count;
+	s->ecus       = ecus;
+	s->bit_length = sig->bit_length;
+	s->start_bit  = sig->start_bit;
+	s->flags      = signal_flags(sig);
+	s->sigval     = sig->sigval;
+	s->switchval  = sig->switchval;
+	s->val_list   = val_list;
+}
+
+static void msg2bin(builder_t *b, uint32_t offset, const can_msg_t *msg, const val_offset_t *vals, size_t val_count)
+{
+	assert(b);
+	assert(msg);
+	const uint32_t name = string(b, msg->name), ecu = string(b, msg->ecu), comment = string(b, msg->comment);
+	const uint32_t sigs = array(b, msg->signal_count, sizeof(image_signal_t));
+	for (size_t i = 0; i < msg->signal_count && !b->overflow; i++)
+		signal2bin(b, sigs + i * sizeof(image_signal_t), msg->sigs[i], vals, val_count);
+	if (b->overflow)
+		return;
+	image_message_t *m = AT(b, image_message_t, offset);
+	m->name         = name;
+	m->ecu          = ecu;
+	m->comment      = comment;
+	m->id           = msg->id;
+	m->dlc          = msg->dlc;
+	m->signal_count = msg->signal_count;
+	m->signals      = sigs;
+}
+
+static void vals2bin(builder_t *b, uint32_t offset, const dbc_t *dbc, val_offset_t *vals)
+{
+	assert(b);
+	assert(dbc);
+	for (size_t i = 0; i < dbc->val_count && !b->overflow; i++) {
+		const val_list_t *v = dbc->vals[i];
+		const uint32_t name = string(b, v->name);
+		const uint32_t items = array(b, v->val_list_item_count, sizeof(image_val_item_t));
+		for (size_t j = 0; j < v->val_list_item_count; j++) {
+			const uint32_t item = string(b, v->val_list_items[j]->name);
+			if (b->overflow)
+				return;
+			AT(b, image_val_item_t, items)[j].name  = item;
+			AT(b, image_val_item_t, items)[j].value = v->val_list_items[j]->value;
+		}
+		if (b->overflow)
+			return;
+		vals[i].val = v;
+		vals[i].offset = offset + i * sizeof(image_val_list_t);
+		image_val_list_t *l = AT(b, image_val_list_t, vals[i].offset);
+		l->name = name;
+		l->id = v->id;
+		l->item_count = v->val_list_item_count;
+		l->items = items;
+	}
+}
+
+int dbc2bin(dbc_t *dbc, FILE *output)
+{
+	assert(dbc);
+	assert(output);
+	builder_t b = { .data = NULL };
+	val_offset_t *vals = allocate(sizeof(*vals) * (dbc->val_count + 1));
+	index_t *index = allocate(sizeof(*index) * (dbc->message_count + 1));
+	int r = 0;
+
+	const uint32_t header  = reserve(&b, sizeof(image_header_t), 8);
+	const uint32_t msgs    = array(&b, dbc->message_count, sizeof(image_message_t));
+	const uint32_t sorted  = array(&b, dbc->message_count, sizeof(uint32_t));
+	const uint32_t vlists  = array(&b, dbc->val_count, sizeof(image_val_list_t));
+	const uint32_t sigvals = array(&b, dbc->sigval_count, sizeof(image_sigval_t));
+
+	vals2bin(&b, vlists, dbc, vals);
+	qsort(vals, dbc->val_count, sizeof(*vals), val_offset_compare);
+
+	for (size_t i = 0; i < dbc->sigval_count && !b.overflow; i++) {
+		const uint32_t name = string(&b, dbc->sigvals[i].name);
+		if (b.overflow)
+			break;
+		image_sigval_t *s = AT(&b, image_sigval_t, sigvals + i * sizeof(image_sigval_t));
+		s->id = dbc->sigvals[i].id;
+		s->name = name;
+		s->type = dbc->sigvals[i].type;
+	}
+
+	for (size_t i = 0; i < dbc->message_count && !b.overflow; i++)
+		msg2bin(&b, msgs + i * sizeof(image_message_t), dbc->messages[i], vals, dbc->val_count);
+
+	for (size_t i = 0; i < dbc->message_count; i++)
+		index[i] = (index_t){ .id = dbc->messages[i]->id, .message = i };
+	qsort(index, dbc->message_count, sizeof(*index), index_compare);
+
+	reserve(&b, 0, 8); /* pad the image out to a whole record */
+	if (b.overflow) {
+		warning("image too large");
+		r = -1;
+		goto done;
+	}
+	for (size_t i = 0; i < dbc->message_count; i++)
+		AT(&b, uint32_t, sorted)[i] = index[i].message;
+
+	image_header_t *h = AT(&b, image_header_t, header);
+	memcpy(h->magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+	h->version       = IMAGE_VERSION;
+	h->byte_order    = IMAGE_BYTE_ORDER;
+	h->size          = b.used;
+	h->flags         = dbc->use_float ? IMAGE_FLAG_USE_FLOAT : 0;
+	h->message_count = dbc->message_count;
+	h->messages      = msgs;
+	h->index         = sorted;
+	h->val_count     = dbc->val_count;
+	h->vals          = vlists;
+	h->sigval_count  = dbc->sigval_count;
+	h->sigvals       = sigvals;
+
+	errno = 0;
+	if (fwrite(b.data, 1, b.used, output) != b.used) {
+		warning("problem writing image: %s", emsg());
+		r = -1;
+	}
+done:
+	free(b.data);
+	free(vals);
+	free(index);
+	return r;
+}
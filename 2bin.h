@@ -0,0 +1,16 @@
+#ifndef _2BIN_H
+#define _2BIN_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "can.h"
+
+int dbc2bin(dbc_t *dbc, FILE *output);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
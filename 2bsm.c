@@ -4,9 +4,9 @@
  * @license MIT *
  */
 #include "2bsm.h"
+#include "buffer.h"
 #include "util.h"
 #include <assert.h>
-#include <time.h>
 
 /*
 Add:
@@ -106,13 +106,9 @@ Add:
 	return 0;
 }*/
 
-static int indent(FILE * o, unsigned depth)
+static int indent(buffer_t * b, unsigned depth)
 {
-	assert(o);
-	while (depth--)
-		if (fputc('\t', o) != '\t')
-			return -1;
-	return 0;
+	return buffer_repeat(b, '\t', depth);
 }
 
 /*static int pnode(FILE * o, unsigned depth, const char *node, const char *fmt, ...)
@@ -142,54 +138,47 @@ static int indent(FILE * o, unsigned depth)
 	return -1;
 }*/
 
-static int comment(FILE * o, unsigned depth, const char *fmt, ...)
+static int comment(buffer_t * b, unsigned depth, const char *s)
 {
-	assert(o);
-	assert(fmt);
-	va_list args;
-	assert(o && fmt);
-	errno = 0;
-	if (indent(o, depth) < 0)
-		goto warn;
-	if (fputs("<!-- ", o) < 0)
-		goto warn;
-	assert(fmt);
-	va_start(args, fmt);
-	int r = vfprintf(o, fmt, args);
-	va_end(args);
-	if (r < 0)
-		goto warn;
-	if (fputs(" -->\n", o) < 0)
-		goto warn;
-	return 0;
- warn:
-	warning("XML comment generation, problem writing to FILE* <%p>: %s", o,
-		emsg());
-	return -1;
+	assert(s);
+	indent(b, depth);
+	buffer_string(b, "<!-- ");
+	buffer_string(b, s);
+	return buffer_string(b, " -->\n");
+}
+
+static int bb(buffer_t * b, const char *name, const char *part, unsigned size)
+{
+	buffer_string(b, "									<BB Name=\"");
+	buffer_string(b, name);
+	buffer_string(b, part);
+	buffer_string(b, "\" Bits=\"0\" Size=\"");
+	buffer_unsigned(b, size);
+	return buffer_string(b, "\" />\n");
 }
 
-static int signal2bsm(signal_t * sig, FILE * o, unsigned depth)
+static int signal2bsm(signal_t * sig, buffer_t * b, unsigned depth)
 {
 	assert(sig);
-	assert(o);
+	assert(b);
 	UNUSED(depth); /**@todo use depth */
 
 	if (sig->bit_length > 16) {
 		// We need to split it into two, because we assume a <BB> is a 16 bit element (0xXX 0x00)
-		fprintf(o, "									<BB Name=\"%s (LSB)\" Bits=\"0\" Size=\"%d\" />\n", sig->name, 16);
-		fprintf(o, "									<BB Name=\"%s (MSB)\" Bits=\"0\" Size=\"%d\" />\n", sig->name, sig->bit_length - 16);
+		bb(b, sig->name, " (LSB)", 16);
+		bb(b, sig->name, " (MSB)", sig->bit_length - 16);
 	} else {
-		fprintf(o, "									<BB Name=\"%s\" Bits=\"0\" Size=\"%d\" />\n", sig->name, sig->bit_length);
+		bb(b, sig->name, "", sig->bit_length);
 	}
 
 	return 0;
 }
 
-static int msg2bsm(can_msg_t * msg, FILE * o, unsigned depth)
+static int msg2bsm(can_msg_t * msg, buffer_t * b, unsigned depth)
 {
 	assert(msg);
-	assert(o);
-	indent(o, depth);
+	assert(b);
+	indent(b, depth);
 
 	unsigned last_bit = 0;	// Detect gaps between signals
 
@@ -218,7 +207,7 @@ static int msg2bsm(can_msg_t * msg, FILE * o, unsigned depth)
 		padding_size = 32;
 	}
 
-	fprintf(o, BSM_MESSAGE_PREFIX, msg->name, msg->id, msg->id, padding_size);
+	buffer_printf(b, BSM_MESSAGE_PREFIX, msg->name, msg->id, msg->id, padding_size);
 
 	last_bit = 0;
 	signal_t *multiplexor = NULL;
@@ -245,13 +234,13 @@ static int msg2bsm(can_msg_t * msg, FILE * o, unsigned depth)
 			unknownsig.start_bit = last_bit;
 			unknownsig.bit_length = sig->start_bit - last_bit;
 
-			if (signal2bsm(&unknownsig, o, depth + 1) < 0)
+			if (signal2bsm(&unknownsig, b, depth + 1) < 0)
 				return -1;
 
 			last_bit = sig->start_bit;
 		}
 		// Generate a Signal element
-		if (signal2bsm(sig, o, depth + 1) < 0)
+		if (signal2bsm(sig, b, depth + 1) < 0)
 			return -1;
 
 		last_bit = sig->start_bit + sig->bit_length;
@@ -284,9 +273,7 @@ static int msg2bsm(can_msg_t * msg, FILE * o, unsigned depth)
 	   fprintf(o, "</multiplexor-group>\n");
 	   } */
 
-	if (fprintf(o, BSM_MESSAGE_SUFFIX) < 0)
-		return -1;
-	return 0;
+	return buffer_string(b, BSM_MESSAGE_SUFFIX);
 }
 
 int dbc2bsm(dbc_t * dbc, FILE * output, bool use_time_stamps)
@@ -294,22 +281,26 @@ int dbc2bsm(dbc_t * dbc, FILE * output, bool use_time_stamps)
 	assert(dbc);
 	assert(output);
 	/**@todo print out ECU node information, and the standard XML header */
-	time_t rawtime = time(NULL);
-	struct tm *timeinfo = localtime(&rawtime);
+	char stamp[TIME_STAMP_LENGTH];
+	buffer_t *b = buffer_new(output);
 
-	comment(output, 0, "Generated by dbcc (see https://github.com/howerj/dbcc)");
-	fprintf(output, BSM_PREFIX);
+	comment(b, 0, "Generated by dbcc (see https://github.com/howerj/dbcc)");
+	buffer_string(b, BSM_PREFIX);
 
-	if (use_time_stamps)
-		comment(output, 0, "Generated on: %s", asctime(timeinfo));
+	if (use_time_stamps) {
+		buffer_string(b, "<!-- Generated on: ");
+		buffer_string(b, time_stamp(stamp));
+		buffer_string(b, " -->\n");
+	}
 
 	for (size_t i = 0; i < dbc->message_count; i++) {
-		if (msg2bsm(dbc->messages[i], output, 1) < 0) {
+		if (msg2bsm(dbc->messages[i], b, 1) < 0) {
+			buffer_delete(b);
 			return -1;
 		}
 	}
 
-	fprintf(output, BSM_SUFFIX);
+	buffer_string(b, BSM_SUFFIX);
 
-	return 0;
+	return buffer_delete(b);
 }
@@ -19,13 +19,18 @@
  * code. The entire program really should be written in a language like Perl or
  * Python, but I wanted to use the MPC library for something, so here we are. */
 
+#if defined(__unix__) || defined(__APPLE__)
+#define _POSIX_C_SOURCE 200809L /* for 'open_memstream' */
+#define HAVE_MEMSTREAM
+#endif
 #include "2c.h"
+#include "filter.h"
+#include "pool.h"
 #include "util.h"
 #include <assert.h>
 #include <ctype.h>
 #include <inttypes.h>
 #include <string.h>
-#include <time.h>
 
 #define MAX_NAME_LENGTH (512u)
 
@@ -326,16 +331,23 @@ static int64_t signed_min(signal_t *sig)
 	return ~signed_max(sig);
 }
 
+/* the type of the value given to 'encode_' and got from 'decode_' functions */
+static const char *scaled_type(signal_t *sig, dbc2c_options_t *copts)
+{
+	assert(sig);
+	assert(copts);
+	if (copts->use_doubles_for_encoding || sig->scaling != 1.0 || sig->offset != 0.0)
+		return "double";
+	return determine_type(sig->bit_length, sig->is_signed);
+}
+
 static int signal2scaling_encode(const char *msgname, unsigned id, signal_t *sig, FILE *o, bool header, const char *god, dbc2c_options_t *copts) 
 {
 	assert(msgname);
 	assert(sig);
 	assert(o);
 	assert(copts);
-	const char *type = determine_type(sig->bit_length, sig->is_signed);
-	if (sig->scaling != 1.0 || sig->offset != 0.0)
-		type = "double";
-	fprintf(o, "int encode_can_0x%03x_%s(can_obj_%s_t *o, %s in)", id, sig->name, god, copts->use_doubles_for_encoding ? "double" : type);
+	fprintf(o, "int encode_can_0x%03x_%s(can_obj_%s_t *o, %s in)", id, sig->name, god, scaled_type(sig, copts));
 	if (header)
 		return fputs(";\n", o);
 	fputs(" {\n", o);
@@ -385,7 +397,7 @@ static int signal2scaling_decode(const char *msgname, unsigned id, signal_t *sig
 	const char *type = determine_type(sig->bit_length, sig->is_signed);
 	if (sig->scaling != 1.0 || sig->offset != 0.0)
 		type = "double";
-	fprintf(o, "int decode_can_0x%03x_%s(const can_obj_%s_t *o, %s *out)", id, sig->name, god, copts->use_doubles_for_encoding ? "double" : type);
+	fprintf(o, "int decode_can_0x%03x_%s(const can_obj_%s_t *o, %s *out)", id, sig->name, god, scaled_type(sig, copts));
 	if (header)
 		return fputs(";\n", o);
 	fputs(" {\n", o);
@@ -452,14 +464,15 @@ static int signal2scaling(const char *msgname, unsigned id, signal_t *sig, FILE
 	return signal2scaling_encode(msgname, id, sig, o, header, god, copts);
 }
 
-static int print_function_name(FILE *out, const char *prefix, const char *name, const char *postfix, bool in, char *datatype, bool dlc, const char *god)
+static int print_function_name(FILE *out, const char *prefix, const char *name, const char *postfix, bool in, char *datatype, bool dlc, const char *god, bool external)
 {
 	assert(out);
 	assert(prefix); 
 	assert(name); 
 	assert(god); 
 	assert(postfix);
-	return fprintf(out, "static int %s_%s(can_obj_%s_t *o, %s %sdata%s)%s",
+	return fprintf(out, "%sint %s_%s(can_obj_%s_t *o, %s %sdata%s)%s",
+			external ? "" : "static ",
 			prefix, name, god, datatype,
 			in ? "" : "*",
 			dlc ? ", uint8_t dlc, dbcc_time_stamp_t time_stamp" : "",
@@ -584,7 +597,7 @@ static int msg_pack(can_msg_t *msg, FILE *c, const char *name, bool motorola_use
 	assert(name);
 	assert(copts);
 	const bool message_has_signals = motorola_used || intel_used;
-	print_function_name(c, "pack", name, " {\n", false, "uint64_t", false, god);
+	print_function_name(c, "pack", name, " {\n", false, "uint64_t", false, god, copts->split > 0);
 	if (copts->generate_asserts) {
 		fprintf(c, "\tassert(o);\n");
 		fprintf(c, "\tassert(data);\n");
@@ -623,7 +636,7 @@ static int msg_unpack(can_msg_t *msg, FILE *c, const char *name, bool motorola_u
 	assert(name);
 	assert(copts);
 	const bool message_has_signals = motorola_used || intel_used;
-	print_function_name(c, "unpack", name, " {\n", true, "uint64_t", true, god);
+	print_function_name(c, "unpack", name, " {\n", true, "uint64_t", true, god, copts->split > 0);
 	if (copts->generate_asserts) {
 		fprintf(c, "\tassert(o);\n");
 		fprintf(c, "\tassert(dlc <= 8);\n");
@@ -697,7 +710,7 @@ static int msg_dlc_check(can_msg_t *msg) {
 	return 0;
 }
 
-static int msg2c(can_msg_t *msg, FILE *c, dbc2c_options_t *copts, char *god)
+static int msg2c(can_msg_t *msg, FILE *c, dbc2c_options_t *copts, const char *god)
 {
 	assert(msg);
 	assert(c);
@@ -714,13 +727,6 @@ static int msg2c(can_msg_t *msg, FILE *c, dbc2c_options_t *copts, char *god)
 		else
 			intel_used = true;
 
-	/* sanity checks against messages should go here, we could check for;
-	 * - odd min/max values given scaling
-	 * - duplicate signals and messages
-	 * They really should go into a semantic analysis phase after reading
-	 * in the DBC file and parsing it. Oh Well. */
-	msg_dlc_check(msg);
-
 	if (copts->generate_pack && msg_pack(msg, c, name, motorola_used, intel_used, god, copts) < 0)
 		return -1;
 
@@ -913,7 +919,164 @@ fail:
 	return NULL;
 }
 
-int dbc2c(dbc_t *dbc, FILE *c, FILE *h, const char *name, dbc2c_options_t *copts)
+typedef struct {
+	dbc_t *dbc;
+	dbc2c_options_t *copts;
+	const char *god;
+	size_t begin;   /**< index of the first message to emit */
+	bool header;    /**< 'msg2h' if true, 'msg2c' otherwise */
+	char **text;    /**< output for each message */
+	size_t *length; /**< length of each output */
+	int *rv;        /**< return value for each message */
+} emit_t;
+
+static int emit_message(emit_t *e, size_t index, FILE *o)
+{
+	assert(e);
+	assert(o);
+	can_msg_t *msg = e->dbc->messages[e->begin + index];
+	return e->header ?
+		msg2h(msg, o, e->copts, e->god) :
+		msg2c(msg, o, e->copts, e->god);
+}
+
+#ifdef HAVE_MEMSTREAM
+static void emit_message_job(void *context, size_t index, unsigned worker)
+{
+	UNUSED(worker);
+	emit_t *e = context;
+	FILE *o = open_memstream(&e->text[index], &e->length[index]);
+	if (!o)
+		error("open_memstream failed: %s", emsg());
+	e->rv[index] = emit_message(e, index, o);
+	if (fclose(o) < 0)
+		error("open_memstream failed: %s", emsg());
+}
+#endif
+
+/* The messages are independent of each other, so they are rendered into
+ * memory on a thread pool and then written out in order, which gives the
+ * same output as writing them out one after another. Messages are modified
+ * by 'msg2c' (the signals are sorted), so all of the 'msg2h' output must be
+ * done before any 'msg2c'. Messages 'begin' up to 'end' are emitted. */
+static int emit_messages(dbc_t *dbc, size_t begin, size_t end, FILE *o, bool header, const char *god, dbc2c_options_t *copts)
+{
+	assert(dbc);
+	assert(o);
+	assert(god);
+	assert(copts);
+	assert(begin <= end && end <= dbc->message_count);
+	emit_t e = { .dbc = dbc, .copts = copts, .god = god, .begin = begin, .header = header };
+	const size_t count = end - begin;
+#ifdef HAVE_MEMSTREAM
+	if (pool_threads(copts->threads, count) > 1) {
+		e.text   = allocate(sizeof(*e.text) * count);
+		e.length = allocate(sizeof(*e.length) * count);
+		e.rv     = allocate(sizeof(*e.rv) * count);
+		pool_run(count, copts->threads, emit_message_job, &e);
+		int rv = 0;
+		for (size_t i = 0; i < count; i++) {
+			if (rv == 0 && e.rv[i] < 0)
+				rv = -1;
+			if (rv == 0 && fwrite(e.text[i], 1, e.length[i], o) != e.length[i])
+				rv = -1;
+			free(e.text[i]);
+		}
+		free(e.text);
+		free(e.length);
+		free(e.rv);
+		return rv;
+	}
+#endif
+	for (size_t i = 0; i < count; i++)
+		if (emit_message(&e, i, o) < 0)
+			return -1;
+	return 0;
+}
+
+static int c_preamble(FILE *c, const char *name, bool use_float, dbc2c_options_t *copts)
+{
+	assert(c);
+	assert(name);
+	assert(copts);
+	fputs("/* Generated by DBCC, see <https://github.com/howerj/dbcc> */\n", c);
+	fprintf(c, "#include \"%s\"\n", name);
+	fprintf(c, "#include <inttypes.h>\n");
+	if (use_float)
+		fprintf(c, "#include <math.h> /* uses macros NAN, INFINITY, signbit, no need for -lm */\n");
+	if (copts->generate_asserts)
+		fprintf(c, "#include <assert.h>\n");
+	fputc('\n', c);
+	fprintf(c, "#define UNUSED(X) ((void)(X))\n\n");
+	fputs(cfunctions, c);
+	if (copts->generate_print)
+		fputs(cfunctions_print_only, c);
+
+	if (copts->generate_unpack && use_float)
+		fputs(float_unpack, c);
+	if (copts->generate_pack && use_float)
+		return fputs(float_pack, c);
+	return 0;
+}
+
+static bool messages_use_float(dbc_t *dbc, size_t begin, size_t end)
+{
+	assert(dbc);
+	for (size_t i = begin; i < end; i++)
+		for (size_t j = 0; j < dbc->messages[i]->signal_count; j++)
+			if (dbc->messages[i]->sigs[j]->is_floating)
+				return true;
+	return false;
+}
+
+/* Messages are split into contiguous ranges of IDs with about the same number
+ * of signals in each, which is roughly how long each file takes to compile,
+ * this returns the index one past the last message of 'shard'. */
+static size_t shard_end(dbc_t *dbc, size_t shard, size_t shards)
+{
+	assert(dbc);
+	assert(shard < shards);
+	if (shard == shards - 1)
+		return dbc->message_count;
+	size_t total = 0, weight = 0, i = 0;
+	for (i = 0; i < dbc->message_count; i++)
+		total += 1 + dbc->messages[i]->signal_count;
+	const size_t target = (total * (shard + 1)) / shards;
+	for (i = 0; i < dbc->message_count && weight < target; i++)
+		weight += 1 + dbc->messages[i]->signal_count;
+	return i;
+}
+
+/* When split the source file given to 'dbc2c' only contains the functions
+ * that dispatch on the message ID, the per message functions they call are
+ * in the other files and have external linkage. */
+static int dispatcher_preamble(FILE *c, dbc_t *dbc, const char *name, const char *god, dbc2c_options_t *copts)
+{
+	assert(c);
+	assert(dbc);
+	assert(name);
+	assert(god);
+	assert(copts);
+	fputs("/* Generated by DBCC, see <https://github.com/howerj/dbcc> */\n", c);
+	fprintf(c, "#include \"%s\"\n", name);
+	if (copts->generate_asserts)
+		fprintf(c, "#include <assert.h>\n");
+	fputc('\n', c);
+	for (size_t i = 0; i < dbc->message_count; i++) {
+		can_msg_t *msg = dbc->messages[i];
+		char mname[MAX_NAME_LENGTH] = {0};
+		make_name(mname, MAX_NAME_LENGTH, msg->name, msg->id);
+		if (copts->generate_pack)
+			print_function_name(c, "pack", mname, ";\n", false, "uint64_t", false, god, true);
+		if (copts->generate_unpack)
+			print_function_name(c, "unpack", mname, ";\n", true, "uint64_t", true, god, true);
+		if (copts->generate_print)
+			fprintf(c, "int print_%s(const can_obj_%s_t *o, FILE *output);\n", mname, god);
+	}
+	return fputc('\n', c) < 0 ? -1 : 0;
+}
+
+int dbc2c(dbc_t *dbc, FILE *c, FILE *h, FILE **shards, const char *name, dbc2c_options_t *copts)
 {
 	/**@todo print out ECU node information */
 	assert(dbc);
@@ -922,8 +1085,7 @@ int dbc2c(dbc_t *dbc, FILE *c, FILE *h, const char *name, dbc2c_options_t *copts
 	assert(name);
 	assert(copts);
 	int rv = 0;
-	time_t rawtime = time(NULL);
-	struct tm *timeinfo = localtime(&rawtime); // This is not considered safe on Visual Studio
+	char stamp[TIME_STAMP_LENGTH];
 	char *god = NULL;
 	char *file_guard = duplicate(name);
 	const size_t file_guard_len = strlen(file_guard);
@@ -947,7 +1109,7 @@ int dbc2c(dbc_t *dbc, FILE *c, FILE *h, const char *name, dbc2c_options_t *copts
 	/* header file (begin) */
 	fprintf(h, "/** CAN message encoder/decoder: automatically generated - do not edit\n");
 	if (copts->use_time_stamps)
-		fprintf(h, "  * @note  Generated on %s", asctime(timeinfo));
+		fprintf(h, "  * @note  Generated on %s", time_stamp(stamp));
 
 	fprintf(h,
 		"  * Generated by dbcc: See https://github.com/howerj/dbcc */\n"
@@ -972,7 +1134,10 @@ int dbc2c(dbc_t *dbc, FILE *c, FILE *h, const char *name, dbc2c_options_t *copts
 
 	fprintf(h, "#ifndef DBCC_TIME_STAMP\n");
 	fprintf(h, "#define DBCC_TIME_STAMP\n");
-	fprintf(h, "typedef uint32_t dbcc_time_stamp_t; /* Time stamp for message; you decide on units */\n");
+	if (copts->time_stamp_ns)
+		fprintf(h, "typedef uint64_t dbcc_time_stamp_t; /* Time stamp for message in nanoseconds, it will not wrap */\n");
+	else
+		fprintf(h, "typedef uint32_t dbcc_time_stamp_t; /* Time stamp for message; you decide on units */\n");
 	fprintf(h, "#endif\n\n");
 
 	fprintf(h, "#ifndef DBCC_STATUS_ENUM\n");
@@ -1006,9 +1171,10 @@ int dbc2c(dbc_t *dbc, FILE *c, FILE *h, const char *name, dbc2c_options_t *copts
 
 	fputs("\n", h);
 
-	for (size_t i = 0; i < dbc->message_count; i++)
-		if (msg2h(dbc->messages[i], h, copts, god) < 0)
-			return -1;
+	if (emit_messages(dbc, 0, dbc->message_count, h, true, god, copts) < 0) {
+		rv = -1;
+		goto fail;
+	}
 
 	fputs(
 		"#ifdef __cplusplus\n"
@@ -1019,29 +1185,37 @@ int dbc2c(dbc_t *dbc, FILE *c, FILE *h, const char *name, dbc2c_options_t *copts
 	/* header file (end) */
 
 	/* C FILE */
-	fputs("/* Generated by DBCC, see <https://github.com/howerj/dbcc> */\n", c);
-	fprintf(c, "#include \"%s\"\n", name);
-	fprintf(c, "#include <inttypes.h>\n");
-	if (dbc->use_float)
-		fprintf(c, "#include <math.h> /* uses macros NAN, INFINITY, signbit, no need for -lm */\n");
-	if (copts->generate_asserts)
-		fprintf(c, "#include <assert.h>\n");
-	fputc('\n', c);
-	fprintf(c, "#define UNUSED(X) ((void)(X))\n\n");
-	fputs(cfunctions, c);
-	if (copts->generate_print)
-		fputs(cfunctions_print_only, c);
-
-	if (copts->generate_unpack && dbc->use_float)
-		fputs(float_unpack, c);
-	if (copts->generate_pack && dbc->use_float)
-		fputs(float_pack, c);
-
+	/* sanity checks against messages should go here, we could check for;
+	 * - odd min/max values given scaling
+	 * - duplicate signals and messages
+	 * They really should go into a semantic analysis phase after reading
+	 * in the DBC file and parsing it. Oh Well. */
 	for (size_t i = 0; i < dbc->message_count; i++)
-		if (msg2c(dbc->messages[i], c, copts, god) < 0) {
+		msg_dlc_check(dbc->messages[i]);
+
+	if (copts->split) {
+		assert(shards);
+		if (dispatcher_preamble(c, dbc, name, god, copts) < 0) {
+			rv = -1;
+			goto fail;
+		}
+		for (size_t i = 0, begin = 0; i < copts->split; i++) {
+			assert(shards[i]);
+			const size_t end = shard_end(dbc, i, copts->split);
+			c_preamble(shards[i], name, dbc->use_float && messages_use_float(dbc, begin, end), copts);
+			if (emit_messages(dbc, begin, end, shards[i], false, god, copts) < 0) {
+				rv = -1;
+				goto fail;
+			}
+			begin = end;
+		}
+	} else {
+		c_preamble(c, name, dbc->use_float, copts);
+		if (emit_messages(dbc, 0, dbc->message_count, c, false, god, copts) < 0) {
 			rv = -1;
 			goto fail;
 		}
+	}
 
 	if (copts->generate_unpack)
 		switch_function(c, dbc, "unpack", true, false, "uint64_t", true, god, copts);
@@ -1058,3 +1232,574 @@ fail:
 	return rv;
 }
 
+
+static const char *bench_preamble =
+"typedef struct {\n"
+"\tconst char *name;\n"
+"\tunsigned long id;\n"
+"\tuint8_t dlc;\n"
+"\tunsigned signals;\n"
+"\tint (*payload)(bench_obj_t *o, uint64_t random, uint64_t *data);\n"
+"\tint (*decode)(const bench_obj_t *o, double *out);\n"
+"\tint (*encode)(bench_obj_t *o, const double *in);\n"
+"} bench_message_t;\n\n"
+"static uint64_t bench_state = 0x9E3779B97F4A7C15ull;\n\n"
+"static uint64_t bench_random(void) { /* xorshift64*, so runs are repeatable */\n"
+"\tbench_state ^= bench_state >> 12;\n"
+"\tbench_state ^= bench_state << 25;\n"
+"\tbench_state ^= bench_state >> 27;\n"
+"\treturn bench_state * 2685821657736338717ull;\n"
+"}\n\n";
+
+static const char *bench_driver =
+"#ifndef BENCH_ITERATIONS\n"
+"#define BENCH_ITERATIONS (100000ul)\n"
+"#endif\n"
+"#define BENCH_PAYLOADS   (64u) /* different payloads each message is run with */\n"
+"#define BENCH_PRINT_DIV  (16u) /* printing is far slower, so it is run less */\n"
+"\n"
+"#ifdef _WIN32\n"
+"#define BENCH_NULL \"NUL\"\n"
+"#else\n"
+"#define BENCH_NULL \"/dev/null\"\n"
+"#endif\n"
+"\n"
+"enum { BENCH_UNPACK, BENCH_DECODE, BENCH_ENCODE, BENCH_PACK, BENCH_PRINT, BENCH_APIS };\n"
+"enum { BENCH_CYCLES, BENCH_INSTRUCTIONS, BENCH_BRANCH_MISSES, BENCH_L1D_MISSES, BENCH_COUNTERS };\n"
+"\n"
+"static const char *bench_apis[BENCH_APIS] = { \"unpack\", \"decode\", \"encode\", \"pack\", \"print\" };\n"
+"static const char *bench_counters[BENCH_COUNTERS] = { \"cycles\", \"instructions\", \"branch_misses\", \"l1d_misses\" };\n"
+"static int bench_fds[BENCH_COUNTERS] = { -1, -1, -1, -1 }; /* -1 if a counter is unavailable */\n"
+"\n"
+"static volatile uint64_t bench_sink; /* stops results being optimized out */\n"
+"static bench_obj_t bench_obj;\n"
+"\n"
+"typedef struct {\n"
+"\tdouble ns[BENCH_APIS];\n"
+"\tdouble counts[BENCH_APIS][BENCH_COUNTERS];\n"
+"} bench_result_t;\n"
+"\n"
+"typedef struct {\n"
+"\tdouble t;\n"
+"\tuint64_t counts[BENCH_COUNTERS];\n"
+"} bench_mark_t;\n"
+"\n"
+"/* Hardware counters for this thread in user space only, which is allowed\n"
+" * with the default 'perf_event_paranoid' setting, those that cannot be\n"
+" * opened (in containers and virtual machines usually none can be) are left\n"
+" * out and only the time is measured. */\n"
+"static void bench_counters_open(void) {\n"
+"#ifdef BENCH_PERF\n"
+"\tstatic const struct { uint32_t type; uint64_t config; } events[BENCH_COUNTERS] = {\n"
+"\t\t{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },\n"
+"\t\t{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },\n"
+"\t\t{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },\n"
+"\t\t{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },\n"
+"\t};\n"
+"\tfor (int i = 0; i < BENCH_COUNTERS; i++) {\n"
+"\t\tstruct perf_event_attr attr;\n"
+"\t\tmemset(&attr, 0, sizeof(attr));\n"
+"\t\tattr.size = sizeof(attr);\n"
+"\t\tattr.type = events[i].type;\n"
+"\t\tattr.config = events[i].config;\n"
+"\t\tattr.exclude_kernel = 1;\n"
+"\t\tattr.exclude_hv = 1;\n"
+"\t\tbench_fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);\n"
+"\t}\n"
+"#endif\n"
+"}\n"
+"\n"
+"static void bench_counters_close(void) {\n"
+"\tfor (int i = 0; i < BENCH_COUNTERS; i++) {\n"
+"#ifdef BENCH_PERF\n"
+"\t\tif (bench_fds[i] >= 0)\n"
+"\t\t\tclose(bench_fds[i]);\n"
+"#endif\n"
+"\t\tbench_fds[i] = -1;\n"
+"\t}\n"
+"}\n"
+"\n"
+"static void bench_counters_read(uint64_t *counts) {\n"
+"\tfor (int i = 0; i < BENCH_COUNTERS; i++) {\n"
+"\t\tcounts[i] = 0;\n"
+"#ifdef BENCH_PERF\n"
+"\t\tif (bench_fds[i] >= 0 && read(bench_fds[i], &counts[i], sizeof(counts[i])) != sizeof(counts[i]))\n"
+"\t\t\tcounts[i] = 0;\n"
+"#endif\n"
+"\t}\n"
+"}\n"
+"\n"
+"static double bench_now(void) { /* nanoseconds */\n"
+"#ifdef CLOCK_MONOTONIC\n"
+"\tstruct timespec ts;\n"
+"\tclock_gettime(CLOCK_MONOTONIC, &ts);\n"
+"\treturn ts.tv_sec * 1e9 + ts.tv_nsec;\n"
+"#else\n"
+"\treturn (double)clock() / CLOCKS_PER_SEC * 1e9;\n"
+"#endif\n"
+"}\n"
+"\n"
+"static void bench_start(bench_mark_t *m) {\n"
+"\tbench_counters_read(m->counts);\n"
+"\tm->t = bench_now();\n"
+"}\n"
+"\n"
+"static void bench_stop(const bench_mark_t *m, bench_result_t *r, int api) {\n"
+"\tconst double t = bench_now();\n"
+"\tuint64_t counts[BENCH_COUNTERS];\n"
+"\tbench_counters_read(counts);\n"
+"\tr->ns[api] += t - m->t;\n"
+"\tfor (int i = 0; i < BENCH_COUNTERS; i++)\n"
+"\t\tr->counts[api][i] += counts[i] - m->counts[i];\n"
+"}\n"
+"\n"
+"static void bench_scale(bench_result_t *r, int api, double by) {\n"
+"\tr->ns[api] /= by;\n"
+"\tfor (int i = 0; i < BENCH_COUNTERS; i++)\n"
+"\t\tr->counts[api][i] /= by;\n"
+"}\n"
+"\n"
+"static int bench_print(const bench_result_t *r) {\n"
+"\tfor (int i = 0; i < BENCH_APIS; i++) {\n"
+"\t\tprintf(\"%s\\\"%s\\\": { \\\"ns\\\": %.3f, \\\"fps\\\": %.0f\", i ? \", \" : \"\", bench_apis[i], r->ns[i], r->ns[i] > 0 ? 1e9 / r->ns[i] : 0);\n"
+"\t\tfor (int j = 0; j < BENCH_COUNTERS; j++)\n"
+"\t\t\tif (bench_fds[j] >= 0)\n"
+"\t\t\t\tprintf(\", \\\"%s\\\": %.2f\", bench_counters[j], r->counts[i][j]);\n"
+"\t\tprintf(\" }\");\n"
+"\t}\n"
+"\treturn 0;\n"
+"}\n"
+"\n";
+
+static const char *bench_measure =
+"/* Compare the aggregate figures against those in a baseline made by an\n"
+" * earlier run, returns non zero if any of them are 'tolerance' percent slower */\n"
+"static int bench_compare(const char *file, const double *ns, double tolerance) {\n"
+"\tFILE *f = fopen(file, \"rb\");\n"
+"\tif (!f) {\n"
+"\t\tfprintf(stderr, \"bench: cannot open baseline '%s'\\n\", file);\n"
+"\t\treturn 1;\n"
+"\t}\n"
+"\tchar line[1024], *aggregate = NULL; /* the aggregate figures are on one line */\n"
+"\twhile (!aggregate && fgets(line, sizeof(line), f))\n"
+"\t\taggregate = strstr(line, \"\\\"aggregate\\\"\");\n"
+"\tfclose(f);\n"
+"\tint r = 0;\n"
+"\tfor (int i = 0; i < BENCH_APIS; i++) {\n"
+"\t\tchar key[32];\n"
+"\t\tsnprintf(key, sizeof(key), \"\\\"%s\\\": { \\\"ns\\\": \", bench_apis[i]);\n"
+"\t\tconst char *k = aggregate ? strstr(aggregate, key) : NULL;\n"
+"\t\tdouble base = 0;\n"
+"\t\tif (!k || sscanf(k + strlen(key), \"%lf\", &base) != 1) {\n"
+"\t\t\tfprintf(stderr, \"bench: no figure for %s in baseline '%s'\\n\", bench_apis[i], file);\n"
+"\t\t\treturn 1;\n"
+"\t\t}\n"
+"\t\tconst int slower = ns[i] > base * (1.0 + tolerance / 100.0);\n"
+"\t\tfprintf(stderr, \"bench: %-6s %10.3f ns/op, baseline %10.3f ns/op (%+.1f%%)%s\\n\",\n"
+"\t\t\tbench_apis[i], ns[i], base, base > 0 ? (ns[i] / base - 1.0) * 100.0 : 0, slower ? \" REGRESSION\" : \"\");\n"
+"\t\tr |= slower;\n"
+"\t}\n"
+"\treturn r;\n"
+"}\n"
+"\n"
+"static int bench_message(const bench_message_t *b, const uint64_t *payloads, unsigned long reps, unsigned long prints, FILE *null, bench_result_t *result) {\n"
+"\tbench_obj_t *o = &bench_obj;\n"
+"\tstatic double values[BENCH_MAX_SIGNALS];\n"
+"\tbench_mark_t m;\n"
+"\tuint64_t x = 0, data = 0;\n"
+"\tint r = 0;\n"
+"\tbench_start(&m);\n"
+"\tfor (unsigned long i = 0; i < reps * BENCH_PAYLOADS; i++)\n"
+"\t\tr |= unpack_message(o, b->id, payloads[i % BENCH_PAYLOADS], b->dlc, i);\n"
+"\tbench_stop(&m, result, BENCH_UNPACK);\n"
+"\n"
+"\t/* the others work on the unpacked message, so they are timed with each\n"
+"\t * payload unpacked in turn */\n"
+"\tfor (unsigned p = 0; p < BENCH_PAYLOADS; p++) {\n"
+"\t\tunpack_message(o, b->id, payloads[p], b->dlc, 0);\n"
+"\t\tbench_start(&m);\n"
+"\t\tfor (unsigned long i = 0; i < reps; i++)\n"
+"\t\t\tr |= b->decode(o, values);\n"
+"\t\tbench_stop(&m, result, BENCH_DECODE);\n"
+"\t\tbench_start(&m);\n"
+"\t\tfor (unsigned long i = 0; i < reps; i++)\n"
+"\t\t\tr |= b->encode(o, values);\n"
+"\t\tbench_stop(&m, result, BENCH_ENCODE);\n"
+"\t\tbench_start(&m);\n"
+"\t\tfor (unsigned long i = 0; i < reps; i++) {\n"
+"\t\t\tr |= pack_message(o, b->id, &data);\n"
+"\t\t\tx ^= data;\n"
+"\t\t}\n"
+"\t\tbench_stop(&m, result, BENCH_PACK);\n"
+"\t\tbench_start(&m);\n"
+"\t\tfor (unsigned long i = 0; i < prints; i++)\n"
+"\t\t\tr |= print_message(o, b->id, null);\n"
+"\t\tbench_stop(&m, result, BENCH_PRINT);\n"
+"\t}\n"
+"\tbench_sink = x;\n"
+"\tfor (int i = 0; i < BENCH_APIS; i++)\n"
+"\t\tbench_scale(result, i, (i == BENCH_PRINT ? prints : reps) * BENCH_PAYLOADS);\n"
+"\treturn r;\n"
+"}\n"
+"\n";
+
+static const char *bench_main =
+"int main(int argc, char **argv) {\n"
+"\tunsigned long iterations = BENCH_ITERATIONS;\n"
+"\tconst char *baseline = NULL;\n"
+"\tdouble tolerance = 25;\n"
+"\tint counters = 1;\n"
+"\tfor (int i = 1; i < argc; i++) {\n"
+"\t\tif (!strcmp(argv[i], \"-n\") && i + 1 < argc) {\n"
+"\t\t\titerations = strtoul(argv[++i], NULL, 0);\n"
+"\t\t} else if (!strcmp(argv[i], \"-b\") && i + 1 < argc) {\n"
+"\t\t\tbaseline = argv[++i];\n"
+"\t\t} else if (!strcmp(argv[i], \"-t\") && i + 1 < argc) {\n"
+"\t\t\ttolerance = strtod(argv[++i], NULL);\n"
+"\t\t} else if (!strcmp(argv[i], \"-c\")) {\n"
+"\t\t\tcounters = 0;\n"
+"\t\t} else {\n"
+"\t\t\tfprintf(stderr, \"usage: %s [-c] [-n iterations] [-b baseline.json] [-t tolerance%%]\\n\", argv[0]);\n"
+"\t\t\treturn 2;\n"
+"\t\t}\n"
+"\t}\n"
+"\tuint64_t payloads[BENCH_PAYLOADS];\n"
+"\tconst size_t count = sizeof(bench_messages) / sizeof(bench_messages[0]) - 1;\n"
+"\tconst unsigned long reps = iterations / BENCH_PAYLOADS ? iterations / BENCH_PAYLOADS : 1;\n"
+"\tconst unsigned long prints = reps / BENCH_PRINT_DIV ? reps / BENCH_PRINT_DIV : 1;\n"
+"\tbench_result_t total;\n"
+"\tmemset(&total, 0, sizeof(total));\n"
+"\tFILE *null = fopen(BENCH_NULL, \"wb\");\n"
+"\tif (!null) {\n"
+"\t\tfprintf(stderr, \"bench: cannot open %s\\n\", BENCH_NULL);\n"
+"\t\treturn 1;\n"
+"\t}\n"
+"\tif (counters)\n"
+"\t\tbench_counters_open();\n"
+"\n"
+"\tprintf(\"{\\n\\t\\\"name\\\": \\\"%s\\\",\\n\\t\\\"iterations\\\": %lu,\\n\\t\\\"counters\\\": [\", BENCH_NAME, reps * BENCH_PAYLOADS);\n"
+"\tfor (int i = 0, n = 0; i < BENCH_COUNTERS; i++)\n"
+"\t\tif (bench_fds[i] >= 0)\n"
+"\t\t\tprintf(\"%s\\\"%s\\\"\", n++ ? \", \" : \" \", bench_counters[i]);\n"
+"\tprintf(\" ],\\n\\t\\\"messages\\\": [\\n\");\n"
+"\tfor (size_t m = 0; m < count; m++) {\n"
+"\t\tconst bench_message_t *b = &bench_messages[m];\n"
+"\t\tbench_result_t result;\n"
+"\t\tmemset(&result, 0, sizeof(result));\n"
+"\t\tunsigned invalid = 0;\n"
+"\t\tfor (unsigned p = 0; p < BENCH_PAYLOADS; p++)\n"
+"\t\t\tif (b->payload(&bench_obj, bench_random(), &payloads[p]) < 0 || unpack_message(&bench_obj, b->id, payloads[p], b->dlc, 0) < 0)\n"
+"\t\t\t\tinvalid++;\n"
+"\t\tbench_sink = bench_message(b, payloads, reps, prints, null, &result);\n"
+"\t\tfor (int i = 0; i < BENCH_APIS; i++) {\n"
+"\t\t\ttotal.ns[i] += result.ns[i] / (count ? count : 1);\n"
+"\t\t\tfor (int j = 0; j < BENCH_COUNTERS; j++)\n"
+"\t\t\t\ttotal.counts[i][j] += result.counts[i][j] / (count ? count : 1);\n"
+"\t\t}\n"
+"\t\tprintf(\"\\t\\t{ \\\"id\\\": %lu, \\\"name\\\": \\\"%s\\\", \\\"signals\\\": %u, \\\"invalid_payloads\\\": %u, \", b->id, b->name, b->signals, invalid);\n"
+"\t\tbench_print(&result);\n"
+"\t\tprintf(\" }%s\\n\", m + 1 < count ? \",\" : \"\");\n"
+"\t}\n"
+"\tprintf(\"\\t],\\n\\t\\\"aggregate\\\": { \");\n"
+"\tbench_print(&total);\n"
+"\tprintf(\" }\\n}\\n\");\n"
+"\tbench_counters_close();\n"
+"\tfclose(null);\n"
+"\tif (fflush(stdout) < 0)\n"
+"\t\treturn 1;\n"
+"\treturn baseline ? bench_compare(baseline, total.ns, tolerance) : 0;\n"
+"}\n";
+
+static int msg2bench(can_msg_t *msg, FILE *b, dbc2c_options_t *copts)
+{
+	assert(msg);
+	assert(b);
+	assert(copts);
+	char name[MAX_NAME_LENGTH] = {0};
+	make_name(name, MAX_NAME_LENGTH, msg->name, msg->id);
+	const unsigned dlc = msg->dlc > 8 ? 8 : msg->dlc;
+
+	/* unpacking random data and packing it again clears any bits that are
+	 * not in a signal, the multiplexor is set to a value that is used */
+	fprintf(b, "static int bench_payload_%s(bench_obj_t *o, uint64_t random, uint64_t *data) {\n", name);
+	signal_t *multiplexor = find_multiplexor(msg);
+	unsigned switches = 0;
+	if (multiplexor) {
+		fputs("\tstatic const unsigned switches[] = {", b);
+		for (size_t i = 0; i < msg->signal_count; i++) {
+			signal_t *sig = msg->sigs[i];
+			bool seen = false;
+			for (size_t j = 0; j < i; j++)
+				seen |= msg->sigs[j]->is_multiplexed && msg->sigs[j]->switchval == sig->switchval;
+			if (sig->is_multiplexed && !seen)
+				fprintf(b, "%s%u", switches++ ? ", " : " ", sig->switchval);
+		}
+		fputs(switches ? " };\n" : " 0 };\n", b);
+	}
+	fprintf(b, "\t(void)unpack_message(o, 0x%lx, random, %u, 0);\n", msg->id, dlc);
+	if (multiplexor)
+		fprintf(b, "\to->%s.%s = switches[(random >> 32) %% %u];\n", name, multiplexor->name, switches ? switches : 1);
+	fprintf(b, "\treturn pack_message(o, 0x%lx, data);\n}\n\n", msg->id);
+
+	fprintf(b, "static int bench_decode_%s(const bench_obj_t *o, double *out) {\n", name);
+	fputs(msg->signal_count ? "\tint r = 0;\n" : "\tUNUSED(o);\n\tUNUSED(out);\n", b);
+	for (size_t i = 0; i < msg->signal_count; i++) {
+		signal_t *sig = msg->sigs[i];
+		const char *type = scaled_type(sig, copts);
+		fprintf(b, "\t{ %s v = 0; r |= decode_can_0x%03lx_%s(o, &v); out[%zu] = v; }\n", type, msg->id, sig->name, i);
+	}
+	fprintf(b, "\treturn %s;\n}\n\n", msg->signal_count ? "r" : "0");
+
+	fprintf(b, "static int bench_encode_%s(bench_obj_t *o, const double *in) {\n", name);
+	fputs(msg->signal_count ? "\tint r = 0;\n" : "\tUNUSED(o);\n\tUNUSED(in);\n", b);
+	for (size_t i = 0; i < msg->signal_count; i++) {
+		signal_t *sig = msg->sigs[i];
+		const char *type = scaled_type(sig, copts);
+		fprintf(b, "\tr |= encode_can_0x%03lx_%s(o, (%s)in[%zu]);\n", msg->id, sig->name, type, i);
+	}
+	return fprintf(b, "\treturn %s;\n}\n\n", msg->signal_count ? "r" : "0");
+}
+
+int dbc2c_bench(dbc_t *dbc, FILE *b, const char *name, dbc2c_options_t *copts)
+{
+	assert(dbc);
+	assert(b);
+	assert(name);
+	assert(copts);
+	if (!copts->generate_pack || !copts->generate_unpack || !copts->generate_print) {
+		warning("the benchmark needs the pack, unpack and print code");
+		return -1;
+	}
+	char *god = duplicate(name);
+	for (size_t i = 0; god[i]; i++)
+		god[i] = (isalnum(god[i])) ?  tolower(god[i]) : '_';
+	char *title = duplicate(name);
+	char *dot = strrchr(title, '.');
+	if (dot)
+		*dot = '\0';
+	size_t most = 1;
+	for (size_t i = 0; i < dbc->message_count; i++)
+		if (dbc->messages[i]->signal_count > most)
+			most = dbc->messages[i]->signal_count;
+
+	fputs("/* Generated by DBCC, see <https://github.com/howerj/dbcc> */\n", b);
+	fprintf(b, "/* Benchmark for the code in '%s', link it with that code and run it to\n", name);
+	fputs(" * get the time taken by each function for each message as JSON. */\n", b);
+	fputs("#define _POSIX_C_SOURCE 200809L\n", b);
+	fputs("#define _DEFAULT_SOURCE /* for 'syscall' */\n", b);
+	fprintf(b, "#include \"%s\"\n", name);
+	fputs("#include <stdio.h>\n#include <stdlib.h>\n#include <string.h>\n#include <time.h>\n\n", b);
+	fputs("#if defined(__linux__) && !defined(BENCH_NO_PERF)\n", b);
+	fputs("#define BENCH_PERF /* read hardware counters with 'perf_event_open' */\n", b);
+	fputs("#include <linux/perf_event.h>\n#include <sys/syscall.h>\n#include <unistd.h>\n", b);
+	fputs("#endif\n\n", b);
+	fputs("#define UNUSED(X) ((void)(X))\n", b);
+	fprintf(b, "#define BENCH_NAME \"%s\"\n", title);
+	fprintf(b, "#define BENCH_MAX_SIGNALS (%zu)\n\n", most);
+	fprintf(b, "typedef can_obj_%s_t bench_obj_t;\n\n", god);
+	fputs(bench_preamble, b);
+
+	for (size_t i = 0; i < dbc->message_count; i++)
+		if (msg2bench(dbc->messages[i], b, copts) < 0)
+			goto fail;
+
+	fputs("static const bench_message_t bench_messages[] = {\n", b);
+	for (size_t i = 0; i < dbc->message_count; i++) {
+		can_msg_t *msg = dbc->messages[i];
+		char mname[MAX_NAME_LENGTH] = {0};
+		make_name(mname, MAX_NAME_LENGTH, msg->name, msg->id);
+		fprintf(b, "\t{ \"%s\", 0x%lx, %u, %zu, bench_payload_%s, bench_decode_%s, bench_encode_%s },\n",
+				msg->name, msg->id, msg->dlc > 8 ? 8 : msg->dlc, msg->signal_count, mname, mname, mname);
+	}
+	fputs("\t{ NULL, 0, 0, 0, NULL, NULL, NULL },\n};\n\n", b);
+	fputs(bench_driver, b);
+	fputs(bench_measure, b);
+	fputs(bench_main, b);
+	free(god);
+	free(title);
+	return 0;
+fail:
+	free(god);
+	free(title);
+	return -1;
+}
+
+static const char *bpf_code(uint16_t code)
+{
+	switch (code) {
+	case FILTER_LD_W:   return "BPF_LD | BPF_W | BPF_ABS";
+	case FILTER_LD_H:   return "BPF_LD | BPF_H | BPF_ABS";
+	case FILTER_LD_B:   return "BPF_LD | BPF_B | BPF_ABS";
+	case FILTER_LD_MEM: return "BPF_LD | BPF_MEM";
+	case FILTER_ST:     return "BPF_ST";
+	case FILTER_AND:    return "BPF_ALU | BPF_AND | BPF_K";
+	case FILTER_OR_X:   return "BPF_ALU | BPF_OR | BPF_X";
+	case FILTER_LSH:    return "BPF_ALU | BPF_LSH | BPF_K";
+	case FILTER_RSH:    return "BPF_ALU | BPF_RSH | BPF_K";
+	case FILTER_TAX:    return "BPF_MISC | BPF_TAX";
+	case FILTER_JEQ:    return "BPF_JMP | BPF_JEQ | BPF_K";
+	case FILTER_JGE:    return "BPF_JMP | BPF_JGE | BPF_K";
+	case FILTER_JSET:   return "BPF_JMP | BPF_JSET | BPF_K";
+	case FILTER_RET:    return "BPF_RET | BPF_K";
+	}
+	return NULL;
+}
+
+static int bpf2c(dbc_t *dbc, FILE *f, const char *god, const char *who, const char *symbol, const char *manifest, bool *bpf)
+{
+	assert(bpf);
+	filter_insn_t *program = NULL;
+	size_t length = 0;
+	*bpf = false;
+	if (filter_bpf(dbc, manifest, &program, &length) < 0)
+		return -1;
+	if (!length)
+		return 0;
+	fprintf(f, "/* %s: frames of those messages its predicates accept, %zu instructions */\n", who, length);
+	fprintf(f, "static const struct sock_filter can_bpf_%s_%s[] = {\n", god, symbol);
+	for (size_t i = 0; i < length; i++) {
+		const filter_insn_t *in = &program[i];
+		const char *code = bpf_code(in->code);
+		assert(code);
+		char k[64];
+		snprintf(k, sizeof(k), in->id ? "CAN_BPF_ID(0x%08lxu)" : "0x%lxu", (unsigned long)in->k);
+		if ((in->code & 0x07) == 0x05) /* BPF_JMP */
+			fprintf(f, "\tBPF_JUMP(%s, %s, %u, %u),\n", code, k, (unsigned)in->jt, (unsigned)in->jf);
+		else
+			fprintf(f, "\tBPF_STMT(%s, %s),\n", code, k);
+	}
+	fputs("};\n\n", f);
+	free(program);
+	*bpf = true;
+	return 0;
+}
+
+static int consumer2c(dbc_t *dbc, FILE *f, const char *god, const char *who, const char *symbol, const bool *wanted, const char *manifest, dbc2c_options_t *copts, bool *bpf)
+{
+	assert(dbc);
+	assert(f);
+	assert(god);
+	assert(who);
+	assert(symbol);
+	filter_set_t set;
+	*bpf = false;
+	if (!wanted || filter_compute(dbc, wanted, copts->filter_rate, &set) < 0)
+		return -1;
+	fprintf(f, "/* %s: %zu message%s in %zu filter%s, passing %zu other message%s */\n", who,
+			set.wanted, set.wanted == 1 ? "" : "s", set.count, set.count == 1 ? "" : "s",
+			set.unwanted, set.unwanted == 1 ? "" : "s");
+	fprintf(f, "static const struct can_filter can_filters_%s_%s[] = {\n", god, symbol);
+	for (size_t i = 0; i < set.count; i++)
+		fprintf(f, "\t{ .can_id = 0x%08lxu, .can_mask = 0x%08lxu },\n",
+				(unsigned long)set.filters[i].id, (unsigned long)set.filters[i].mask);
+	fputs("};\n\n", f);
+	filter_set_free(&set);
+	return manifest ? bpf2c(dbc, f, god, who, symbol, manifest, bpf) : 0;
+}
+
+int dbc2c_filters(dbc_t *dbc, FILE *f, const char *name, dbc2c_options_t *copts)
+{
+	assert(dbc);
+	assert(f);
+	assert(name);
+	assert(copts);
+	char *god = duplicate(name);
+	char *dot = strrchr(god, '.');
+	if (dot)
+		*dot = '\0';
+	for (size_t i = 0; god[i]; i++)
+		god[i] = (isalnum(god[i])) ?  tolower(god[i]) : '_';
+	size_t node_count = 0;
+	const char **nodes = filter_nodes(dbc, &node_count);
+	const size_t count = node_count + copts->manifest_count;
+	int r = 0;
+	/* the symbols of manifests are kept apart from those of the nodes, which
+	 * are unique, as "dir/abs.txt" -> "manifest_abs", and are named after
+	 * the file without the prefix */
+	static const char prefix[] = "manifest_";
+	char **consumers = allocate(sizeof(*consumers) * (count + 1));
+	for (size_t i = 0; i < node_count; i++)
+		consumers[i] = duplicate(nodes[i]);
+	for (size_t i = 0; i < copts->manifest_count; i++) {
+		const char *base = dbcc_basename(copts->manifests[i]);
+		char *c = allocate(sizeof(prefix) + strlen(base));
+		strcpy(c, prefix);
+		strcat(c, base);
+		if ((dot = strrchr(c + sizeof(prefix) - 1, '.')))
+			*dot = '\0';
+		for (size_t j = sizeof(prefix) - 1; c[j]; j++)
+			c[j] = isalnum(c[j]) ? c[j] : '_';
+		for (size_t j = node_count; c && j < node_count + i; j++) {
+			if (consumers[j] && !strcmp(consumers[j], c)) {
+				warning("manifests '%s' and '%s' would both be called '%s', the second is ignored",
+						copts->manifests[j - node_count], copts->manifests[i], c + sizeof(prefix) - 1);
+				free(c);
+				c = NULL;
+				r = -1;
+			}
+		}
+		consumers[node_count + i] = c;
+	}
+
+	char *guard = duplicate(god);
+	for (size_t i = 0; guard[i]; i++)
+		guard[i] = toupper(guard[i]);
+
+	fputs("/* Generated by DBCC, see <https://github.com/howerj/dbcc> */\n", f);
+	fprintf(f, "/* SocketCAN receive filters for the messages in '%s', for\n", name);
+	fputs(" * 'setsockopt(fd, SOL_CAN_RAW, CAN_RAW_FILTER, filters, count * sizeof(*filters))'.\n", f);
+	fputs(" * Each node gets the messages with a signal it receives, and each consumer\n", f);
+	fprintf(f, " * the messages in its manifest, at most %g%% of the messages from the DBC\n", copts->filter_rate * 100);
+	fputs(" * file that the filters let through are not needed. Consumers with\n", f);
+	fputs(" * predicates on the payload in their manifest also get a classic BPF\n", f);
+	fputs(" * program for 'SO_ATTACH_FILTER', the 'struct sock_fprog' for it needs\n", f);
+	fputs(" * the const cast away. */\n", f);
+	fprintf(f, "#ifndef FILTERS_%s_H\n#define FILTERS_%s_H\n\n", guard, guard);
+	fputs("#include <stddef.h>\n#include <linux/can.h>\n#include <linux/filter.h>\n\n", f);
+	fputs("#ifndef CAN_BPF_ID /* BPF loads 'can_id' big endian */\n", f);
+	fputs("#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__\n", f);
+	fputs("#define CAN_BPF_ID(X) (X)\n#else\n", f);
+	fputs("#define CAN_BPF_ID(X) ((((X) & 0xFFu) << 24) | (((X) & 0xFF00u) << 8) | (((X) >> 8) & 0xFF00u) | (((X) >> 24) & 0xFFu))\n", f);
+	fputs("#endif\n#endif\n\n", f);
+	bool *bpf = allocate(sizeof(*bpf) * (count + 1));
+	for (size_t i = 0; i < count; i++) {
+		if (!consumers[i])
+			continue;
+		bool *wanted = i < node_count ?
+			filter_node(dbc, nodes[i]) :
+			filter_manifest(dbc, copts->manifests[i - node_count]);
+		const char *manifest = i < node_count ? NULL : copts->manifests[i - node_count];
+		const char *who = consumers[i] + (manifest ? sizeof(prefix) - 1 : 0);
+		if (consumer2c(dbc, f, god, who, consumers[i], wanted, manifest, copts, &bpf[i]) < 0) {
+			warning("no filters for '%s'", who);
+			free(consumers[i]); /* and left out of the table */
+			consumers[i] = NULL;
+			r = -1;
+		}
+		free(wanted);
+	}
+	fputs("typedef struct {\n\tconst char *name;\n\tconst struct can_filter *filters;\n\tunsigned count;\n", f);
+	fprintf(f, "\tconst struct sock_filter *bpf; /* NULL if there are no predicates */\n\tunsigned short bpf_count;\n} can_filters_%s_t;\n\n", god);
+	fprintf(f, "static const can_filters_%s_t can_filters_%s[] = {\n", god, god);
+	for (size_t i = 0; i < count; i++) {
+		if (!consumers[i])
+			continue;
+		fprintf(f, "\t{ \"%s\", can_filters_%s_%s, sizeof(can_filters_%s_%s) / sizeof(can_filters_%s_%s[0]), ",
+				consumers[i] + (i < node_count ? 0 : sizeof(prefix) - 1),
+				god, consumers[i], god, consumers[i], god, consumers[i]);
+		if (bpf[i])
+			fprintf(f, "can_bpf_%s_%s, sizeof(can_bpf_%s_%s) / sizeof(can_bpf_%s_%s[0]) },\n",
+					god, consumers[i], god, consumers[i], god, consumers[i]);
+		else
+			fputs("NULL, 0 },\n", f);
+	}
+	fputs("\t{ NULL, NULL, 0, NULL, 0 },\n};\n\n#endif\n", f);
+	free(bpf);
+	for (size_t i = 0; i < count; i++)
+		free(consumers[i]);
+	free(consumers);
+	free(nodes);
+	free(guard);
+	free(god);
+	return r;
+}
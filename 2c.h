@@ -11,11 +11,32 @@ extern "C" {
 typedef struct {
 	bool use_time_stamps;
 	bool use_doubles_for_encoding;
+	bool time_stamp_ns;  /**< 'dbcc_time_stamp_t' is a 64-bit count of nanoseconds */
 	bool generate_print, generate_pack, generate_unpack;
 	bool generate_asserts;
+	unsigned threads; /**< threads to generate code on, 0 for one per core */
+	unsigned split;   /**< number of source files to split messages over, 0 for none */
+	bool generate_bench; /**< also write a benchmark driver, see 'dbc2c_bench' */
+	bool generate_filters; /**< also write receive filters, see 'dbc2c_filters' */
+	double filter_rate;    /**< most of the messages passed that may be unwanted, 0-1 */
+	char **manifests;      /**< consumers to write filters for, as well as each node */
+	unsigned manifest_count;
 } dbc2c_options_t;
 
-int dbc2c(dbc_t *dbc, FILE *c, FILE *h, const char *name, dbc2c_options_t *copts);
+/* 'shards' is an array of 'copts->split' files to put the messages in, if
+ * the output is split 'c' only gets the functions that dispatch on the ID */
+int dbc2c(dbc_t *dbc, FILE *c, FILE *h, FILE **shards, const char *name, dbc2c_options_t *copts);
+
+/* Write a program that times the pack, unpack, encode, decode and print
+ * functions generated by 'dbc2c' (from the same 'dbc', after it has been
+ * called) for each message, and reports them as JSON. It can also compare
+ * the results against an earlier run and fail if they are slower. */
+int dbc2c_bench(dbc_t *dbc, FILE *b, const char *name, dbc2c_options_t *copts);
+
+/* Write a header with an array of 'struct can_filter' for 'CAN_RAW_FILTER'
+ * for each node that receives signals and for each manifest, see
+ * 'filter.h', and a table of them by name. */
+int dbc2c_filters(dbc_t *dbc, FILE *f, const char *name, dbc2c_options_t *copts);
 
 #ifdef __cplusplus
 }
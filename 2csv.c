@@ -6,42 +6,48 @@
  * @bug No escape done on ',', '\t', or '\n'
  */
 #include "2csv.h"
+#include "buffer.h"
 #include "util.h"
 #include <assert.h>
 
-static int msg2csv(can_msg_t *msg, FILE *o)
+static int msg2csv(can_msg_t *msg, buffer_t *b)
 {
 	assert(msg);
-	assert(o);
+	assert(b);
 
 	signal_t *multiplexor = NULL;
 	for(size_t i = 0; i < msg->signal_count; i++) {
-		char sv[64];
-		const char *multi = "N/A";
 		signal_t *sig = msg->sigs[i];
 		if(sig->is_multiplexor) {
 			if(multiplexor) {
 				error("multiple multiplexor values detected (only one per CAN msg is allowed) for %s", msg->name);
 				return -1;
 			}
-			multi = "multiplexor";
-		}
-		if(sig->is_multiplexed) {
-			sprintf(sv, "%d", sig->switchval);
-			multi = sv;
 		}
 
 		/* "MSG, ID, DLC, Signal, Start, Length, Endianess, Scaling, Offset, Minimum, Maximum, Signed, Units, Multiplexed */
-		fprintf(o, "%s, %lu, %u, ", msg->name, msg->id, msg->dlc);
-		fprintf(o, "%s, ", sig->name);
-		fprintf(o, "%u, ", sig->start_bit);
-		fprintf(o, "%u, ", sig->bit_length);
-		fprintf(o, "%s, ", sig->endianess == endianess_motorola_e ? "motorola" : "intel");
-		fprintf(o, "%g, ", sig->scaling);
-		fprintf(o, "%g, ", sig->offset);
-		fprintf(o, "%g, ", sig->minimum);
-		fprintf(o, "%g, ", sig->maximum);
-		fprintf(o, "%s, ", sig->is_signed ? "true" : "false");
+		buffer_string(b, msg->name);
+		buffer_string(b, ", ");
+		buffer_unsigned(b, msg->id);
+		buffer_string(b, ", ");
+		buffer_unsigned(b, msg->dlc);
+		buffer_string(b, ", ");
+		buffer_string(b, sig->name);
+		buffer_string(b, ", ");
+		buffer_unsigned(b, sig->start_bit);
+		buffer_string(b, ", ");
+		buffer_unsigned(b, sig->bit_length);
+		buffer_string(b, ", ");
+		buffer_string(b, sig->endianess == endianess_motorola_e ? "motorola, " : "intel, ");
+		buffer_double(b, sig->scaling);
+		buffer_string(b, ", ");
+		buffer_double(b, sig->offset);
+		buffer_string(b, ", ");
+		buffer_double(b, sig->minimum);
+		buffer_string(b, ", ");
+		buffer_double(b, sig->maximum);
+		buffer_string(b, ", ");
+		buffer_string(b, sig->is_signed ? "true, " : "false, ");
 		bool have_units = false;
 		const char *units = sig->units;
 		for(size_t i = 0; units[i]; i++)
@@ -49,8 +55,13 @@ static int msg2csv(can_msg_t *msg, FILE *o)
 				have_units = true;
 		if(!have_units)
 			units = "none";
-		fprintf(o, "%s, ", units);
-		fprintf(o, "%s, ", multi);
+		buffer_string(b, units);
+		buffer_string(b, ", ");
+		if(sig->is_multiplexed)
+			buffer_signed(b, (int)sig->switchval);
+		else
+			buffer_string(b, sig->is_multiplexor ? "multiplexor" : "N/A");
+		buffer_string(b, ", ");
 
 		const char *floating = "no";
 		if (sig->is_floating) {
@@ -58,8 +69,8 @@ static int msg2csv(can_msg_t *msg, FILE *o)
 			floating = (sig->sigval == 1) ? "single" : "double";
 		}
 
-		fprintf(o, "%s, ", floating);
-		fprintf(o, "\n");
+		buffer_string(b, floating);
+		buffer_string(b, ", \n");
 	}
 
 	return 0;
@@ -69,10 +80,12 @@ int dbc2csv(dbc_t *dbc, FILE *output)
 {
 	assert(dbc);
 	assert(output);
-	fprintf(output, "MSG, ID, DLC, Signal, Start, Length, Endianess, Scaling, Offset, Minimum, Maximum, Signed, Units, Multiplexed, Floating,\n");
+	buffer_t *b = buffer_new(output);
+	buffer_string(b, "MSG, ID, DLC, Signal, Start, Length, Endianess, Scaling, Offset, Minimum, Maximum, Signed, Units, Multiplexed, Floating,\n");
 	for (size_t i = 0; i < dbc->message_count; i++)
-		if(msg2csv(dbc->messages[i], output) < 0)
+		if(msg2csv(dbc->messages[i], b) < 0) {
+			buffer_delete(b);
 			return -1;
-	return 0;
+		}
+	return buffer_delete(b);
 }
-
@@ -4,113 +4,103 @@
  * @license MIT *
  */
 #include "2json.h"
+#include "buffer.h"
 #include "util.h"
 #include <assert.h>
-#include <time.h>
 
-static int print_escaped(FILE *o, const char *string)
+static int indent(buffer_t *b, unsigned depth)
 {
-	assert(o);
-	assert(string);
-	char c;
-	int r = 0;
-	while ((c = *(string)++)) {
-		switch(c) {
-		case '"':  r = fputs("&quot;", o); break;
-		case '\'': r = fputs("&apos;", o); break;
-		case '<':  r = fputs("&lt;",   o); break;
-		case '>':  r = fputs("&gt;",   o); break;
-		case '&':  r = fputs("&amp;",  o); break;
-		default:
-			r = fputc(c, o);
-		}
-		if (r < 0)
-			return -1;
-	}
-	return 0;
+	return buffer_repeat(b, '\t', depth);
 }
 
-static int indent(FILE *o, unsigned depth)
+/* all fields but the last in an object are followed by a comma, the last
+ * field of each object is written out by hand */
+static int field_open(buffer_t *b, unsigned depth, const char *node, bool quote)
 {
-	assert(o);
-	while (depth--)
-		if (fputc('\t', o) != '\t')
-			return -1;
-	return 0;
+	assert(node);
+	indent(b, depth);
+	buffer_char(b, '"');
+	buffer_string(b, node);
+	return buffer_string(b, quote ? "\" : \"" : "\" : ");
+}
+
+static int field_close(buffer_t *b, bool quote)
+{
+	return buffer_string(b, quote ? "\",\n" : ",\n");
 }
 
-enum { INT, STRING, BOOL, FLOAT };
+static int pstring(buffer_t *b, unsigned depth, const char *node, const char *s)
+{
+	field_open(b, depth, node, true);
+	buffer_string(b, s);
+	return field_close(b, true);
+}
 
-static int pfield(FILE *o, unsigned depth, bool last, int type, const char *node, const char *fmt, ...)
+static int pbool(buffer_t *b, unsigned depth, const char *node, bool v)
 {
-	assert(o);
-	assert(node);
-	assert(fmt);
-	va_list args;
-	assert(o && node && fmt);
-	errno = 0;
-	if (indent(o, depth) < 0)
-		goto warn;
-	if (fprintf(o, "\"%s\" : %s", node, type == STRING ? "\"" : "") < 0)
-		goto warn;
-	assert(fmt);
-	va_start(args, fmt);
-	int r = vfprintf(o, fmt, args);
-	va_end(args);
-	if (r < 0)
-		goto warn;
-	if (fprintf(o, "%s%s\n", type == STRING ? "\"" : "", !last ? "," : "") < 0)
-		goto warn;
-	return 0;
-warn:
-	warning("XML node generation, problem writing to FILE* <%p>: %s", o, emsg());
-	return -1;
+	field_open(b, depth, node, false);
+	buffer_string(b, v ? "true" : "false");
+	return field_close(b, false);
 }
 
-static int signal2json(signal_t *sig, FILE *o, unsigned depth, int multiplexed, int selector, int is_value)
+static int punsigned(buffer_t *b, unsigned depth, const char *node, unsigned long u)
+{
+	field_open(b, depth, node, false);
+	buffer_unsigned(b, u);
+	return field_close(b, false);
+}
+
+static int pdouble(buffer_t *b, unsigned depth, const char *node, double d)
+{
+	field_open(b, depth, node, false);
+	buffer_double(b, d);
+	return field_close(b, false);
+}
+
+static int signal2json(signal_t *sig, buffer_t *b, unsigned depth, int multiplexed, int selector, int is_value)
 {
 	assert(sig);
-	assert(o);
+	assert(b);
 	if (!is_value)
-		indent(o, depth);
-	fprintf(o, "{\n");
-	pfield(o, depth+1, false, STRING, "name",      "%s", sig->name);
-	pfield(o, depth+1, false, INT,    "startbit",  "%u", sig->start_bit);
-	pfield(o, depth+1, false, INT,    "bitlength", "%u", sig->bit_length);
-	pfield(o, depth+1, false, STRING, "endianess", "%s", sig->endianess == endianess_motorola_e ? "motorola" : "intel");
-	pfield(o, depth+1, false, FLOAT,  "scaling",   "%g", sig->scaling);
-	pfield(o, depth+1, false, FLOAT,  "offset",    "%g", sig->offset);
-	pfield(o, depth+1, false, FLOAT,  "minimum",   "%g", sig->minimum);
-	pfield(o, depth+1, false, FLOAT,  "maximum",   "%g", sig->maximum);
-	pfield(o, depth+1, false, BOOL,   "signed",    "%s", sig->is_signed ? "true" : "false");
-	pfield(o, depth+1, false, INT,    "floating",  "%u", sig->is_floating ? sig->sigval : 0);
-	if (multiplexed)
-		pfield(o, depth+1, false, STRING, "selector",      "%u", selector);
-
-	indent(o, depth+1);
-	fprintf(o, "\"units\" : \"");
-	print_escaped(o, sig->units);
-	fprintf(o, "\"\n");
-
-	indent(o, depth);
-	if (fprintf(o, "}") < 0)
-		return -1;
-	return 0;
+		indent(b, depth);
+	buffer_string(b, "{\n");
+	pstring(b,   depth+1, "name",      sig->name);
+	punsigned(b, depth+1, "startbit",  sig->start_bit);
+	punsigned(b, depth+1, "bitlength", sig->bit_length);
+	pstring(b,   depth+1, "endianess", sig->endianess == endianess_motorola_e ? "motorola" : "intel");
+	pdouble(b,   depth+1, "scaling",   sig->scaling);
+	pdouble(b,   depth+1, "offset",    sig->offset);
+	pdouble(b,   depth+1, "minimum",   sig->minimum);
+	pdouble(b,   depth+1, "maximum",   sig->maximum);
+	pbool(b,     depth+1, "signed",    sig->is_signed);
+	punsigned(b, depth+1, "floating",  sig->is_floating ? sig->sigval : 0);
+	if (multiplexed) {
+		field_open(b, depth+1, "selector", true);
+		buffer_unsigned(b, (unsigned)selector);
+		field_close(b, true);
+	}
+
+	field_open(b, depth+1, "units", true);
+	buffer_xml_escaped(b, sig->units);
+	buffer_string(b, "\"\n");
+
+	indent(b, depth);
+	return buffer_char(b, '}');
 }
 
-static int msg2json(can_msg_t *msg, FILE *o, unsigned depth)
+static int msg2json(can_msg_t *msg, buffer_t *b, unsigned depth)
 {
 	assert(msg);
-	assert(o);
-	indent(o, depth);
-	fprintf(o, "{\n");
-	pfield(o, depth+1, false, STRING, "name", "%s", msg->name);
-	pfield(o, depth+1, false, INT,    "id",   "%u", msg->id);
-	pfield(o, depth+1, false, INT,    "dlc",  "%u", msg->dlc);
+	assert(b);
+	indent(b, depth);
+	buffer_string(b, "{\n");
+	pstring(b,   depth+1, "name", msg->name);
+	punsigned(b, depth+1, "id",   msg->id);
+	punsigned(b, depth+1, "dlc",  msg->dlc);
 
 	signal_t *multiplexor = NULL;
-	indent(o, depth+1);
-	fprintf(o, "\"signals\": [\n");
+	indent(b, depth+1);
+	buffer_string(b, "\"signals\": [\n");
 	for (size_t i = 0; i < msg->signal_count; i++) {
 		signal_t *sig = msg->sigs[i];
 		if (sig->is_multiplexor) {
@@ -123,23 +113,23 @@ static int msg2json(can_msg_t *msg, FILE *o, unsigned depth)
 		}
 		if (sig->is_multiplexed)
 			continue;
-		if (signal2json(sig, o, depth+2, 0, 0, 0) < 0)
+		if (signal2json(sig, b, depth+2, 0, 0, 0) < 0)
 			return -1;
 		if ((msg->signal_count && i < (msg->signal_count - 1)))// || multiplexor)
-			fprintf(o, ",");
-		fprintf(o, "\n");
+			buffer_char(b, ',');
+		buffer_char(b, '\n');
 	}
-	indent(o, depth+1);
-	fprintf(o, "]%s\n", multiplexor ? "," : "");
+	indent(b, depth+1);
+	buffer_string(b, multiplexor ? "],\n" : "]\n");
 
 	if (multiplexor) {
-		indent(o, depth+1);
-		fprintf(o, "\"multiplexor-group\" : {\n");
-		indent(o, depth+2);
-		fprintf(o, "\"multiplexor\" : ");
-		if (signal2json(multiplexor, o, depth+3, 0, 0, 1) < 0)
+		indent(b, depth+1);
+		buffer_string(b, "\"multiplexor-group\" : {\n");
+		indent(b, depth+2);
+		buffer_string(b, "\"multiplexor\" : ");
+		if (signal2json(multiplexor, b, depth+3, 0, 0, 1) < 0)
 			return -1;
-		fprintf(o, "%s\n", msg->signal_count ? "," : "");
+		buffer_string(b, msg->signal_count ? ",\n" : "\n");
 		size_t multiplexed_count = 0;
 		for (size_t i = 0; i < msg->signal_count; i++) {
 			signal_t *sig = msg->sigs[i];
@@ -147,31 +137,29 @@ static int msg2json(can_msg_t *msg, FILE *o, unsigned depth)
 				multiplexed_count++;
 		}
 
-		indent(o, depth+2);
-		fprintf(o, "\"multiplexed\" : [\n");
+		indent(b, depth+2);
+		buffer_string(b, "\"multiplexed\" : [\n");
 		for (size_t i = 0, j = 0; i < msg->signal_count; i++) {
 			signal_t *sig = msg->sigs[i];
 			if (!(sig->is_multiplexed))
 				continue;
 			j++;
-			if (signal2json(sig, o, depth+3, 1, sig->switchval, 0) < 0)
+			if (signal2json(sig, b, depth+3, 1, sig->switchval, 0) < 0)
 				return -1;
 			if (multiplexed_count && j < multiplexed_count)
-				fprintf(o, ",");
-			fprintf(o, "\n");
+				buffer_char(b, ',');
+			buffer_char(b, '\n');
 
 		}
-		indent(o, depth+2);
-		fprintf(o, "]\n");
+		indent(b, depth+2);
+		buffer_string(b, "]\n");
 
-		indent(o, depth+1);
-		fprintf(o, "}\n");
+		indent(b, depth+1);
+		buffer_string(b, "}\n");
 	}
 
-	indent(o, depth);
-	if (fprintf(o, "}") < 0)
-		return -1;
-	return 0;
+	indent(b, depth);
+	return buffer_char(b, '}');
 }
 
 int dbc2json(dbc_t *dbc, FILE *output, bool use_time_stamps)
@@ -179,27 +167,31 @@ int dbc2json(dbc_t *dbc, FILE *output, bool use_time_stamps)
 	assert(dbc);
 	assert(output);
 	/**@todo print out ECU node information, and the standard XML header */
-	time_t rawtime = time(NULL);
-	struct tm *timeinfo = localtime(&rawtime);
-
-	fprintf(output, "{\n");
-	fprintf(output, "\t\"description\" : \"JSON generated from a CAN DBC file\",\n");
-	fprintf(output, "\t\"compiler\" : \"dbcc\",\n");
-	fprintf(output, "\t\"site\" : \"https://github.com/howerj/dbcc\",\n");
-	if (use_time_stamps)
-		fprintf(output, "\t\"generated-on\": %s,", asctime(timeinfo));
+	char stamp[TIME_STAMP_LENGTH];
+	buffer_t *b = buffer_new(output);
+
+	buffer_string(b, "{\n");
+	buffer_string(b, "\t\"description\" : \"JSON generated from a CAN DBC file\",\n");
+	buffer_string(b, "\t\"compiler\" : \"dbcc\",\n");
+	buffer_string(b, "\t\"site\" : \"https://github.com/howerj/dbcc\",\n");
+	if (use_time_stamps) {
+		buffer_string(b, "\t\"generated-on\": ");
+		buffer_string(b, time_stamp(stamp));
+		buffer_char(b, ',');
+	}
 
-	fprintf(output, "\t\"messages\" : [\n");
+	buffer_string(b, "\t\"messages\" : [\n");
 	for (size_t i = 0; i < dbc->message_count; i++) {
-		if (msg2json(dbc->messages[i], output, 2) < 0)
+		if (msg2json(dbc->messages[i], b, 2) < 0) {
+			buffer_delete(b);
 			return -1;
+		}
 		if (dbc->message_count && i < (dbc->message_count - 1))
-			fprintf(output, ",");
-		fprintf(output, "\n");
+			buffer_char(b, ',');
+		buffer_char(b, '\n');
 	}
-	fprintf(output, "\t]\n");
-	if (fprintf(output, "}\n") < 0)
-		return -1;
-	return 0;
+	buffer_string(b, "\t]\n");
+	buffer_string(b, "}\n");
+	return buffer_delete(b);
 }
 
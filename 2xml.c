@@ -4,9 +4,9 @@
  * @license MIT *
  */
 #include "2xml.h"
+#include "buffer.h"
 #include "util.h"
 #include <assert.h>
-#include <time.h>
 
 /*
 Add:
@@ -15,127 +15,92 @@ Add:
 
  */
 
-static int print_escaped(FILE *o, const char *string)
+static int indent(buffer_t *b, unsigned depth)
 {
-	assert(o);
-	assert(string);
-	char c;
-	int r = 0;
-	while((c = *(string)++)) {
-		switch(c) {
-		case '"':  r = fputs("&quot;", o); break;
-		case '\'': r = fputs("&apos;", o); break;
-		case '<':  r = fputs("&lt;",   o); break;
-		case '>':  r = fputs("&gt;",   o); break;
-		case '&':  r = fputs("&amp;",  o); break;
-		default:
-			   r = fputc(c, o);
-		}
-		if(r < 0)
-			return -1;
-	}
-	return 0;
+	return buffer_repeat(b, '\t', depth);
 }
 
-static int indent(FILE *o, unsigned depth)
+static int node_open(buffer_t *b, unsigned depth, const char *node)
 {
-	assert(o);
-	while(depth--)
-		if(fputc('\t', o) != '\t')
-			return -1;
-	return 0;
+	assert(node);
+	indent(b, depth);
+	buffer_char(b, '<');
+	buffer_string(b, node);
+	return buffer_char(b, '>');
 }
 
-static int pnode(FILE *o, unsigned depth, const char *node, const char *fmt, ...)
+static int node_close(buffer_t *b, const char *node)
 {
-	assert(o);
 	assert(node);
-	assert(fmt);
-	va_list args;
-	assert(o && node && fmt);
-	errno = 0;
-	if(indent(o, depth) < 0)
-		goto warn;
-	if(fprintf(o, "<%s>", node) < 0)
-		goto warn;
-	assert(fmt);
-	va_start(args, fmt);
-	int r = vfprintf(o, fmt, args);
-	va_end(args);
-	if(r < 0)
-		goto warn;
-	if(fprintf(o, "</%s>\n", node) < 0)
-		goto warn;
-	return 0;
-warn:
-	warning("XML node generation, problem writing to FILE* <%p>: %s", o, emsg());
-	return -1;
+	buffer_string(b, "</");
+	buffer_string(b, node);
+	return buffer_string(b, ">\n");
+}
+
+static int pstring(buffer_t *b, unsigned depth, const char *node, const char *s)
+{
+	node_open(b, depth, node);
+	buffer_string(b, s);
+	return node_close(b, node);
+}
+
+static int punsigned(buffer_t *b, unsigned depth, const char *node, unsigned long u)
+{
+	node_open(b, depth, node);
+	buffer_unsigned(b, u);
+	return node_close(b, node);
+}
+
+static int pdouble(buffer_t *b, unsigned depth, const char *node, double d)
+{
+	node_open(b, depth, node);
+	buffer_double(b, d);
+	return node_close(b, node);
 }
 
-static int comment(FILE *o, unsigned depth, const char *fmt, ...)
+static int comment(buffer_t *b, unsigned depth, const char *s)
 {
-	assert(o);
-	assert(fmt);
-	va_list args;
-	assert(o && fmt);
-	errno = 0;
-	if(indent(o, depth) < 0)
-		goto warn;
-	if(fputs("<!-- ", o) < 0)
-		goto warn;
-	assert(fmt);
-	va_start(args, fmt);
-	int r = vfprintf(o, fmt, args);
-	va_end(args);
-	if(r < 0)
-		goto warn;
-	if(fputs(" -->\n", o) < 0)
-		goto warn;
-	return 0;
-warn:
-	warning("XML comment generation, problem writing to FILE* <%p>: %s", o, emsg());
-	return -1;
+	assert(s);
+	indent(b, depth);
+	buffer_string(b, "<!-- ");
+	buffer_string(b, s);
+	return buffer_string(b, " -->\n");
 }
 
-static int signal2xml(signal_t *sig, FILE *o, unsigned depth)
+static int signal2xml(signal_t *sig, buffer_t *b, unsigned depth)
 {
 	assert(sig);
-	assert(o);
-	indent(o, depth);
-	fprintf(o, "<signal>\n");
-	pnode(o, depth+1, "name",      "%s", sig->name);
-	pnode(o, depth+1, "startbit",  "%u", sig->start_bit);
-	pnode(o, depth+1, "bitlength", "%u", sig->bit_length);
-	pnode(o, depth+1, "endianess", "%s", sig->endianess == endianess_motorola_e ? "motorola" : "intel");
-	pnode(o, depth+1, "scaling",   "%g", sig->scaling);
-	pnode(o, depth+1, "offset",    "%g", sig->offset);
-	pnode(o, depth+1, "minimum",   "%g", sig->minimum);
-	pnode(o, depth+1, "maximum",   "%g", sig->maximum);
-	pnode(o, depth+1, "signed",    "%s", sig->is_signed ? "true" : "false");
-	pnode(o, depth+1, "floating",  "%u", sig->is_floating ? sig->sigval : 0);
-
-	indent(o, depth+1);
-	fprintf(o, "<units>");
-	/*indent(o, depth+2);*/
-	print_escaped(o, sig->units);
-	/*indent(o, depth+1);*/
-	fprintf(o, "</units>\n");
-
-	indent(o, depth);
-	if(fprintf(o, "</signal>\n") < 0)
-		return -1;
-	return 0;
+	assert(b);
+	indent(b, depth);
+	buffer_string(b, "<signal>\n");
+	pstring(b,   depth+1, "name",      sig->name);
+	punsigned(b, depth+1, "startbit",  sig->start_bit);
+	punsigned(b, depth+1, "bitlength", sig->bit_length);
+	pstring(b,   depth+1, "endianess", sig->endianess == endianess_motorola_e ? "motorola" : "intel");
+	pdouble(b,   depth+1, "scaling",   sig->scaling);
+	pdouble(b,   depth+1, "offset",    sig->offset);
+	pdouble(b,   depth+1, "minimum",   sig->minimum);
+	pdouble(b,   depth+1, "maximum",   sig->maximum);
+	pstring(b,   depth+1, "signed",    sig->is_signed ? "true" : "false");
+	punsigned(b, depth+1, "floating",  sig->is_floating ? sig->sigval : 0);
+
+	node_open(b, depth+1, "units");
+	buffer_xml_escaped(b, sig->units);
+	node_close(b, "units");
+
+	indent(b, depth);
+	return buffer_string(b, "</signal>\n");
 }
 
-static int msg2xml(can_msg_t *msg, FILE *o, unsigned depth)
+static int msg2xml(can_msg_t *msg, buffer_t *b, unsigned depth)
 {
 	assert(msg);
-	assert(o);
-	indent(o, depth);
-	fprintf(o, "<message>\n");
-	pnode(o, depth+1, "name", "%s", msg->name);
-	pnode(o, depth+1, "id",   "%u", msg->id);
-	pnode(o, depth+1, "dlc",  "%u", msg->dlc);
+	assert(b);
+	indent(b, depth);
+	buffer_string(b, "<message>\n");
+	pstring(b,   depth+1, "name", msg->name);
+	punsigned(b, depth+1, "id",   msg->id);
+	punsigned(b, depth+1, "dlc",  msg->dlc);
 
 	signal_t *multiplexor = NULL;
 	for(size_t i = 0; i < msg->signal_count; i++) {
@@ -150,40 +115,38 @@ static int msg2xml(can_msg_t *msg, FILE *o, unsigned depth)
 		}
 		if(sig->is_multiplexed)
 			continue;
-		if(signal2xml(sig, o, depth+1) < 0)
+		if(signal2xml(sig, b, depth+1) < 0)
 			return -1;
 	}
 
 	if(multiplexor) {
-		indent(o, depth+1);
-		fprintf(o, "<multiplexor-group>\n");
-		indent(o, depth+2);
-		fprintf(o, "<multiplexor>\n");
-		if(signal2xml(multiplexor, o, depth+2) < 0)
+		indent(b, depth+1);
+		buffer_string(b, "<multiplexor-group>\n");
+		indent(b, depth+2);
+		buffer_string(b, "<multiplexor>\n");
+		if(signal2xml(multiplexor, b, depth+2) < 0)
 			return -1;
-		indent(o, depth+2);
-		fprintf(o, "</multiplexor>\n");
+		indent(b, depth+2);
+		buffer_string(b, "</multiplexor>\n");
 
 		for(size_t i = 0; i < msg->signal_count; i++) {
 			signal_t *sig = msg->sigs[i];
 			if(!(sig->is_multiplexed))
 				continue;
-			indent(o, depth+2);
-			fprintf(o, "<multiplexed>\n");
-			pnode(o, depth+3, "multiplexed-on", "%u",  sig->switchval);
-			if(signal2xml(sig, o, depth+3) < 0)
+			indent(b, depth+2);
+			buffer_string(b, "<multiplexed>\n");
+			punsigned(b, depth+3, "multiplexed-on", sig->switchval);
+			if(signal2xml(sig, b, depth+3) < 0)
 				return -1;
-			indent(o, depth+2);
-			fprintf(o, "</multiplexed>\n");
+			indent(b, depth+2);
+			buffer_string(b, "</multiplexed>\n");
 		}
-		indent(o, depth+2);
-		fprintf(o, "</multiplexor-group>\n");
+		indent(b, depth+2);
+		buffer_string(b, "</multiplexor-group>\n");
 	}
 
-	indent(o, depth);
-	if(fprintf(o, "</message>\n") < 0)
-		return -1;
-	return 0;
+	indent(b, depth);
+	return buffer_string(b, "</message>\n");
 }
 
 int dbc2xml(dbc_t *dbc, FILE *output, bool use_time_stamps)
@@ -191,23 +154,27 @@ int dbc2xml(dbc_t *dbc, FILE *output, bool use_time_stamps)
 	assert(dbc);
 	assert(output);
 	/**@todo print out ECU node information, and the standard XML header */
-	time_t rawtime = time(NULL);
-	struct tm *timeinfo = localtime(&rawtime);
-
-	fprintf(output, "<?xml version=\"1.0\"?>\n");
-	fprintf(output, "<?xml-stylesheet type=\"text/xsl\" href=\"%s\"?>\n",
-		"https://raw.githubusercontent.com/howerj/dbcc/master/dbcc.xslt");
-
-	comment(output, 0, "Generated by dbcc (see https://github.com/howerj/dbcc)");
-	if (use_time_stamps)
-		comment(output, 0, "Generated on: %s", asctime(timeinfo));
+	char stamp[TIME_STAMP_LENGTH];
+	buffer_t *b = buffer_new(output);
+
+	buffer_string(b, "<?xml version=\"1.0\"?>\n");
+	buffer_string(b, "<?xml-stylesheet type=\"text/xsl\" href=\""
+		"https://raw.githubusercontent.com/howerj/dbcc/master/dbcc.xslt\"?>\n");
+
+	comment(b, 0, "Generated by dbcc (see https://github.com/howerj/dbcc)");
+	if (use_time_stamps) {
+		buffer_string(b, "<!-- Generated on: ");
+		buffer_string(b, time_stamp(stamp));
+		buffer_string(b, " -->\n");
+	}
 
-	fprintf(output, "<candb>\n");
+	buffer_string(b, "<candb>\n");
 	for (size_t i = 0; i < dbc->message_count; i++)
-		if(msg2xml(dbc->messages[i], output, 1) < 0)
+		if(msg2xml(dbc->messages[i], b, 1) < 0) {
+			buffer_delete(b);
 			return -1;
-	if(fprintf(output, "</candb>\n") < 0)
-		return -1;
-	return 0;
+		}
+	buffer_string(b, "</candb>\n");
+	return buffer_delete(b);
 }
 
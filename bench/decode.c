@@ -0,0 +1,194 @@
+/**@file decode.c
+ * @brief benchmark for the run time decoder (../decode.c), interpreted and
+ * compiled with the JIT (../jit.c), against the code generated for the same
+ * DBC file, it checks they all decode random messages to the same values
+ * and reports the time each takes per message
+ * @license MIT */
+#include "decode.h"
+#include "parse.h"
+#include "util.h"
+#include NAME_H
+#include <assert.h>
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define FRAMES  (4096u)        /* a power of two */
+#define DECODES (20u * 1000u * 1000u)
+#define CHECKS  (10000u)
+
+typedef struct {
+	unsigned long id;
+	unsigned dlc;
+	uint8_t data[8];
+} frame_t;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t random_u64(uint64_t *state)
+{
+	uint64_t x = *state; /* xorshift64 */
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return *state = x;
+}
+
+static uint64_t load(const uint8_t *p)
+{
+	uint64_t x = 0;
+	for (unsigned i = 0; i < 8; i++)
+		x |= (uint64_t)p[i] << (8 * i);
+	return x;
+}
+
+static decode_type_e type(const decode_plan_t *plan, size_t output)
+{
+	for (size_t i = 0; i < plan->op_count; i++)
+		if (plan->ops[i].output == output)
+			return plan->ops[i].type;
+	return DECODE_INVALID;
+}
+
+/* The generated 'print_message' prints the unscaled value of each signal,
+ * so the values are checked with a context made with every scaling set to
+ * one and every offset to zero. */
+static int check(const dbcc_ctx_t *raw, const frame_t *f)
+{
+	static OBJECT o;
+	memset(&o, 0, sizeof(o));
+	if (unpack_message(&o, f->id, load(f->data), f->dlc, 0) < 0)
+		return 0;
+	const decode_plan_t *plan = dbcc_plan(raw, f->id);
+	double *values = allocate(sizeof(*values) * (plan->signal_count + 1));
+	if (dbcc_decode_plan(plan, f->data, f->dlc, values) < 0)
+		error("decode failed for %lx where the generated code did not", f->id);
+	char *printed = NULL;
+	size_t length = 0;
+	FILE *p = open_memstream(&printed, &length);
+	print_message(&o, f->id, p);
+	fclose(p);
+	int r = 0;
+	for (char *line = strtok(printed, "\n"); line; line = strtok(NULL, "\n")) {
+		char name[256] = { 0 }, expected[256] = { 0 }, got[256] = { 0 };
+		if (sscanf(line, "%255s = (wire: %255[^)])", name, expected) != 2)
+			continue;
+		for (size_t i = 0; i < plan->signal_count; i++) {
+			if (strcmp(plan->names[i], name) || isnan(values[i]))
+				continue;
+			const decode_type_e t = type(plan, i);
+			const bool fp = t == DECODE_FLOAT || t == DECODE_DOUBLE;
+			if (fp && fabs(values[i]) < (t == DECODE_FLOAT ? FLT_MIN : DBL_MIN))
+				continue; /* the generated 'unpack754' gets these wrong */
+			snprintf(got, sizeof(got), fp ? "%g" : "%.0f", values[i]);
+			if (strcmp(got, expected)) {
+				fprintf(stderr, "%lx %s: generated %s, decoded %s\n", f->id, name, expected, got);
+				r = -1;
+			}
+		}
+	}
+	free(printed);
+	free(values);
+	return r;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s file.dbc\n", argv[0]);
+		return 1;
+	}
+	dbc_t *dbc = NULL;
+	if (parse_dbc_file_parallel(argv[1], 0, &dbc) < 0 || !dbc)
+		error("could not parse: %s", argv[1]);
+	if (!dbc->message_count)
+		error("no messages in: %s", argv[1]);
+	dbcc_ctx_t *ctx = dbcc_new(dbc), *jit = dbcc_new(dbc);
+	const int compiled = dbcc_jit(jit);
+	for (size_t i = 0; i < dbc->message_count; i++)
+		for (size_t j = 0; j < dbc->messages[i]->signal_count; j++) {
+			dbc->messages[i]->sigs[j]->scaling = 1.0;
+			dbc->messages[i]->sigs[j]->offset = 0.0;
+		}
+	dbcc_ctx_t *raw = dbcc_new(dbc);
+
+	uint64_t state = 88172645463325252ull;
+	frame_t *frames = allocate(sizeof(*frames) * FRAMES);
+	size_t most = 0;
+	for (size_t i = 0; i < FRAMES; i++) {
+		const decode_plan_t *plan = dbcc_plan_at(ctx, random_u64(&state) % dbcc_plan_count(ctx));
+		frames[i].id = plan->id;
+		frames[i].dlc = 8;
+		const uint64_t data = random_u64(&state);
+		memcpy(frames[i].data, &data, sizeof(data));
+		most = plan->signal_count > most ? plan->signal_count : most;
+	}
+
+	int r = 0;
+	for (size_t i = 0; i < CHECKS; i++)
+		if (check(raw, &frames[i % FRAMES]) < 0)
+			r = 1;
+	printf("input: %s, %zu messages, checked %u decodes: %s\n", argv[1], dbc->message_count, CHECKS, r ? "FAILED" : "ok");
+
+	double *values = allocate(sizeof(*values) * (most + 1));
+	double *expected = allocate(sizeof(*expected) * (most + 1));
+	if (compiled >= 0) {
+		bool same = true;
+		for (size_t i = 0; i < FRAMES; i++) {
+			const frame_t *f = &frames[i];
+			const int n = dbcc_decode(ctx, f->id, f->data, f->dlc, expected);
+			if (dbcc_decode(jit, f->id, f->data, f->dlc, values) != n || (n > 0 && memcmp(values, expected, sizeof(*values) * n)))
+				same = false;
+		}
+		printf("JIT compiled %d of %zu plans, checked %u decodes: %s\n", compiled, dbcc_plan_count(jit), FRAMES, same ? "ok" : "FAILED");
+		r |= !same;
+	} else {
+		printf("JIT not available\n");
+	}
+
+	double sum = 0;
+	double start = now();
+	for (size_t i = 0; i < DECODES; i++) {
+		const frame_t *f = &frames[i & (FRAMES - 1)];
+		if (dbcc_decode(ctx, f->id, f->data, f->dlc, values) > 0)
+			sum += values[0];
+	}
+	const double interpreted = (now() - start) * 1e9 / DECODES;
+
+	start = now();
+	for (size_t i = 0; i < DECODES; i++) {
+		const frame_t *f = &frames[i & (FRAMES - 1)];
+		if (dbcc_decode(jit, f->id, f->data, f->dlc, values) > 0)
+			sum += values[0];
+	}
+	const double jitted = (now() - start) * 1e9 / DECODES;
+
+	static OBJECT o;
+	start = now();
+	for (size_t i = 0; i < DECODES; i++) {
+		const frame_t *f = &frames[i & (FRAMES - 1)];
+		unpack_message(&o, f->id, load(f->data), f->dlc, 0);
+	}
+	const double generated = (now() - start) * 1e9 / DECODES;
+
+	printf("interpreted:    %6.1f ns/message (scaled values), %.2fx generated\n", interpreted, interpreted / generated);
+	printf("JIT:            %6.1f ns/message (scaled values), %.2fx generated\n", jitted, jitted / generated);
+	printf("unpack_message: %6.1f ns/message (unscaled values)\n", generated);
+	printf("checksum:       %g\n", sum);
+
+	free(expected);
+	free(values);
+	free(frames);
+	dbcc_delete(raw);
+	dbcc_delete(jit);
+	dbcc_delete(ctx);
+	dbc_delete(dbc);
+	return r;
+}
@@ -0,0 +1,253 @@
+/**@file gen.c
+ * @brief writes a synthetic, but valid, DBC file to stdout for benchmarking
+ * dbcc on inputs the size of those found in vehicles
+ * @license MIT */
+#include "options.h"
+#include "util.h"
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MUX_BITS     (4u)     /* width of the multiplexor signal */
+#define MUX_GROUPS   (4u)     /* switch values used by multiplexed signals */
+#define MAX_STANDARD (0x7FFu) /* larger identifiers are made extended */
+#define EXTENDED     (0x80000000ul)
+
+typedef struct {
+	unsigned long messages;
+	unsigned signals;      /**< signals per message, at most 64 */
+	unsigned motorola;     /**< percentage of signals that are big endian */
+	unsigned multiplexed;  /**< percentage of messages that are multiplexed */
+	unsigned vals;         /**< percentage of signals with a VAL_ table */
+	unsigned comments;     /**< percentage of messages and signals with a CM_ */
+	unsigned attributes;   /**< percentage of messages and signals with a BA_ */
+	unsigned nodes;
+	uint64_t seed;
+} gen_t;
+
+typedef struct {
+	unsigned start, length;
+	bool motorola, is_signed;
+	int mux;               /**< -2 multiplexor, -1 plain, else switch value */
+} sig_t;
+
+static const char *units[] = { "", "km/h", "rpm", "degC", "V", "A", "%", "bar", "Nm", "deg" };
+static const double scalings[] = { 1, 1, 1, 0.5, 0.1, 0.01, 0.25, 2, 0.001 };
+static const double offsets[] = { 0, 0, 0, -40, -100, 10, -1000 };
+static const char *states[] = { "Off", "On", "Error", "Not Available", "Init", "Standby", "Active", "Fault" };
+
+static uint64_t rng = 1;
+
+static uint64_t next(void) /* xorshift64*, so runs are reproducible */
+{
+	rng ^= rng >> 12;
+	rng ^= rng << 25;
+	rng ^= rng >> 27;
+	return rng * UINT64_C(2685821657736338717);
+}
+
+static unsigned below(unsigned n)
+{
+	assert(n);
+	return next() % n;
+}
+
+static bool percent(unsigned p)
+{
+	return below(100) < p;
+}
+
+#define PICK(ARRAY) ((ARRAY)[below(sizeof(ARRAY) / sizeof((ARRAY)[0]))])
+
+/* The bits, in Intel (little endian) numbering, used by a signal or 0 if it
+ * does not fit in eight bytes. Motorola signals start at their most
+ * significant bit and go down through a byte then on to the next byte. */
+static uint64_t bits(unsigned start, unsigned length, bool motorola)
+{
+	uint64_t m = 0;
+	unsigned b = start;
+	for(unsigned i = 0; i < length; i++) {
+		if(b > 63)
+			return 0;
+		m |= UINT64_C(1) << b;
+		b = motorola ? (b % 8 ? b - 1 : b + 15) : b + 1;
+	}
+	return m;
+}
+
+/* Place a signal of up to 'length' bits in the first gap in 'used' it fits,
+ * shrinking it until it does, returns false if the message is full */
+static bool place(sig_t *s, uint64_t *used, unsigned length)
+{
+	for(; length; length--)
+		for(unsigned start = 0; start < 64; start++) {
+			const uint64_t m = bits(start, length, s->motorola);
+			if(m && !(m & *used)) {
+				*used |= m;
+				s->start = start;
+				s->length = length;
+				return true;
+			}
+		}
+	return false;
+}
+
+static unsigned long message_id(unsigned long i)
+{
+	return i < MAX_STANDARD ? i + 1 : (i + 1) | EXTENDED;
+}
+
+static void signal_line(const gen_t *g, unsigned long msg, unsigned i, const sig_t *s)
+{
+	assert(g);
+	assert(s);
+	char mux[16] = "";
+	if(s->mux == -2)
+		snprintf(mux, sizeof(mux), " M");
+	else if(s->mux >= 0)
+		snprintf(mux, sizeof(mux), " m%d", s->mux);
+	const double scaling = s->mux == -2 ? 1 : PICK(scalings);
+	const double offset = s->mux == -2 ? 0 : PICK(offsets);
+	const double lo = (s->is_signed ? -ldexp(1, s->length - 1) : 0) * scaling + offset;
+	const double hi = (ldexp(1, s->length - s->is_signed) - 1) * scaling + offset;
+	printf(" SG_ S%lu_%u%s : %u|%u@%c%c (%g,%g) [%g|%g] \"%s\" ECU%u\n",
+		msg, i, mux, s->start, s->length, s->motorola ? '0' : '1', s->is_signed ? '-' : '+',
+		scaling, offset, lo, hi, s->mux == -2 ? "" : PICK(units), below(g->nodes));
+}
+
+static unsigned message(const gen_t *g, unsigned long msg, sig_t *sigs)
+{
+	assert(g);
+	assert(sigs);
+	const bool mux = g->signals > 2 && percent(g->multiplexed);
+	const unsigned width = 64 / g->signals ? 64 / g->signals : 1;
+	uint64_t used = 0, group[MUX_GROUPS];
+	unsigned n = 0;
+
+	if(mux) {
+		sigs[n] = (sig_t) { .mux = -2 };
+		place(&sigs[n++], &used, MUX_BITS);
+	}
+	/* plain signals first, then each multiplexed group shares what is left */
+	for(unsigned i = n; i < g->signals; i++) {
+		sig_t s = {
+			.motorola  = percent(g->motorola),
+			.is_signed = percent(30),
+			.mux       = mux && i % 2 ? (int)(i / 2 % MUX_GROUPS) : -1,
+		};
+		if(s.mux >= 0)
+			continue;
+		if(place(&s, &used, 1 + below(width)))
+			sigs[n++] = s;
+	}
+	for(unsigned i = 0; i < MUX_GROUPS; i++)
+		group[i] = used;
+	for(unsigned i = 1; mux && i < g->signals; i += 2) {
+		sig_t s = { .motorola = percent(g->motorola), .is_signed = percent(30), .mux = i / 2 % MUX_GROUPS };
+		if(place(&s, &group[s.mux], 1 + below(width * 2)))
+			sigs[n++] = s;
+	}
+
+	printf("BO_ %lu M%lu: 8 ECU%u\n", message_id(msg), msg, below(g->nodes));
+	for(unsigned i = 0; i < n; i++)
+		signal_line(g, msg, i, &sigs[i]);
+	printf("\n");
+	return n;
+}
+
+static void usage(const char *arg0)
+{
+	fprintf(stderr, "usage: %s [-m messages] [-s signals] [-M motorola%%] [-x multiplexed%%]\n"
+			"\t[-V vals%%] [-c comments%%] [-a attributes%%] [-n nodes] [-r seed]\n", arg0);
+}
+
+static unsigned option(const char *arg, unsigned long max)
+{
+	char *end = NULL;
+	const unsigned long v = strtoul(arg, &end, 0);
+	if(!*arg || *end || v > max)
+		error("invalid option value (maximum %lu): %s", max, arg);
+	return v;
+}
+
+int main(int argc, char **argv)
+{
+	gen_t g = {
+		.messages    = 1000,
+		.signals     = 8,
+		.motorola    = 30,
+		.multiplexed = 10,
+		.vals        = 10,
+		.comments    = 20,
+		.attributes  = 50,
+		.nodes       = 16,
+		.seed        = 1,
+	};
+	int opt = 0;
+	while((opt = dbcc_getopt(argc, argv, "hm:s:M:x:V:c:a:n:r:")) != -1) {
+		switch(opt) {
+		case 'm': g.messages    = option(dbcc_optarg, 0x1FFFFFFE); break;
+		case 's': g.signals     = option(dbcc_optarg, 64); break;
+		case 'M': g.motorola    = option(dbcc_optarg, 100); break;
+		case 'x': g.multiplexed = option(dbcc_optarg, 100); break;
+		case 'V': g.vals        = option(dbcc_optarg, 100); break;
+		case 'c': g.comments    = option(dbcc_optarg, 100); break;
+		case 'a': g.attributes  = option(dbcc_optarg, 100); break;
+		case 'n': g.nodes       = option(dbcc_optarg, 1000); break;
+		case 'r': g.seed        = option(dbcc_optarg, UINT32_MAX); break;
+		case 'h': usage(argv[0]); return 0;
+		default:  usage(argv[0]); return 1;
+		}
+	}
+	if(!g.signals || !g.nodes) {
+		usage(argv[0]);
+		return 1;
+	}
+	rng = g.seed * UINT64_C(0x9E3779B97F4A7C15) | 1;
+
+	printf("VERSION \"\"\n\n\nNS_ :\n\tCM_\n\tBA_DEF_\n\tBA_\n\tVAL_\n\tBA_DEF_DEF_\n\nBS_:\n\nBU_:");
+	for(unsigned i = 0; i < g.nodes; i++)
+		printf(" ECU%u", i);
+	printf("\n\n\n");
+
+	/* the trailing sections refer back to the signals, so remember how many
+	 * each message got */
+	sig_t sigs[64 + 1];
+	unsigned *counts = allocate(sizeof(*counts) * (g.messages + 1));
+	for(unsigned long i = 0; i < g.messages; i++)
+		counts[i] = message(&g, i, sigs);
+
+	for(unsigned long i = 0; i < g.messages; i++) {
+		if(percent(g.comments))
+			printf("CM_ BO_ %lu \"Message %lu, sent periodically\";\n", message_id(i), i);
+		for(unsigned j = 0; j < counts[i]; j++)
+			if(percent(g.comments))
+				printf("CM_ SG_ %lu S%lu_%u \"Signal %u of message %lu\";\n", message_id(i), i, j, j, i);
+	}
+	printf("BA_DEF_ BO_ \"GenMsgCycleTime\" INT 0 10000;\n");
+	printf("BA_DEF_ SG_ \"GenSigStartValue\" INT 0 1000000;\n");
+	printf("BA_DEF_DEF_ \"GenMsgCycleTime\" 100;\n");
+	printf("BA_DEF_DEF_ \"GenSigStartValue\" 0;\n");
+	for(unsigned long i = 0; i < g.messages; i++) {
+		if(percent(g.attributes))
+			printf("BA_ \"GenMsgCycleTime\" BO_ %lu %u;\n", message_id(i), 10u << below(6));
+		for(unsigned j = 0; j < counts[i]; j++)
+			if(percent(g.attributes))
+				printf("BA_ \"GenSigStartValue\" SG_ %lu S%lu_%u %u;\n", message_id(i), i, j, below(256));
+	}
+	for(unsigned long i = 0; i < g.messages; i++)
+		for(unsigned j = 0; j < counts[i]; j++) {
+			if(!percent(g.vals))
+				continue;
+			printf("VAL_ %lu S%lu_%u ", message_id(i), i, j);
+			const unsigned items = 2 + below(sizeof(states) / sizeof(states[0]) - 1);
+			for(unsigned k = 0; k < items; k++)
+				printf("%u \"%s\" ", k, states[k]);
+			printf(";\n");
+		}
+	free(counts);
+	return fflush(stdout) < 0 || ferror(stdout);
+}
@@ -0,0 +1,18 @@
+# Summarises the '-P table' output of dbcc runs on files of increasing size,
+# the exponents are the slope of the time (or memory) against the number of
+# messages on a log-log scale since the previous file: 1 is linear, 2 is
+# quadratic.
+$1 == "total"    { wall = $2 / 1e3; cpu = $3 / 1e3 }
+$1 == "model:"   { messages = $2 }
+$1 == "peak" {
+	rss = $3
+	if (!header++)
+		printf "%10s %9s %9s %9s %10s %9s %7s %7s\n", "messages", "wall/s", "cpu/s", "us/msg", "peak/MiB", "KiB/msg", "t-exp", "m-exp"
+	texp = mexp = "-"
+	if (last_messages && messages > last_messages) {
+		texp = sprintf("%.2f", log(wall / last_wall) / log(messages / last_messages))
+		mexp = sprintf("%.2f", log(rss / last_rss) / log(messages / last_messages))
+	}
+	printf "%10d %9.3f %9.3f %9.2f %10.1f %9.2f %7s %7s\n", messages, wall, cpu, wall * 1e6 / messages, rss / 1024, rss / messages, texp, mexp
+	last_messages = messages; last_wall = wall; last_rss = rss
+}
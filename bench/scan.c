@@ -0,0 +1,82 @@
+/**@file scan.c
+ * @brief microbenchmark for the structural index (../scan.c), it checks all
+ * of the kernels agree and reports the throughput of each of them
+ * @license MIT */
+#include "scan.h"
+#include "util.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DEFAULT_SIZE (100ul * 1024ul * 1024ul)
+#define RUNS         (5)
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static bool same(const scan_index_t *a, const scan_index_t *b)
+{
+	return a->record_count == b->record_count
+		&& a->structural_count == b->structural_count
+		&& !memcmp(a->records, b->records, sizeof(*a->records) * a->record_count)
+		&& !memcmp(a->structurals, b->structurals, sizeof(*a->structurals) * a->structural_count);
+}
+
+int main(int argc, char **argv)
+{
+	if(argc < 2 || argc > 3) {
+		fprintf(stderr, "usage: %s file.dbc [bytes]\n", argv[0]);
+		return 1;
+	}
+	const size_t size = argc > 2 ? strtoul(argv[2], NULL, 0) : DEFAULT_SIZE;
+	FILE *f = fopen_or_die(argv[1], "rb");
+	char *file = slurp(f);
+	fclose(f);
+	const size_t flen = strlen(file);
+	if(!flen)
+		error("empty file: %s", argv[1]);
+
+	char *input = allocate(size + 1);
+	for(size_t i = 0; i < size; i += flen)
+		memcpy(input + i, file, size - i < flen ? size - i : flen);
+	printf("input: %s repeated to %zu bytes\n", argv[1], size);
+
+	int r = 0;
+	for(int structurals = 0; structurals < 2; structurals++) {
+		scan_index_t reference;
+		if(scan_index(&reference, input, size, SCAN_KERNEL_SCALAR, structurals) < 0)
+			error("scalar kernel failed");
+		printf("records: %zu structurals: %zu\n", reference.record_count, reference.structural_count);
+
+		for(scan_kernel_e k = SCAN_KERNEL_SCALAR; k < SCAN_KERNEL_COUNT; k++) {
+			if(!scan_kernel_available(k)) {
+				printf("%-8s not available\n", scan_kernel_name(k));
+				continue;
+			}
+			double best = 0;
+			for(int i = 0; i < RUNS; i++) {
+				scan_index_t idx;
+				const double start = now();
+				scan_index(&idx, input, size, k, structurals);
+				const double t = now() - start;
+				if(!same(&idx, &reference)) {
+					fprintf(stderr, "%s: index differs from scalar kernel\n", scan_kernel_name(k));
+					r = 1;
+				}
+				scan_index_free(&idx);
+				if(!i || t < best)
+					best = t;
+			}
+			printf("%-8s %8.3f GB/s\n", scan_kernel_name(k), size / best / 1e9);
+		}
+		scan_index_free(&reference);
+	}
+	free(input);
+	free(file);
+	return r;
+}
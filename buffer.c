@@ -0,0 +1,184 @@
+/**@note The formatting functions produce exactly what the printf family
+ * would for the same value, the backends used to be written with 'fprintf'
+ * and their output must not change. */
+#include "buffer.h"
+#include "util.h"
+#include <assert.h>
+#include <errno.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+buffer_t *buffer_new(FILE *output)
+{
+	assert(output);
+	buffer_t *b = allocate(sizeof(*b));
+	b->output = output;
+	b->data = allocate(BUFFER_SIZE);
+	return b;
+}
+
+int buffer_delete(buffer_t *b)
+{
+	if(!b)
+		return 0;
+	const int r = buffer_flush(b);
+	free(b->data);
+	free(b);
+	return r;
+}
+
+int buffer_flush(buffer_t *b)
+{
+	assert(b);
+	if(b->failed)
+		return -1;
+	errno = 0;
+	if(b->used && fwrite(b->data, 1, b->used, b->output) != b->used) {
+		warning("problem writing to FILE* <%p>: %s", b->output, emsg());
+		b->failed = true;
+		return -1;
+	}
+	b->used = 0;
+	return 0;
+}
+
+int buffer_bytes(buffer_t *b, const char *s, size_t length)
+{
+	assert(b);
+	assert(s);
+	while(length) {
+		if(b->used == BUFFER_SIZE && buffer_flush(b) < 0)
+			return -1;
+		const size_t space = BUFFER_SIZE - b->used;
+		const size_t n = length < space ? length : space;
+		memcpy(b->data + b->used, s, n);
+		b->used += n;
+		s += n;
+		length -= n;
+	}
+	return b->failed ? -1 : 0;
+}
+
+int buffer_string(buffer_t *b, const char *s)
+{
+	assert(s);
+	return buffer_bytes(b, s, strlen(s));
+}
+
+int buffer_char(buffer_t *b, char c)
+{
+	assert(b);
+	if(b->used == BUFFER_SIZE && buffer_flush(b) < 0)
+		return -1;
+	b->data[b->used++] = c;
+	return b->failed ? -1 : 0;
+}
+
+int buffer_repeat(buffer_t *b, char c, size_t count)
+{
+	assert(b);
+	while(count) {
+		if(b->used == BUFFER_SIZE && buffer_flush(b) < 0)
+			return -1;
+		const size_t space = BUFFER_SIZE - b->used;
+		const size_t n = count < space ? count : space;
+		memset(b->data + b->used, c, n);
+		b->used += n;
+		count -= n;
+	}
+	return b->failed ? -1 : 0;
+}
+
+/* digits are generated backwards from the end of a small scratch buffer */
+int buffer_unsigned(buffer_t *b, unsigned long u)
+{
+	char s[3 * sizeof(u) + 1];
+	size_t i = sizeof(s);
+	do {
+		s[--i] = '0' + (u % 10);
+		u /= 10;
+	} while(u);
+	return buffer_bytes(b, s + i, sizeof(s) - i);
+}
+
+int buffer_signed(buffer_t *b, long l)
+{
+	if(l >= 0)
+		return buffer_unsigned(b, l);
+	if(buffer_char(b, '-') < 0)
+		return -1;
+	return buffer_unsigned(b, 0ul - (unsigned long)l);
+}
+
+/* Most scalings, offsets and ranges in a DBC file are small integers, which
+ * "%g" prints without an exponent or a decimal point as long as they have no
+ * more than six digits, so they take the integer path. */
+int buffer_double(buffer_t *b, double d)
+{
+	if(d > -1e6 && d < 1e6 && d == (long)d) {
+		if(d == 0 && signbit(d))
+			return buffer_bytes(b, "-0", 2);
+		return buffer_signed(b, (long)d);
+	}
+	return buffer_printf(b, "%g", d);
+}
+
+int buffer_xml_escaped(buffer_t *b, const char *s)
+{
+	assert(s);
+	for(;;) {
+		const size_t run = strcspn(s, "\"'<>&");
+		if(buffer_bytes(b, s, run) < 0)
+			return -1;
+		s += run;
+		const char *r = NULL;
+		switch(*s) {
+		case '\0': return 0;
+		case '"':  r = "&quot;"; break;
+		case '\'': r = "&apos;"; break;
+		case '<':  r = "&lt;";   break;
+		case '>':  r = "&gt;";   break;
+		case '&':  r = "&amp;";  break;
+		}
+		if(buffer_string(b, r) < 0)
+			return -1;
+		s++;
+	}
+}
+
+int buffer_printf(buffer_t *b, const char *fmt, ...)
+{
+	assert(b);
+	assert(fmt);
+	va_list args, again;
+	va_start(args, fmt);
+	va_copy(again, args);
+	int r = -1;
+	size_t space = BUFFER_SIZE - b->used;
+	int n = vsnprintf(b->data + b->used, space, fmt, args);
+	if(n < 0)
+		goto done;
+	if((size_t)n < space) {
+		b->used += n;
+		r = b->failed ? -1 : 0;
+		goto done;
+	}
+	if(buffer_flush(b) < 0)
+		goto done;
+	if((size_t)n < BUFFER_SIZE) {
+		vsnprintf(b->data, BUFFER_SIZE, fmt, again);
+		b->used = n;
+		r = 0;
+		goto done;
+	}
+	char *big = allocate(n + 1);
+	vsnprintf(big, n + 1, fmt, again);
+	r = buffer_bytes(b, big, n);
+	free(big);
+done:
+	va_end(again);
+	va_end(args);
+	return r;
+}
@@ -0,0 +1,43 @@
+#ifndef BUFFER_H
+#define BUFFER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* An output buffer for the backends, text is collected in memory and written
+ * to the FILE* a megabyte at a time instead of going through stdio (and its
+ * lock and format string parsing) for every field. Errors are sticky, once
+ * a write has failed every later call returns -1 as well. */
+
+#define BUFFER_SIZE (1024u * 1024u)
+
+typedef struct {
+	FILE *output;
+	char *data;
+	size_t used;
+	bool failed;
+} buffer_t;
+
+buffer_t *buffer_new(FILE *output);
+int buffer_delete(buffer_t *b); /**< flushes, returns -1 if any write failed */
+int buffer_flush(buffer_t *b);
+int buffer_bytes(buffer_t *b, const char *s, size_t length);
+int buffer_string(buffer_t *b, const char *s);
+int buffer_char(buffer_t *b, char c);
+int buffer_repeat(buffer_t *b, char c, size_t count);
+int buffer_unsigned(buffer_t *b, unsigned long u);
+int buffer_signed(buffer_t *b, long l);
+int buffer_double(buffer_t *b, double d); /**< formatted as by "%g" */
+int buffer_xml_escaped(buffer_t *b, const char *s);
+int buffer_printf(buffer_t *b, const char *fmt, ...);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
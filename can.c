@@ -11,6 +11,82 @@
 #include <inttypes.h>
 #include <math.h>
 
+/* Every tag looked up in the AST; when the AST was built in an arena these
+ * are resolved to interned integer ids once, up front, so child lookups do
+ * not have to 'strcmp' against every child. */
+#define X_MACRO_AST_TAGS\
+	X(TAG_REGEX,          "regex")\
+	X(TAG_INTEGER,        "integer|regex")\
+	X(TAG_STRING,         "string|>")\
+	X(TAG_NAME,           "name|ident|regex")\
+	X(TAG_ID,             "id|integer|regex")\
+	X(TAG_ECU,            "ecu|ident|regex")\
+	X(TAG_DLC,            "dlc|integer|regex")\
+	X(TAG_STARTBIT,       "startbit|integer|regex")\
+	X(TAG_LENGTH,         "length|regex")\
+	X(TAG_ENDIANESS,      "endianess|char")\
+	X(TAG_SIGN,           "sign|char")\
+	X(TAG_Y_MX_C,         "y_mx_c|>")\
+	X(TAG_RANGE,          "range|>")\
+	X(TAG_UNIT,           "unit|string|>")\
+	X(TAG_NODES,          "nodes|>")\
+	X(TAG_ONE_NODE,       "nodes|node|ident|regex")\
+	X(TAG_NODE,           "node|ident|regex")\
+	X(TAG_MULTIPLEXED,    "multiplexor|>")\
+	X(TAG_MULTIPLEXOR,    "multiplexor|char")\
+	X(TAG_SIGTYPE,        "sigtype|integer|regex")\
+	X(TAG_SIGVAL,         "sigval|>")\
+	X(TAG_SIGNAL,         "signal|>")\
+	X(TAG_MESSAGE,        "message|>")\
+	X(TAG_MESSAGES,       "messages|>")\
+	X(TAG_VAL_ITEM,       "val_item|>")\
+	X(TAG_VAL,            "val|>")\
+	X(TAG_VALS,           "vals|>")\
+	X(TAG_COMMENT,        "comment|>")\
+	X(TAG_COMMENTS,       "comments|>")\
+	X(TAG_COMMENT_STRING, "comment_string|string|>")
+
+typedef enum {
+#define X(ENUM, TAG) ENUM,
+	X_MACRO_AST_TAGS
+#undef X
+	TAG_COUNT
+} ast_tag_e;
+
+static const char *ast_tag_names[] = {
+#define X(ENUM, TAG) TAG,
+	X_MACRO_AST_TAGS
+#undef X
+};
+
+typedef struct {
+	mpc_ast_arena_t *arena; /**< NULL if the AST was heap allocated */
+	int ids[TAG_COUNT];     /**< interned tag ids, if 'arena' is set */
+} ast_tags_t;
+
+static void ast_tags_init(ast_tags_t *t, mpc_ast_arena_t *arena)
+{
+	assert(t);
+	t->arena = arena;
+	for(size_t i = 0; i < TAG_COUNT; i++)
+		t->ids[i] = arena ? mpc_ast_arena_tag(arena, ast_tag_names[i]) : -1;
+}
+
+/* index of the first child at or after 'lb' with 'tag', or -1 */
+static int ast_index(const ast_tags_t *t, mpc_ast_t *ast, ast_tag_e tag, int lb)
+{
+	assert(t && ast && tag < TAG_COUNT);
+	if(t->arena)
+		return mpc_ast_get_index_id(ast, t->ids[tag], lb);
+	return mpc_ast_get_index_lb(ast, ast_tag_names[tag], lb);
+}
+
+static mpc_ast_t *ast_child(const ast_tags_t *t, mpc_ast_t *ast, ast_tag_e tag)
+{
+	const int i = ast_index(t, ast, tag, 0);
+	return i < 0 ? NULL : ast->children[i];
+}
+
 static signal_t *signal_new(void)
 {
 	return allocate(sizeof(signal_t));
@@ -80,57 +156,114 @@ static void range(mpc_ast_t *ast, signal_t *sig)
 	assert(r == 1);
 }
 
-/**@todo implement nodes function
-static void nodes(mpc_ast_t *ast, signal_t *sig)
+static void units(const ast_tags_t *t, mpc_ast_t *ast, signal_t *sig)
 {
 	assert(ast && sig);
+	mpc_ast_t *unit = ast_child(t, ast, TAG_REGEX);
+	sig->units = duplicate(unit->contents);
 }
-*/
 
-static void units(mpc_ast_t *ast, signal_t *sig)
+/* the receivers of a signal, a single one is folded into the 'nodes' tag */
+static void nodes(const ast_tags_t *t, mpc_ast_t *ast, signal_t *sig)
 {
 	assert(ast && sig);
-	mpc_ast_t *unit = mpc_ast_get_child(ast, "regex");
-	sig->units = duplicate(unit->contents);
+	mpc_ast_t *one = ast_child(t, ast, TAG_ONE_NODE);
+	if(one) {
+		sig->ecus = allocate(sizeof(*sig->ecus) * 2);
+		sig->ecus[sig->ecu_count++] = duplicate(one->contents);
+		return;
+	}
+	mpc_ast_t *list = ast_child(t, ast, TAG_NODES);
+	if(!list)
+		return;
+	sig->ecus = allocate(sizeof(*sig->ecus) * (list->children_num + 1));
+	for(int i = 0; (i = ast_index(t, list, TAG_NODE, i)) >= 0; i++)
+		sig->ecus[sig->ecu_count++] = duplicate(list->children[i]->contents);
+}
+
+static int sigval_compare(const void *a, const void *b)
+{
+	const sigval_t *x = a, *y = b;
+	if(x->id != y->id)
+		return x->id < y->id ? -1 : 1;
+	return strcmp(x->name, y->name);
+}
+
+typedef struct {
+	sigval_t sv;
+	size_t order; /**< position in the file, the first entry for a signal wins */
+} sigval_order_t;
+
+static int sigval_order_compare(const void *a, const void *b)
+{
+	const sigval_order_t *x = a, *y = b;
+	const int r = sigval_compare(&x->sv, &y->sv);
+	if(r)
+		return r;
+	return x->order < y->order ? -1 : x->order > y->order;
 }
 
-static int sigval(mpc_ast_t *top, unsigned id, const char *signal)
+static void ast2sigvals(const ast_tags_t *t, mpc_ast_t *top, dbc_t *dbc)
 {
 	assert(top);
-	assert(signal);
+	assert(dbc);
+	sigval_order_t *o = allocate(sizeof(*o) * (top->children_num+1));
+	size_t j = 0;
 	for(int i = 0; i >= 0;) {
-		i = mpc_ast_get_index_lb(top, "sigval|>", i);
+		i = ast_index(t, top, TAG_SIGVAL, i);
 		if(i >= 0) {
-			mpc_ast_t *sv = mpc_ast_get_child_lb(top, "sigval|>", i);
-			mpc_ast_t *name   = mpc_ast_get_child(sv, "name|ident|regex");
-			mpc_ast_t *svid = mpc_ast_get_child(sv,   "id|integer|regex");
+			mpc_ast_t *sv = top->children[i];
+			mpc_ast_t *name = ast_child(t, sv, TAG_NAME);
+			mpc_ast_t *svid = ast_child(t, sv, TAG_ID);
+			mpc_ast_t *type = ast_child(t, sv, TAG_SIGTYPE);
 			assert(name);
 			assert(svid);
-			unsigned svidd = 0;
-			sscanf(svid->contents, "%u", &svidd);
-			if(id == svidd && !strcmp(signal, name->contents)) {
-				unsigned typed = 0;
-				mpc_ast_t *type = mpc_ast_get_child(sv, "sigtype|integer|regex");
-				sscanf(type->contents, "%u", &typed);
-				debug("floating -> %s:%u:%u\n", name->contents, id, typed);
-				return typed;
-			}
+			sscanf(svid->contents, "%u", &o[j].sv.id);
+			sscanf(type->contents, "%u", &o[j].sv.type);
+			o[j].sv.name = duplicate(name->contents);
+			o[j].order = j;
+			j++;
 			i++;
 		}
 	}
+	qsort(o, j, sizeof(*o), sigval_order_compare);
+	dbc->sigvals = allocate(sizeof(*dbc->sigvals) * (j+1));
+	for(size_t i = 0; i < j; i++)
+		dbc->sigvals[i] = o[i].sv;
+	dbc->sigval_count = j;
+	free(o);
+}
+
+static int sigval(const dbc_t *dbc, unsigned id, const char *signal)
+{
+	assert(dbc);
+	assert(signal);
+	const sigval_t key = { .id = id, .name = (char*)signal };
+	size_t lo = 0, hi = dbc->sigval_count;
+	while(lo < hi) { /* lower bound, the first matching entry */
+		const size_t mid = lo + (hi - lo)/2;
+		if(sigval_compare(&dbc->sigvals[mid], &key) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if(lo < dbc->sigval_count && !sigval_compare(&dbc->sigvals[lo], &key)) {
+		debug("floating -> %s:%u:%u\n", signal, id, dbc->sigvals[lo].type);
+		return dbc->sigvals[lo].type;
+	}
 	return -1;
 }
 
-static signal_t *ast2signal(mpc_ast_t *top, mpc_ast_t *ast, unsigned can_id)
+static signal_t *ast2signal(const ast_tags_t *t, const dbc_t *dbc, mpc_ast_t *ast, unsigned can_id)
 {
 	int r;
 	assert(ast);
 	signal_t *sig = signal_new();
-	mpc_ast_t *name   = mpc_ast_get_child(ast, "name|ident|regex");
-	mpc_ast_t *start  = mpc_ast_get_child(ast, "startbit|integer|regex");
-	mpc_ast_t *length = mpc_ast_get_child(ast, "length|regex");
-	mpc_ast_t *endianess = mpc_ast_get_child(ast, "endianess|char");
-	mpc_ast_t *sign   = mpc_ast_get_child(ast, "sign|char");
+	mpc_ast_t *name   = ast_child(t, ast, TAG_NAME);
+	mpc_ast_t *start  = ast_child(t, ast, TAG_STARTBIT);
+	mpc_ast_t *length = ast_child(t, ast, TAG_LENGTH);
+	mpc_ast_t *endianess = ast_child(t, ast, TAG_ENDIANESS);
+	mpc_ast_t *sign   = ast_child(t, ast, TAG_SIGN);
 	sig->name = duplicate(name->contents);
 	sig->val_list = NULL;
 	r = sscanf(start->contents, "%u", &sig->start_bit);
@@ -146,24 +279,24 @@ static signal_t *ast2signal(mpc_ast_t *top, mpc_ast_t *ast, unsigned can_id)
 	assert(signchar == '+' || signchar == '-');
 	sig->is_signed = signchar == '-';
 
-	y_mx_c(mpc_ast_get_child(ast, "y_mx_c|>"), sig);
-	range(mpc_ast_get_child(ast, "range|>"), sig);
-	units(mpc_ast_get_child(ast, "unit|string|>"), sig);
-	/*nodes(mpc_ast_get_child(ast, "nodes|node|ident|regex|>"), sig);*/
+	y_mx_c(ast_child(t, ast, TAG_Y_MX_C), sig);
+	range(ast_child(t, ast, TAG_RANGE), sig);
+	units(t, ast_child(t, ast, TAG_UNIT), sig);
+	nodes(t, ast, sig);
 
 	/* process multiplexed values, if present */
-	mpc_ast_t *multiplex = mpc_ast_get_child(ast, "multiplexor|>");
+	mpc_ast_t *multiplex = ast_child(t, ast, TAG_MULTIPLEXED);
 	if(multiplex) {
 		sig->is_multiplexed = true;
 		sig->switchval = atol(multiplex->children[1]->contents);
 	}
 
-	if(mpc_ast_get_child(ast, "multiplexor|char")) {
+	if(ast_child(t, ast, TAG_MULTIPLEXOR)) {
 		assert(!sig->is_multiplexed);
 		sig->is_multiplexor = true;
 	}
 
-	sig->sigval = sigval(top, can_id, sig->name);
+	sig->sigval = sigval(dbc, can_id, sig->name);
 	if(sig->sigval == 1 || sig->sigval == 2)
 		sig->is_floating = true;
 
@@ -174,33 +307,33 @@ static signal_t *ast2signal(mpc_ast_t *top, mpc_ast_t *ast, unsigned can_id)
 	return sig;
 }
 
-static val_list_t *ast2val(mpc_ast_t *top, mpc_ast_t *ast)
+static val_list_t *ast2val(const ast_tags_t *t, mpc_ast_t *top, mpc_ast_t *ast)
 {
 	assert(top);
 	assert(ast);
 	val_list_t *val = allocate(sizeof(val_list_t));
 
-	mpc_ast_t *id   = mpc_ast_get_child(ast, "id|integer|regex");
+	mpc_ast_t *id   = ast_child(t, ast, TAG_ID);
 	int r = sscanf(id->contents,  "%u",  &val->id);
 	assert(r == 1);
 
-	mpc_ast_t *name = mpc_ast_get_child(ast, "name|ident|regex");
+	mpc_ast_t *name = ast_child(t, ast, TAG_NAME);
 	val->name = duplicate(name->contents);
 
 	val_list_item_t **items = allocate(sizeof(*items) * (ast->children_num+1));
 	int j = 0;
 	for(int i = 0; i >= 0;) {
-		i = mpc_ast_get_index_lb(ast, "val_item|>", i);
+		i = ast_index(t, ast, TAG_VAL_ITEM, i);
 		if(i >= 0) {
 			val_list_item_t *item = allocate(sizeof(val_list_item_t));
-			mpc_ast_t *val_item_ast = mpc_ast_get_child_lb(ast, "val_item|>", i);
+			mpc_ast_t *val_item_ast = ast->children[i];
 
-			mpc_ast_t *val_item_index = mpc_ast_get_child(val_item_ast, "integer|regex");
+			mpc_ast_t *val_item_index = ast_child(t, val_item_ast, TAG_INTEGER);
 			int r = sscanf(val_item_index->contents,  "%u",  &item->value);
 			assert(r == 1);
 
-			mpc_ast_t *val_item_name = mpc_ast_get_child(val_item_ast, "string|>");
-			val_item_name = mpc_ast_get_child_lb(val_item_name, "regex", 1);
+			mpc_ast_t *val_item_name = ast_child(t, val_item_ast, TAG_STRING);
+			val_item_name = val_item_name->children[ast_index(t, val_item_name, TAG_REGEX, 1)];
 			item->name = duplicate(val_item_name->contents);
 			items[j++] = item;
 			i++;
@@ -229,15 +362,15 @@ static val_list_t *ast2val(mpc_ast_t *top, mpc_ast_t *ast)
 	return val;
 }
 
-static can_msg_t *ast2msg(mpc_ast_t *top, mpc_ast_t *ast, dbc_t *dbc)
+static can_msg_t *ast2msg(const ast_tags_t *t, mpc_ast_t *ast, const dbc_t *dbc)
 {
-	assert(top);
 	assert(ast);
+	assert(dbc);
 	can_msg_t *c = can_msg_new();
-	mpc_ast_t *name = mpc_ast_get_child(ast, "name|ident|regex");
-	mpc_ast_t *ecu  = mpc_ast_get_child(ast, "ecu|ident|regex");
-	mpc_ast_t *dlc  = mpc_ast_get_child(ast, "dlc|integer|regex");
-	mpc_ast_t *id   = mpc_ast_get_child(ast, "id|integer|regex");
+	mpc_ast_t *name = ast_child(t, ast, TAG_NAME);
+	mpc_ast_t *ecu  = ast_child(t, ast, TAG_ECU);
+	mpc_ast_t *dlc  = ast_child(t, ast, TAG_DLC);
+	mpc_ast_t *id   = ast_child(t, ast, TAG_ID);
 	c->name = duplicate(name->contents);
 	c->ecu  = duplicate(ecu->contents);
 	int r = sscanf(dlc->contents, "%u", &c->dlc);
@@ -249,11 +382,11 @@ static can_msg_t *ast2msg(mpc_ast_t *top, mpc_ast_t *ast, dbc_t *dbc)
 	signal_t **signal_s = allocate(sizeof(*signal_s));
 	size_t len = 1, j = 0;
 	for(int i = 0; i >= 0;) {
-		i = mpc_ast_get_index_lb(ast, "signal|>", i);
+		i = ast_index(t, ast, TAG_SIGNAL, i);
 		if(i >= 0) {
-			mpc_ast_t *sig_ast = mpc_ast_get_child_lb(ast, "signal|>", i);
+			mpc_ast_t *sig_ast = ast->children[i];
 			signal_s = reallocator(signal_s, sizeof(*signal_s)*++len);
-			signal_s[j++] = ast2signal(top, sig_ast, c->id);
+			signal_s[j++] = ast2signal(t, dbc, sig_ast, c->id);
 			i++;
 		}
 	}
@@ -301,9 +434,15 @@ void dbc_delete(dbc_t *dbc)
 		return;
 	for (size_t i = 0; i < dbc->message_count; i++)
 		can_msg_delete(dbc->messages[i]);
+	free(dbc->messages);
 
 	for (size_t i = 0; i < dbc->val_count; i++)
 		val_delete(dbc->vals[i]);
+	free(dbc->vals);
+
+	for (size_t i = 0; i < dbc->sigval_count; i++)
+		free(dbc->sigvals[i].name);
+	free(dbc->sigvals);
 
 	free(dbc);
 }
@@ -332,78 +471,90 @@ void assign_comment_to_message(dbc_t *dbc, const char *comment, unsigned message
 	}
 }
 
-dbc_t *ast2dbc(mpc_ast_t *ast)
+dbc_t *ast2dbc_begin(mpc_ast_t *ast, mpc_ast_arena_t *arena)
 {
 	dbc_t *d = dbc_new();
+	ast_tags_t tags;
+	ast_tags_init(&tags, arena);
+	const ast_tags_t *t = &tags;
 
 	// find and store the vals into the dbc: they will be assigned to
 	// signals later
-	mpc_ast_t *vals_ast = mpc_ast_get_child_lb(ast, "vals|>", 0);
+	mpc_ast_t *vals_ast = ast_child(t, ast, TAG_VALS);
 	if (vals_ast) {
 		d->val_count = vals_ast->children_num;
 		d->vals = allocate(sizeof(*d->vals) * (d->val_count+1));
 		if (d->val_count) {
 			int j = 0;
 			for(int i = 0; i >= 0;) {
-				i = mpc_ast_get_index_lb(vals_ast, "val|>", i);
+				i = ast_index(t, vals_ast, TAG_VAL, i);
 				if(i >= 0) {
-					mpc_ast_t *val_ast = mpc_ast_get_child_lb(vals_ast, "val|>", i);
-					d->vals[j++] = ast2val(ast, val_ast);
+					mpc_ast_t *val_ast = vals_ast->children[i];
+					d->vals[j++] = ast2val(t, ast, val_ast);
 					i++;
 				}
 			}
 		}
 	}
 
-	int index     = mpc_ast_get_index_lb(ast, "messages|>", 0);
-	mpc_ast_t *msgs_ast = mpc_ast_get_child_lb(ast, "messages|>", 0);
-	if(index < 0) {
-		warning("no messages found");
-		return NULL;
-	}
-
-	int n = msgs_ast->children_num;
-	if(n <= 0) {
-		warning("messages has no children");
-		return NULL;
-	}
+	ast2sigvals(t, ast, d);
+	d->use_float = d->sigval_count > 0;
+	return d;
+}
 
-	can_msg_t **r = allocate(sizeof(*r) * (n+1));
-	int j = 0;
+can_msg_t **ast2msgs(const dbc_t *dbc, mpc_ast_t *msgs, mpc_ast_arena_t *arena, size_t *count)
+{
+	assert(dbc);
+	assert(msgs);
+	assert(count);
+	ast_tags_t tags;
+	ast_tags_init(&tags, arena);
+	const ast_tags_t *t = &tags;
+
+	can_msg_t **r = allocate(sizeof(*r) * (msgs->children_num+1));
+	size_t j = 0;
 	for(int i = 0; i >= 0;) {
-		i = mpc_ast_get_index_lb(msgs_ast, "message|>", i);
+		i = ast_index(t, msgs, TAG_MESSAGE, i);
 		if(i >= 0) {
-			mpc_ast_t *msg_ast = mpc_ast_get_child_lb(msgs_ast, "message|>", i);
-			r[j++] = ast2msg(ast, msg_ast, d);
+			r[j++] = ast2msg(t, msgs->children[i], dbc);
 			i++;
 		}
 	}
-	d->message_count = j;
-	d->messages = r;
+	*count = j;
+	return r;
+}
+
+dbc_t *ast2dbc_end(dbc_t *d, mpc_ast_t *ast, mpc_ast_arena_t *arena, can_msg_t **msgs, size_t count)
+{
+	assert(d);
+	assert(ast);
+	assert(msgs);
+	ast_tags_t tags;
+	ast_tags_init(&tags, arena);
+	const ast_tags_t *t = &tags;
 
-	int i = mpc_ast_get_index_lb(ast, "sigval|>", 0);
-	if (i >= 0)
-		d->use_float = true;
+	d->message_count = count;
+	d->messages = msgs;
 
 	// find and store the vals into the dbc: they will be assigned to
 	// signals later
-	mpc_ast_t *comments_ast = mpc_ast_get_child_lb(ast, "comments|>", 0);
+	mpc_ast_t *comments_ast = ast_child(t, ast, TAG_COMMENTS);
 	if (comments_ast && comments_ast->children_num) {
 		for(int i = 0; i >= 0;) {
-			i = mpc_ast_get_index_lb(comments_ast, "comment|>", i);
+			i = ast_index(t, comments_ast, TAG_COMMENT, i);
 			if(i >= 0) {
-				mpc_ast_t *comment_ast = mpc_ast_get_child_lb(comments_ast, "comment|>", i);
+				mpc_ast_t *comment_ast = comments_ast->children[i];
 				if (comments_ast && comments_ast->children_num > 3) {
 					bool to_message = strcmp(comment_ast->children[2]->contents, "BO_") == 0;
 					bool to_signal = strcmp(comment_ast->children[2]->contents, "SG_") == 0;
 					if (to_signal || to_message) {
-						mpc_ast_t *id   = mpc_ast_get_child(comment_ast, "id|integer|regex");
+						mpc_ast_t *id   = ast_child(t, comment_ast, TAG_ID);
 						unsigned message_id;
 						int r = sscanf(id->contents, "%u", &message_id);
 						assert(r == 1);
-						mpc_ast_t *comment = mpc_ast_get_child(comment_ast, "comment_string|string|>");
+						mpc_ast_t *comment = ast_child(t, comment_ast, TAG_COMMENT_STRING);
 						if (to_signal) {
-							mpc_ast_t *signal_name = mpc_ast_get_child(comment_ast, "name|ident|regex");
+							mpc_ast_t *signal_name = ast_child(t, comment_ast, TAG_NAME);
 							assign_comment_to_signal(d, comment->children[1]->contents, message_id, signal_name->contents);
 						} else  {
 							assign_comment_to_message(d, comment->children[1]->contents, message_id);
@@ -419,3 +570,30 @@ dbc_t *ast2dbc(mpc_ast_t *ast)
 }
 
 
+
+dbc_t *ast2dbc(mpc_ast_t *ast, mpc_ast_arena_t *arena)
+{
+	dbc_t *d = ast2dbc_begin(ast, arena);
+	ast_tags_t tags;
+	ast_tags_init(&tags, arena);
+	const ast_tags_t *t = &tags;
+
+	int index     = ast_index(t, ast, TAG_MESSAGES, 0);
+	if(index < 0) {
+		warning("no messages found");
+		dbc_delete(d);
+		return NULL;
+	}
+	mpc_ast_t *msgs_ast = ast->children[index];
+
+	int n = msgs_ast->children_num;
+	if(n <= 0) {
+		warning("messages has no children");
+		dbc_delete(d);
+		return NULL;
+	}
+
+	size_t count = 0;
+	can_msg_t **r = ast2msgs(d, msgs_ast, arena, &count);
+	return ast2dbc_end(d, ast, arena, r, count);
+}
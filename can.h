@@ -56,6 +56,12 @@ typedef struct {
 	char *comment;
 } signal_t;
 
+typedef struct {
+	unsigned id;   /**< identifier of the message the signal belongs to */
+	char *name;    /**< signal name */
+	unsigned type; /**< 1 == float, 2 == double */
+} sigval_t;
+
 typedef struct {
 	char *name;          /**< can message name */
 	char *ecu;           /**< name of ECU @todo check this makes sense */
@@ -73,9 +79,23 @@ typedef struct {
 	can_msg_t **messages; /**< list of messages */
 	size_t val_count;     /**< count of vals */
 	val_list_t **vals;    /**< value list; used for enumerations in DBC file */
+	size_t sigval_count;  /**< count of sigvals */
+	sigval_t *sigvals;    /**< signal value types, sorted by id and name */
 } dbc_t;
 
-dbc_t *ast2dbc(mpc_ast_t *ast);
+dbc_t *dbc_new(void);
+
+/* 'arena' is the arena 'ast' was parsed into, or NULL if it is heap allocated */
+dbc_t *ast2dbc(mpc_ast_t *ast, mpc_ast_arena_t *arena);
+
+/* 'ast2dbc' in stages, so the messages section can be parsed and converted
+ * separately (see 'parse_dbc_file_parallel'). 'ast2dbc_begin' converts
+ * everything the messages depend on, 'ast2msgs' converts the children of a
+ * 'messages' AST and may be called concurrently as long as each call has its
+ * own arena, 'ast2dbc_end' takes ownership of all the messages. */
+dbc_t *ast2dbc_begin(mpc_ast_t *ast, mpc_ast_arena_t *arena);
+can_msg_t **ast2msgs(const dbc_t *dbc, mpc_ast_t *msgs, mpc_ast_arena_t *arena, size_t *count);
+dbc_t *ast2dbc_end(dbc_t *dbc, mpc_ast_t *ast, mpc_ast_arena_t *arena, can_msg_t **msgs, size_t count);
 void dbc_delete(dbc_t *dbc);
 
 #ifdef __cplusplus
@@ -1,15 +1,164 @@
 /* SocketCAN read */
+#define _GNU_SOURCE /* for recvmmsg and pthread_setaffinity_np */
+#include "buffer.h"
+#define sigval_t dbcc_sigval_t /* the model's signal type clashes with <signal.h> */
+#include "decode.h"
+#include "filter.h"
+#undef sigval_t
 #include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
-#include <unistd.h> 
+#include <stdint.h>
+#include <unistd.h>
 #include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
 #include <net/if.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
 #include <linux/can.h>
 #include <linux/can/raw.h>
+#include <linux/filter.h>
+#include <linux/net_tstamp.h>
+
+#define BATCH_MAX (1024u)
+#define BUSES_MAX (16u)
+#define RING_SIZE (4096u)  /* frames queued per bus for merging, a power of two */
+#define MERGE_LAG (10)     /* ms an idle bus may hold up the merged output */
+#define CAPTURE_BLOCK  (1u << 16) /* bytes in a block of the capture ring */
+#define CAPTURE_BLOCKS (64u)
+#define CAPTURE_FRAME  (128u)     /* only a hint for TPACKET_V3 */
+#define CAPTURE_RETIRE (1)        /* ms before a block that is not full is handed over */
+#define TX_SPIN   (50000u)   /* ns before frames are due to stop sleeping and spin */
+#define TX_BACKOFF (1)       /* ms to wait for a full device queue to drain */
+#define LATENCIES (32u)    /* histogram buckets, powers of two of ns */
+#define CONTROL   (CMSG_SPACE(3 * sizeof(struct timespec)) + CMSG_SPACE(sizeof(struct timespec)))
+
+#define LOAD(X)     __atomic_load_n(&(X), __ATOMIC_ACQUIRE)
+#define STORE(X, V) __atomic_store_n(&(X), (V), __ATOMIC_RELEASE)
+
+typedef struct {
+	struct can_frame frame;
+	uint64_t time; /* ns since the epoch, zero if not known */
+} record_t;
+
+typedef enum {
+	STAMP_NONE,     /* not wanted */
+	STAMP_USER,     /* read the clock after each 'recvmmsg' */
+	STAMP_KERNEL,   /* SO_TIMESTAMPNS, software only */
+	STAMP_TIMESTAMPING, /* SO_TIMESTAMPING, hardware where the driver has it */
+} stamp_e;
+
+/* Frames from one bus on their way to the merge, with one producer (the
+ * bus' worker) and one consumer (the merge) no locks are needed. The
+ * watermark is a time that no frame still to come from the bus will be
+ * stamped before, it lets the merge go on past a bus that is idle. The
+ * merged output lags an idle bus by up to twice MERGE_LAG. */
+typedef struct {
+	record_t records[RING_SIZE];
+	unsigned long head, tail; /* written by the consumer, the producer */
+	uint64_t watermark;
+	bool done;
+} ring_t;
+
+/* Decoding state and output, one per bus or one for the merged stream */
+typedef struct {
+	buffer_t *out;
+	double *values;     /* room for the largest message */
+	unsigned long failures;
+} printer_t;
+
+/* Frames queued to be sent with one 'sendmmsg', the statistics are of
+ * how late the first flush of each cycle was against the time it was due */
+typedef struct {
+	int fd;             /* -1 if nothing is sent */
+	unsigned long frames; /* to send, 0 for no limit */
+	uint64_t seed;
+	unsigned count;
+	uint64_t due;       /* when the current cycle is to be sent */
+	bool started;       /* the current cycle has waited for 'due' */
+	struct can_frame queue[BATCH_MAX];
+	struct iovec iov[BATCH_MAX];
+	struct mmsghdr msgs[BATCH_MAX];
+	unsigned long sent, syscalls, backoffs, flushes;
+	uint64_t late, late_max; /* ns */
+} tx_t;
+
+/* A TPACKET_V3 receive ring shared with the kernel */
+typedef struct {
+	uint8_t *map;      /* NULL if the socket is read with 'recvmmsg' */
+	size_t size;
+	unsigned block;    /* the next to look at */
+} capture_t;
+
+typedef struct {
+	const char *name;
+	int fd, cpu;
+	pthread_t thread, sender;
+	printer_t printer;  /* unused when merging */
+	ring_t *ring;       /* NULL unless merging */
+	tx_t tx;
+	unsigned long frames, syscalls;
+	int error;          /* errno of a failed receive */
+	stamp_e stamps;
+	bool user_filter;   /* the socket is not CAN_RAW, so filter here */
+	capture_t capture;
+	unsigned long latency[LATENCIES]; /* time stamp to decoded, when busy polling */
+	uint64_t latency_max;
+	struct can_frame frames_in[BATCH_MAX];
+	struct iovec iov[BATCH_MAX];
+	struct mmsghdr msgs[BATCH_MAX];
+	union { char data[CONTROL]; struct cmsghdr align; } control[BATCH_MAX];
+} bus_t;
+
+static dbcc_ctx_t *ctx;           /* decode with this if not NULL, else dump bytes */
+static unsigned long batch = 64;  /* frames asked for per 'recvmmsg' */
+static bool named;                /* more than one bus, so say which */
+static bool hardware;             /* prefer hardware time stamps */
+static int stop_fd = -1;          /* readable once the program should stop */
+static volatile sig_atomic_t stopping; /* for busy polling, which never waits */
+static long busy_poll = -1;       /* SO_BUSY_POLL in us, 0 to only spin, -1 to wait */
+static int priority;              /* SCHED_FIFO priority of the workers, 0 for none */
+static uint64_t period;           /* ns between transmissions of every message */
+static uint64_t spin_for = TX_SPIN; /* ns spun for before a transmission */
+static filter_set_t filters;      /* receive only these, if there are any */
+static struct sock_fprog program; /* predicates on the payload from the manifest, if any */
+
+static void stop(int sig)
+{
+	(void)sig;
+	stopping = 1;
+	const uint64_t one = 1;
+	if(write(stop_fd, &one, sizeof(one)) < 0)
+		return;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t stamp(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
 
 static int open_can_device(const char *port)
 {
@@ -21,97 +170,787 @@ static int open_can_device(const char *port)
 		return -1;
 
 	addr.can_family = AF_CAN;
-	strcpy(ifr.ifr_name, port);
+	strncpy(ifr.ifr_name, port, sizeof(ifr.ifr_name) - 1);
+	ifr.ifr_name[sizeof(ifr.ifr_name) - 1] = '\0';
 
 	if((r = ioctl(fd, SIOCGIFINDEX, &ifr)) < 0)
 		return r;
 
 	addr.can_ifindex = ifr.ifr_ifindex;
 
-	if((r = fcntl(fd, F_SETFL, O_NONBLOCK)) < 0)
-		return r;
 	if((r = bind(fd, (struct sockaddr *)&addr, sizeof(addr))) < 0)
 		return r;
 	return fd;
 }
 
-static int read_can_loop(int port)
-{
-	struct can_frame frame_rd;
-	int recvbytes = 0;
-
-	while (true) {
-		struct timeval timeout = { 1, 0 };
-		fd_set read_set;
-		FD_ZERO(&read_set);
-		FD_SET(port, &read_set);
-
-		if (select((port + 1), &read_set, NULL, NULL, &timeout) >= 0) {
-			if (FD_ISSET(port, &read_set)) {
-				errno = 0;
-				recvbytes = read(port, &frame_rd, sizeof(struct can_frame));
-				if(recvbytes < 0)
-					switch(errno) {
-					/*case EWOULDBLOCK:*/
-					case EAGAIN: usleep(1);
-					case EINTR:
-						continue;
-					default:
-						return -errno;
-					}
-				if (recvbytes) {
-					printf("id 0x%03x, dlc = %d\n\t", frame_rd.can_id, frame_rd.can_dlc);
-					for (unsigned i = 0; i < frame_rd.can_dlc; i++)
-						printf("%02x ", frame_rd.data[i]);
-					printf("\n");
-				}
-			}
+/* The ID as the DBC file has it, extended IDs have the top bit set in both */
+static unsigned long frame_id(const struct can_frame *f)
+{
+	if(f->can_id & CAN_EFF_FLAG)
+		return f->can_id & (CAN_EFF_FLAG | CAN_EFF_MASK);
+	return f->can_id & CAN_SFF_MASK;
+}
+
+static void print_header(printer_t *p, const char *bus, uint64_t time, unsigned long id, unsigned dlc)
+{
+	if(time)
+		buffer_printf(p->out, "(%lu.%06lu) ", (unsigned long)(time / 1000000000u), (unsigned long)(time % 1000000000u / 1000u));
+	if(named)
+		buffer_printf(p->out, "%s ", bus);
+	buffer_printf(p->out, "id 0x%03lx, dlc = %u\n", id, dlc);
+}
+
+/* Frames that are not in the DBC file, or that it cannot decode, are
+ * dumped as bytes */
+static int print_frame(printer_t *p, const char *bus, const struct can_frame *f, uint64_t time)
+{
+	const decode_plan_t *plan = ctx ? dbcc_plan(ctx, frame_id(f)) : NULL;
+	if(!plan || dbcc_decode_plan(plan, f->data, f->can_dlc, p->values) < 0) {
+		p->failures += ctx != NULL;
+		print_header(p, bus, time, frame_id(f), f->can_dlc);
+		buffer_char(p->out, '\t');
+		for (unsigned i = 0; i < f->can_dlc && i < CAN_MAX_DLEN; i++)
+			buffer_printf(p->out, "%02x ", f->data[i]);
+		buffer_char(p->out, '\n');
+	} else {
+		print_header(p, bus, time, plan->id, f->can_dlc);
+		for (size_t i = 0; i < plan->signal_count; i++) {
+			if(isnan(p->values[i])) /* multiplexed out */
+				continue;
+			buffer_printf(p->out, "\t%s = ", plan->names[i]);
+			buffer_double(p->out, p->values[i]);
+			if(plan->units[i] && plan->units[i][0])
+				buffer_printf(p->out, " %s", plan->units[i]);
+			buffer_char(p->out, '\n');
 		}
 	}
+	/* threads share stdout, so only whole frames are written */
+	if(p->out->used > BUFFER_SIZE / 2 && buffer_flush(p->out) < 0)
+		return -1;
+	return p->out->failed ? -1 : 0;
+}
+
+static int flush(printer_t *p)
+{
+	return buffer_flush(p->out) < 0 || fflush(stdout) < 0 ? -1 : 0;
+}
+
+static int printer_open(printer_t *p)
+{
+	size_t most = 1;
+	for (size_t j = 0; ctx && j < dbcc_plan_count(ctx); j++)
+		if(dbcc_plan_at(ctx, j)->signal_count > most)
+			most = dbcc_plan_at(ctx, j)->signal_count;
+	if(!(p->values = calloc(most, sizeof(*p->values))))
+		return -1;
+	p->out = buffer_new(stdout);
 	return 0;
 }
 
-int send_can_msg(struct can_frame *frame, int port)
+static int printer_close(printer_t *p)
 {
-	int r;
+	const int r = p->out ? buffer_delete(p->out) : 0;
+	free(p->values);
+	p->out = NULL;
+	p->values = NULL;
+	return r;
+}
+
+/* Waits for room in a full ring, so a merge that cannot keep up slows the
+ * reading down and the kernel drops frames, as it would without merging */
+static void ring_push(ring_t *q, const record_t *r)
+{
+	const unsigned long tail = q->tail;
+	while(tail - LOAD(q->head) == RING_SIZE)
+		sched_yield();
+	q->records[tail & (RING_SIZE - 1)] = *r;
+	STORE(q->tail, tail + 1);
+}
+
+static record_t *ring_front(ring_t *q)
+{
+	return LOAD(q->tail) == q->head ? NULL : &q->records[q->head & (RING_SIZE - 1)];
+}
+
+/* Frames are decoded where they lie, in the receive batch or the capture
+ * ring, unless they are merged and have to be copied to the merge ring */
+static int deliver(bus_t *b, const struct can_frame *f, uint64_t time)
+{
+	if(b->user_filter && !filter_match(filters.filters, filters.count, f->can_id))
+		return 0;
+	b->frames++;
+	if(b->ring) {
+		const record_t r = { .frame = *f, .time = time };
+		ring_push(b->ring, &r);
+	} else if(print_frame(&b->printer, b->name, f, time) < 0) {
+		b->error = EIO;
+		return -1;
+	}
+	if(busy_poll >= 0 && time) {
+		const uint64_t t = stamp(), latency = t > time ? t - time : 0;
+		unsigned bucket = latency ? 64 - __builtin_clzll(latency) : 0;
+		b->latency[bucket < LATENCIES ? bucket : LATENCIES - 1]++;
+		if(latency > b->latency_max)
+			b->latency_max = latency;
+	}
+	return 1;
+}
+
+/* Ask for the time each frame was received to come with it, from the
+ * hardware if the driver supports it and from the kernel when the frame
+ * arrives otherwise, instead of reading the clock afterwards, which adds
+ * the scheduling delay as jitter and costs a system call per batch */
+static stamp_e enable_stamps(int fd)
+{
+	const int on = 1; /* SO_TIMESTAMPING alone gives nothing on a socket pair */
+	if(setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) < 0)
+		return STAMP_USER;
+	const int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE
+		| SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE;
+	if(setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) == 0)
+		return STAMP_TIMESTAMPING;
+	return STAMP_KERNEL;
+}
+
+static uint64_t ns(const struct timespec *ts)
+{
+	return ts->tv_sec * UINT64_C(1000000000) + ts->tv_nsec;
+}
+
+/* SO_TIMESTAMPING gives the software time stamp first and the raw
+ * hardware one third, either may be zero. Hardware time stamps come from
+ * the clock of the controller, which is only comparable across buses if
+ * they share one. */
+static uint64_t kernel_stamp(struct msghdr *m)
+{
+	uint64_t software = 0, raw = 0, nanoseconds = 0;
+	for (struct cmsghdr *c = CMSG_FIRSTHDR(m); c; c = CMSG_NXTHDR(m, c)) {
+		if(c->cmsg_level != SOL_SOCKET)
+			continue;
+		struct timespec ts[3];
+		if(c->cmsg_type == SCM_TIMESTAMPING && c->cmsg_len >= CMSG_LEN(sizeof(ts))) {
+			memcpy(ts, CMSG_DATA(c), sizeof(ts));
+			software = ns(&ts[0]);
+			raw = ns(&ts[2]);
+		} else if(c->cmsg_type == SCM_TIMESTAMPNS && c->cmsg_len >= CMSG_LEN(sizeof(ts[0]))) {
+			memcpy(ts, CMSG_DATA(c), sizeof(ts[0]));
+			nanoseconds = ns(&ts[0]);
+		}
+	}
+	if(hardware && raw)
+		return raw;
+	if(software)
+		return software;
+	return nanoseconds ? nanoseconds : raw ? raw : stamp();
+}
+
+/* Each 'recvmmsg' takes as many frames as are queued, up to the batch
+ * size, so a busy bus costs one system call per batch rather than a
+ * 'select' and a 'read' per frame. Returns the number of frames received,
+ * zero once the queue is drained and -1 at the end of the stream or on an
+ * error. */
+static int receive(bus_t *b)
+{
+	if(b->stamps >= STAMP_KERNEL) /* the kernel shrinks it to what it wrote */
+		for (unsigned i = 0; i < batch; i++)
+			b->msgs[i].msg_hdr.msg_controllen = CONTROL;
 	errno = 0;
-again:
-	r = write(port, frame, sizeof(struct can_frame));
-	if(r <= 0 || r != sizeof(struct can_frame))
-		switch(errno)  {
-			case EAGAIN: usleep(1);
-			case EINTR: goto again;
-			default:
-				return -errno;
+	const int n = recvmmsg(b->fd, b->msgs, batch, MSG_DONTWAIT, NULL);
+	b->syscalls++;
+	if(n < 0) {
+		if(errno == EAGAIN || errno == EINTR)
+			return 0;
+		b->error = errno;
+		return -1;
+	}
+	const uint64_t time = b->stamps == STAMP_USER ? stamp() : 0;
+	for (int i = 0; i < n; i++) {
+		if(b->msgs[i].msg_len == 0) /* the other end of a socket pair closed */
+			return -1;
+		if(b->msgs[i].msg_len != sizeof(struct can_frame))
+			continue;
+		const uint64_t t = b->stamps >= STAMP_KERNEL ? kernel_stamp(&b->msgs[i].msg_hdr) : time;
+		if(deliver(b, &b->frames_in[i], t) < 0)
+			return -1;
+	}
+	return n;
+}
+
+/* Hands the frames in every block the kernel has finished with to
+ * 'deliver' and the blocks back to the kernel, without a system call or a
+ * copy. The kernel time stamps every packet in the ring, with the hardware
+ * time if PACKET_TIMESTAMP asked for it and the driver has it. */
+static int walk(bus_t *b)
+{
+	capture_t *c = &b->capture;
+	for (int n = 0;; n++) {
+		struct tpacket_block_desc *block = (void *)(c->map + (size_t)c->block * CAPTURE_BLOCK);
+		if(!(LOAD(block->hdr.bh1.block_status) & TP_STATUS_USER))
+			return n;
+		const struct tpacket3_hdr *h = (void *)((uint8_t *)block + block->hdr.bh1.offset_to_first_pkt);
+		for (uint32_t i = 0; i < block->hdr.bh1.num_pkts; i++) {
+			const uint64_t t = b->stamps ? h->tp_sec * UINT64_C(1000000000) + h->tp_nsec : 0;
+			if(h->tp_snaplen == sizeof(struct can_frame)
+					&& deliver(b, (const struct can_frame *)((const uint8_t *)h + h->tp_mac), t) < 0)
+				return -1;
+			h = (const void *)((const uint8_t *)h + h->tp_next_offset);
+		}
+		STORE(block->hdr.bh1.block_status, TP_STATUS_KERNEL);
+		c->block = (c->block + 1) % CAPTURE_BLOCKS;
+	}
+}
+
+/* Busy polling never sleeps, it takes a core to itself to get frames
+ * without the wake up latency of epoll. The stop flag is checked between
+ * polls, as there is no system call for a signal to interrupt. */
+static void spin(bus_t *b)
+{
+	bool dirty = false;
+	while(!stopping) {
+		const int r = b->capture.map ? walk(b) : receive(b);
+		if(r < 0)
+			break;
+		dirty |= r > 0;
+		if(r > 0)
+			continue;
+		if(b->ring) {
+			STORE(b->ring->watermark, stamp() - MERGE_LAG * UINT64_C(1000000));
+		} else if(dirty) {
+			if(flush(&b->printer) < 0) {
+				b->error = EIO;
+				break;
+			}
+			dirty = false;
+		}
+	}
+}
+
+/* One worker per bus, pinned to its own core where there are enough, waits
+ * on the bus and the stop event with epoll and drains the bus when it wakes */
+static void *worker(void *arg)
+{
+	bus_t *b = arg;
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	CPU_SET(b->cpu, &cpus);
+	if((errno = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus)))
+		fprintf(stderr, "%s: could not pin to cpu %d: %s\n", b->name, b->cpu, strerror(errno));
+	if(priority) {
+		const struct sched_param param = { .sched_priority = priority };
+		if((errno = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param)))
+			fprintf(stderr, "%s: could not set SCHED_FIFO priority %d: %s\n", b->name, priority, strerror(errno));
+	}
+	int ep = -1;
+	if(busy_poll >= 0) {
+		spin(b);
+		goto done;
+	}
+
+	struct epoll_event ev = { .events = EPOLLIN, .data.fd = b->fd };
+	ep = epoll_create1(0);
+	if(ep < 0 || epoll_ctl(ep, EPOLL_CTL_ADD, b->fd, &ev) < 0) {
+		b->error = errno;
+		goto done;
+	}
+	ev.data.fd = stop_fd;
+	if(epoll_ctl(ep, EPOLL_CTL_ADD, stop_fd, &ev) < 0) {
+		b->error = errno;
+		goto done;
+	}
+
+	for (;;) {
+		struct epoll_event events[2];
+		/* frames are taken to reach the socket within MERGE_LAG of being
+		 * stamped, so nothing received after this is stamped earlier */
+		if(b->ring)
+			STORE(b->ring->watermark, stamp() - MERGE_LAG * UINT64_C(1000000));
+		const int n = epoll_wait(ep, events, 2, b->ring ? MERGE_LAG : -1);
+		b->syscalls++;
+		if(n < 0 && errno != EINTR) {
+			b->error = errno;
+			break;
+		}
+		bool quit = false, readable = false;
+		for (int i = 0; i < n; i++) {
+			quit |= events[i].data.fd == stop_fd;
+			readable |= events[i].data.fd == b->fd;
+		}
+		if(quit)
+			break;
+		if(!readable)
+			continue;
+		int r = 0;
+		if(b->capture.map)
+			r = walk(b);
+		else
+			while((r = receive(b)) == (int)batch)
+				;
+		if(r < 0)
+			break;
+		if(!b->ring && flush(&b->printer) < 0) {
+			b->error = EIO;
+			break;
+		}
+	}
+done:
+	if(ep >= 0)
+		close(ep);
+	if(b->ring)
+		STORE(b->ring->done, true);
+	return NULL;
+}
+
+/* Writes out the frames of all the buses in time order, the earliest frame
+ * at the front of a ring goes out once no other bus can produce an earlier
+ * one, going by the fronts of their rings or their watermarks if empty */
+static int merge(bus_t *buses, size_t count, unsigned long *failures)
+{
+	printer_t p = { .out = NULL };
+	if(printer_open(&p) < 0)
+		return -1;
+	int r = 0;
+	for (;;) {
+		ring_t *first = NULL;
+		const char *name = NULL;
+		uint64_t bound = UINT64_MAX;
+		bool live = false;
+		for (size_t i = 0; i < count; i++) {
+			ring_t *q = buses[i].ring;
+			const bool done = LOAD(q->done);
+			const uint64_t watermark = LOAD(q->watermark); /* before the tail */
+			const record_t *front = ring_front(q);
+			if(!front) {
+				if(!done && watermark < bound)
+					bound = watermark;
+				live |= !done;
+				continue;
+			}
+			live = true;
+			if(!first || front->time < ring_front(first)->time) {
+				first = q;
+				name = buses[i].name;
+			}
+		}
+		if(!live)
+			break;
+		if(!first || ring_front(first)->time > bound) {
+			if(flush(&p) < 0) {
+				r = -1;
+				break;
+			}
+			struct timespec ts = { 0, 100000 };
+			nanosleep(&ts, NULL);
+			continue;
+		}
+		const record_t *front = ring_front(first);
+		if(print_frame(&p, name, &front->frame, front->time) < 0) {
+			r = -1;
+			break;
+		}
+		STORE(first->head, first->head + 1);
+	}
+	*failures = p.failures;
+	if(printer_close(&p) < 0 || fflush(stdout) < 0)
+		r = -1;
+	return r;
+}
+
+static uint64_t monotonic(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
+/* Sleep until shortly before 'due' then spin until it, sleeping all the
+ * way would leave the frames at the mercy of the timer slack and the
+ * scheduler, tens of microseconds late, spinning all the way would take a
+ * core for nothing */
+static void tx_wait(uint64_t due)
+{
+	if(due > spin_for) {
+		const uint64_t wake = due - spin_for;
+		const struct timespec ts = { .tv_sec = wake / 1000000000u, .tv_nsec = wake % 1000000000u };
+		while(monotonic() < wake && clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR && !stopping)
+			;
+	}
+	while(monotonic() < due && !stopping)
+		;
+}
+
+/* Nothing of a cycle goes out before it is due, even if it is more than
+ * the queue holds and has to be flushed part way through */
+static void tx_start(tx_t *tx)
+{
+	if(!period || tx->started)
+		return;
+	tx->started = true;
+	tx_wait(tx->due);
+	const uint64_t t = monotonic(), late = t > tx->due ? t - tx->due : 0;
+	tx->late += late;
+	tx->flushes++;
+	if(late > tx->late_max)
+		tx->late_max = late;
+	tx->due += period;
+}
+
+/* Send everything queued, when the socket buffer is full wait for it to
+ * be writable and when the device queue is full (ENOBUFS, for which the
+ * socket reads as writable) back off for a while, either wait ends early
+ * when the program is stopped. Returns -1 if the program was stopped or
+ * on an error. */
+static int tx_flush(tx_t *tx)
+{
+	tx_start(tx);
+	for (unsigned done = 0; done < tx->count;) {
+		errno = 0;
+		const int n = sendmmsg(tx->fd, tx->msgs + done, tx->count - done, MSG_DONTWAIT);
+		tx->syscalls++;
+		if(n > 0) {
+			done += n;
+			tx->sent += n;
+			continue;
+		}
+		const int e = errno;
+		if(e == EINTR)
+			continue;
+		if(e != EAGAIN && e != ENOBUFS)
+			return -1;
+		struct pollfd fds[2] = { { .fd = stop_fd, .events = POLLIN }, { .fd = tx->fd, .events = POLLOUT } };
+		tx->backoffs++;
+		if(poll(fds, e == EAGAIN ? 2 : 1, e == ENOBUFS ? TX_BACKOFF : -1) < 0 && errno != EINTR)
+			return -1;
+		if(fds[0].revents)
+			return -1;
+	}
+	tx->count = 0;
+	return 0;
+}
+
+static int tx_queue(tx_t *tx, const struct can_frame *f)
+{
+	if(tx->count == BATCH_MAX && tx_flush(tx) < 0)
+		return -1;
+	tx->queue[tx->count++] = *f;
+	return 0;
+}
+
+/* Queue a frame for every message in the DBC file, with random payloads,
+ * or 'batch' frames for random standard IDs without one */
+static int tx_cycle(tx_t *tx, unsigned long *left)
+{
+	const size_t plans = ctx ? dbcc_plan_count(ctx) : batch;
+	for (size_t i = 0; i < plans && (!tx->frames || *left); i++, (*left)--) {
+		struct can_frame frame;
+		memset(&frame, 0, sizeof(frame));
+		uint64_t x = tx->seed;
+		x ^= x << 13, x ^= x >> 7, x ^= x << 17;
+		tx->seed = x;
+		if(ctx) {
+			const decode_plan_t *plan = dbcc_plan_at(ctx, i);
+			frame.can_id = plan->id;
+			frame.can_dlc = plan->dlc > CAN_MAX_DLEN ? CAN_MAX_DLEN : plan->dlc;
+		} else {
+			frame.can_id = x % (CAN_SFF_MASK + 1);
+			frame.can_dlc = CAN_MAX_DLEN;
 		}
+		memcpy(frame.data, &x, sizeof(frame.data));
+		if(tx_queue(tx, &frame) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+/* Sends every message each 'period', or as fast as possible without one,
+ * until 'frames' have been sent or the program is stopped. With '-l' it
+ * is the stand in for a CAN interface when there is none (or no CAN
+ * support in the kernel), writing into a socket pair. */
+static void *sender(void *arg)
+{
+	tx_t *tx = arg;
+	unsigned long left = tx->frames;
+	tx->due = monotonic();
+	while(!stopping && (!tx->frames || left)) {
+		tx->started = false;
+		if(tx_cycle(tx, &left) < 0)
+			break;
+		if(tx_flush(tx) < 0)
+			break;
+	}
+	close(tx->fd);
+	return NULL;
+}
+
+/* Capture with AF_PACKET into a TPACKET_V3 ring mapped into this process
+ * instead of reading a CAN_RAW socket, for very high frame rates */
+static int open_capture(bus_t *b)
+{
+	capture_t *c = &b->capture;
+	const int version = TPACKET_V3;
+	struct tpacket_req3 req = {
+		.tp_block_size = CAPTURE_BLOCK,
+		.tp_block_nr = CAPTURE_BLOCKS,
+		.tp_frame_size = CAPTURE_FRAME,
+		.tp_frame_nr = CAPTURE_BLOCK / CAPTURE_FRAME * CAPTURE_BLOCKS,
+		.tp_retire_blk_tov = CAPTURE_RETIRE,
+	};
+	struct sockaddr_ll addr = {
+		.sll_family = AF_PACKET,
+		.sll_protocol = htons(ETH_P_CAN),
+		.sll_ifindex = if_nametoindex(b->name),
+	};
+	if(!addr.sll_ifindex)
+		return -1;
+	if((b->fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_CAN))) < 0)
+		return -1;
+	if(setsockopt(b->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0)
+		return -1;
+	if(setsockopt(b->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0)
+		return -1;
+	if(hardware) { /* best effort, software time stamps otherwise */
+		const int flags = SOF_TIMESTAMPING_RAW_HARDWARE;
+		(void)setsockopt(b->fd, SOL_PACKET, PACKET_TIMESTAMP, &flags, sizeof(flags));
+	}
+	c->size = (size_t)CAPTURE_BLOCK * CAPTURE_BLOCKS;
+	c->map = mmap(NULL, c->size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, b->fd, 0);
+	if(c->map == MAP_FAILED) {
+		c->map = NULL;
+		return -1;
+	}
+	if(bind(b->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+		return -1;
+	return b->fd;
+}
+
+static int open_bus(bus_t *b, unsigned long frames, bool capture)
+{
+	b->tx.fd = -1;
+	b->tx.frames = frames;
+	for (unsigned i = 0; i < BATCH_MAX; i++) {
+		b->tx.iov[i].iov_base = &b->tx.queue[i];
+		b->tx.iov[i].iov_len = sizeof(b->tx.queue[i]);
+		b->tx.msgs[i].msg_hdr.msg_iov = &b->tx.iov[i];
+		b->tx.msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	for (unsigned i = 0; i < BATCH_MAX; i++) {
+		b->iov[i].iov_base = &b->frames_in[i];
+		b->iov[i].iov_len = sizeof(b->frames_in[i]);
+		b->msgs[i].msg_hdr.msg_iov = &b->iov[i];
+		b->msgs[i].msg_hdr.msg_iovlen = 1;
+		b->msgs[i].msg_hdr.msg_control = b->control[i].data;
+	}
+	if(!frames) {
+		if(period && (b->tx.fd = open_can_device(b->name)) < 0)
+			return -1; /* and it has no filters, so nothing is queued on it */
+		if(period && setsockopt(b->tx.fd, SOL_CAN_RAW, CAN_RAW_FILTER, NULL, 0) < 0)
+			return -1;
+		return capture ? open_capture(b) : (b->fd = open_can_device(b->name));
+	}
+	int pair[2];
+	if(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, pair) < 0)
+		return -1;
+	b->fd = pair[0];
+	b->tx.fd = pair[1];
+	return b->fd;
+}
+
+static int install_filters(int fd)
+{
+	struct can_filter *k = calloc(filters.count, sizeof(*k));
+	if(!k)
+		return -1;
+	for (size_t i = 0; i < filters.count; i++) {
+		k[i].can_id = filters.filters[i].id;
+		k[i].can_mask = filters.filters[i].mask;
+	}
+	const int r = setsockopt(fd, SOL_CAN_RAW, CAN_RAW_FILTER, k, filters.count * sizeof(*k));
+	free(k);
 	return r;
 }
 
+/* Classic BPF runs on any socket, so unlike the filters the program is
+ * attached to the socket pairs and the capture ring too */
+static int compile_program(const dbc_t *model, const char *manifest)
+{
+	filter_insn_t *insns = NULL;
+	size_t length = 0;
+	if(filter_bpf(model, manifest, &insns, &length) < 0)
+		return -1;
+	if(!length)
+		return 0;
+	if(!(program.filter = calloc(length, sizeof(*program.filter)))) {
+		free(insns);
+		return -1;
+	}
+	for (size_t i = 0; i < length; i++) {
+		program.filter[i].code = insns[i].code;
+		program.filter[i].jt = insns[i].jt;
+		program.filter[i].jf = insns[i].jf;
+		program.filter[i].k = insns[i].id ? htonl(insns[i].k) : insns[i].k;
+	}
+	program.len = length;
+	free(insns);
+	return 0;
+}
+
+static void print_latency(const bus_t *b)
+{
+	unsigned long total = 0, sum = 0;
+	for (unsigned i = 0; i < LATENCIES; i++)
+		total += b->latency[i];
+	if(!total)
+		return;
+	fprintf(stderr, "%s: time stamp to decoded latency, %lu frames, max %.3f us\n", b->name, total, b->latency_max / 1e3);
+	fprintf(stderr, "  %12s %12s %10s %7s %7s\n", "from/us", "to/us", "frames", "%", "cum. %");
+	for (unsigned i = 0; i < LATENCIES; i++) {
+		if(!b->latency[i])
+			continue;
+		sum += b->latency[i];
+		char to[32] = "-";
+		if(i + 1 < LATENCIES)
+			snprintf(to, sizeof(to), "%.3f", ldexp(1, i) / 1e3);
+		fprintf(stderr, "  %12.3f %12s %10lu %7.2f %7.2f\n", i ? ldexp(1, i - 1) / 1e3 : 0, to,
+			b->latency[i], 100.0 * b->latency[i] / total, 100.0 * sum / total);
+	}
+}
+
 static void usage(const char *arg0)
 {
-	fprintf(stderr, "%s: [-] [-h] [-d device]\n", arg0);
+	fprintf(stderr, "%s: [-] [-h] [-s] [-m] [-t] [-H] [-r] [--busy-poll[=us]] [-F priority] [-d device]... [-f file.dbc] [-N node] [-M manifest] [-R percent] [-b batch] [-c cpu] [-l frames] [-T us] [-W us]\n", arg0);
 }
 
 static void help(void)
 {
-	static const char *msg = "";
+	static const char *msg = "\
+Read frames from SocketCAN interfaces and print them, decoded with\n\
+a DBC file (or an image made by 'dbcc -c') if one is given.\n\n\
+\t-d device  interface to read from (default can0), up to 16 may be\n\
+\t           given, each is read on its own thread\n\
+\t-m         merge the frames of all the interfaces in time order\n\
+\t-t         print the time each frame was received, from the kernel\n\
+\t-H         as -t, but use hardware time stamps where there are any\n\
+\t-r         capture from a ring buffer shared with the kernel (PACKET_MMAP)\n\
+\t           instead of receiving frames with system calls\n\
+\t--busy-poll[=us]\n\
+\t           spin on the interfaces instead of sleeping until frames arrive,\n\
+\t           with SO_BUSY_POLL set to 'us' if given, and print a histogram\n\
+\t           of the latency from the kernel time stamp to decoding on exit\n\
+\t-F prio    run the threads with SCHED_FIFO at this priority (1-99)\n\
+\t-f file    decode frames with this DBC file or image\n\
+\t-N node    only receive the messages this node in the DBC file receives\n\
+\t           signals from, with filters set in the kernel (CAN_RAW_FILTER)\n\
+\t-M file    only receive the messages named in this manifest (see dbcc -M),\n\
+\t           and of those only the frames its predicates on the payload\n\
+\t           accept, checked by a BPF program in the kernel (SO_ATTACH_FILTER)\n\
+\t-R n       let the filters pass up to 'n' percent of messages from the\n\
+\t           DBC file that are not needed, to use fewer of them (default 0)\n\
+\t-b batch   frames received per system call, at most 1024 (default 64)\n\
+\t-c cpu     pin the threads to consecutive cores from this one (default 0)\n\
+\t-l frames  read this many random frames from a socket pair for each\n\
+\t           interface instead of the interface itself, then exit\n\
+\t-T us      send every message in the DBC file (or 'batch' random ones)\n\
+\t           every 'us' microseconds on each interface, with random data\n\
+\t-W us      sleep until this long before frames are due to be sent, then\n\
+\t           spin (default 50), more for machines with a lot of timer jitter\n\
+\t-s         print frames/s and system calls per frame on exit\n";
 	fputs(msg, stderr);
 }
 
+static int number(const char *arg, unsigned long min, unsigned long max, unsigned long *v)
+{
+	char *end = NULL;
+	*v = strtoul(arg, &end, 0);
+	return !*arg || *end || *v < min || *v > max ? -1 : 0;
+}
 
 int main(int argc, char **argv)
 {
-	char *port = "can0";
+	static bus_t buses[BUSES_MAX];
+	size_t count = 0;
+	const char *dbc = NULL, *node = NULL, *manifest = NULL;
+	unsigned long frames = 0, cpu = 0, failures = 0, value = 0, percent = 0;
+	bool stats = false, merged = false, times = false, capture = false;
 	int i;
-	int fd = 0;
 	for(i = 1; i < argc && argv[i][0] == '-'; i++)
 		switch(argv[i][1]) {
 		case '\0': /* stop argument processing */
-			goto done; 
+			goto done;
 		case 'd':
+			if(i >= argc - 1 || count == BUSES_MAX)
+				goto fail;
+			buses[count++].name = argv[++i];
+			break;
+		case 'f':
 			if(i >= argc - 1)
 				goto fail;
-			port = argv[++i];
+			dbc = argv[++i];
+			break;
+		case 'N':
+			if(i >= argc - 1)
+				goto fail;
+			node = argv[++i];
+			break;
+		case 'M':
+			if(i >= argc - 1)
+				goto fail;
+			manifest = argv[++i];
+			break;
+		case 'R':
+			if(i >= argc - 1 || number(argv[++i], 0, 100, &percent) < 0)
+				goto fail;
+			break;
+		case 'b':
+			if(i >= argc - 1 || number(argv[++i], 1, BATCH_MAX, &batch) < 0)
+				goto fail;
+			break;
+		case 'c':
+			if(i >= argc - 1 || number(argv[++i], 0, CPU_SETSIZE - 1, &cpu) < 0)
+				goto fail;
+			break;
+		case 'T':
+			if(i >= argc - 1 || number(argv[++i], 1, ULONG_MAX / 1000, &value) < 0)
+				goto fail;
+			period = value * 1000;
+			break;
+		case 'W':
+			if(i >= argc - 1 || number(argv[++i], 0, ULONG_MAX / 1000, &value) < 0)
+				goto fail;
+			spin_for = value * 1000;
+			break;
+		case 'l':
+			if(i >= argc - 1 || number(argv[++i], 1, ULONG_MAX, &frames) < 0)
+				goto fail;
+			break;
+		case 'm':
+			merged = true;
+			break;
+		case 't':
+			times = true;
+			break;
+		case 'r':
+			capture = true;
+			break;
+		case 'F':
+			if(i >= argc - 1 || number(argv[++i], 1, 99, &value) < 0)
+				goto fail;
+			priority = value;
+			break;
+		case '-':
+			if(!strcmp(argv[i], "--busy-poll")) {
+				busy_poll = 0;
+			} else if(!strncmp(argv[i], "--busy-poll=", 12) && number(argv[i] + 12, 0, INT_MAX, &value) == 0) {
+				busy_poll = value;
+			} else {
+				usage(argv[0]);
+				fprintf(stderr, "unknown/invalid command line option '%s'\n", argv[i]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'H':
+			hardware = times = true;
+			break;
+		case 's':
+			stats = true;
 			break;
 		case 'h':
 			usage(argv[0]);
@@ -120,21 +959,156 @@ int main(int argc, char **argv)
 		default:
 		fail:
 			usage(argv[0]);
-			fprintf(stderr, "unknown/invalid command line option '%c'", argv[i][1]);
+			fprintf(stderr, "unknown/invalid command line option '%c'\n", argv[i][1]);
 			return EXIT_FAILURE;
 			break;
 		}
 done:
-	fd = open_can_device(port);
-	if(fd < 0) {
-		perror(port);
+	if(!count)
+		buses[count++].name = "can0";
+	named = count > 1;
+	if((node || manifest) && (!dbc || (node && manifest))) {
+		fprintf(stderr, "-N or -M needs a DBC file (-f), and not both\n");
 		return EXIT_FAILURE;
 	}
-	errno = 0;
-	if(read_can_loop(fd) < 0) {
-		perror(port);
+	if(dbc) {
+		dbc_t *model = dbcc_read(dbc);
+		bool *wanted = NULL;
+		if(!model || !(ctx = dbcc_new(model))) {
+			fprintf(stderr, "%s: could not load\n", dbc);
+			return EXIT_FAILURE;
+		}
+		if(node && !(wanted = filter_node(model, node))) {
+			fprintf(stderr, "%s: node '%s' receives nothing\n", dbc, node);
+			return EXIT_FAILURE;
+		}
+		if(manifest && !(wanted = filter_manifest(model, manifest)))
+			return EXIT_FAILURE;
+		if(wanted && filter_compute(model, wanted, percent / 100.0, &filters) < 0)
+			return EXIT_FAILURE;
+		if(manifest && compile_program(model, manifest) < 0)
+			return EXIT_FAILURE;
+		if(wanted && stats)
+			fprintf(stderr, "%s: %zu messages in %zu filters, passing %zu other messages\n",
+				node ? node : manifest, filters.wanted, filters.count, filters.unwanted);
+		if(program.len && stats)
+			fprintf(stderr, "%s: predicates in %u BPF instructions\n", manifest, (unsigned)program.len);
+		free(wanted);
+		dbc_delete(model);
+	}
+	if((stop_fd = eventfd(0, EFD_NONBLOCK)) < 0) {
+		perror("eventfd");
 		return EXIT_FAILURE;
 	}
-	close(fd);
-	return EXIT_SUCCESS;
+
+	const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	for (size_t j = 0; j < count; j++) {
+		bus_t *b = &buses[j];
+		b->cpu = (cpu + j) % (cpus > 0 ? cpus : 1);
+		b->tx.seed = 88172645463325252ull + j;
+		if(capture && frames) {
+			fprintf(stderr, "%s: -r needs an interface, not a socket pair (-l)\n", b->name);
+			return EXIT_FAILURE;
+		}
+		if(open_bus(b, frames, capture) < 0) {
+			perror(b->name);
+			return EXIT_FAILURE;
+		}
+		if(filters.count && (frames || capture)) {
+			b->user_filter = true;
+		} else if(filters.count && install_filters(b->fd) < 0) {
+			fprintf(stderr, "%s: could not set CAN_RAW_FILTER: %s\n", b->name, strerror(errno));
+			return EXIT_FAILURE;
+		}
+		if(program.len && setsockopt(b->fd, SOL_SOCKET, SO_ATTACH_FILTER, &program, sizeof(program)) < 0) {
+			fprintf(stderr, "%s: could not set SO_ATTACH_FILTER: %s\n", b->name, strerror(errno));
+			return EXIT_FAILURE;
+		}
+		if(busy_poll > 0) {
+			const int us = busy_poll;
+			if(setsockopt(b->fd, SOL_SOCKET, SO_BUSY_POLL, &us, sizeof(us)) < 0)
+				fprintf(stderr, "%s: could not set SO_BUSY_POLL: %s\n", b->name, strerror(errno));
+		}
+		if(!(merged || times || busy_poll >= 0))
+			b->stamps = STAMP_NONE;
+		else
+			b->stamps = capture ? STAMP_KERNEL : enable_stamps(b->fd);
+		if(merged ? !(b->ring = calloc(1, sizeof(*b->ring))) : printer_open(&b->printer) < 0) {
+			perror(b->name);
+			return EXIT_FAILURE;
+		}
+	}
+
+	/* the workers leave the signals to this thread, which tells them to
+	 * stop through 'stop_fd' */
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = stop;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sigset_t block, old;
+	sigemptyset(&block);
+	sigaddset(&block, SIGINT);
+	sigaddset(&block, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &block, &old);
+
+	const double start = now();
+	for (size_t j = 0; j < count; j++) {
+		if((errno = pthread_create(&buses[j].thread, NULL, worker, &buses[j]))) {
+			perror("pthread_create");
+			return EXIT_FAILURE;
+		}
+		if(buses[j].tx.fd >= 0 && (errno = pthread_create(&buses[j].sender, NULL, sender, &buses[j].tx))) {
+			perror("pthread_create");
+			return EXIT_FAILURE;
+		}
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	int e = merged ? merge(buses, count, &failures) : 0;
+	for (size_t j = 0; j < count; j++)
+		pthread_join(buses[j].thread, NULL);
+	const double elapsed = now() - start;
+
+	unsigned long total = 0, syscalls = 0;
+	for (size_t j = 0; j < count; j++) {
+		bus_t *b = &buses[j];
+		if(b->tx.fd >= 0) {
+			pthread_join(b->sender, NULL);
+			if(stats)
+				fprintf(stderr, "%s: sent %lu frames, %.3f system calls/frame, %lu waits for the queue%s",
+					b->name, b->tx.sent, b->tx.sent ? (double)b->tx.syscalls / b->tx.sent : 0, b->tx.backoffs, period ? "" : "\n");
+			if(stats && period)
+				fprintf(stderr, ", late by %.3f us on average, %.3f us at most\n",
+					b->tx.flushes ? b->tx.late / 1e3 / b->tx.flushes : 0, b->tx.late_max / 1e3);
+		}
+		failures += b->printer.failures;
+		if(printer_close(&b->printer) < 0)
+			e = -1;
+		if(b->error) {
+			errno = b->error;
+			perror(b->name);
+			e = -1;
+		}
+		static const char *stamps[] = { "none", "user", "kernel", "kernel or hardware" };
+		if(stats && (named || b->stamps))
+			fprintf(stderr, "%s: %lu frames, %.3f system calls/frame, time stamps: %s\n",
+				b->name, b->frames, b->frames ? (double)b->syscalls / b->frames : 0, stamps[b->stamps]);
+		if(busy_poll >= 0)
+			print_latency(b);
+		total += b->frames;
+		syscalls += b->syscalls;
+		if(b->capture.map)
+			munmap(b->capture.map, b->capture.size);
+		close(b->fd);
+		free(b->ring);
+	}
+	if(stats)
+		fprintf(stderr, "%s: %lu frames in %.3f s, %.0f frames/s, %.3f system calls/frame, %lu not decoded\n",
+			named ? "total" : buses[0].name, total, elapsed, elapsed > 0 ? total / elapsed : 0,
+			total ? (double)syscalls / total : 0, failures);
+	close(stop_fd);
+	filter_set_free(&filters);
+	free(program.filter);
+	dbcc_delete(ctx);
+	return e < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
 }
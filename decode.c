@@ -0,0 +1,320 @@
+/**@note See 'decode.h'. The operations mirror 'signal2deserializer' and
+ * 'signal2scaling_decode' in '2c.c', which are what the generated code does
+ * with a message, and have to be kept in step with them. */
+#include "decode.h"
+#include "image.h"
+#include "jit.h"
+#include "parse.h"
+#include "util.h"
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+	uint32_t id;
+	uint32_t plan; /**< index of the plan plus one, zero if the slot is empty */
+} slot_t;
+
+struct dbcc_ctx {
+	decode_plan_t *plans;
+	size_t plan_count;
+	decode_op_t *ops;  /**< operations of all the plans */
+	slot_t *table;     /**< open addressing, linear probing */
+	unsigned shift;    /**< 32 - log2 of the table size */
+	jit_t *jit;        /**< native code for the plans, if any */
+};
+
+static inline uint32_t hash(uint32_t id, unsigned shift)
+{
+	return (id * 2654435769u) >> shift; /* Fibonacci hashing */
+}
+
+static inline uint64_t reverse_byte_order(uint64_t x)
+{
+	x = (x & 0x00000000FFFFFFFF) << 32 | (x & 0xFFFFFFFF00000000) >> 32;
+	x = (x & 0x0000FFFF0000FFFF) << 16 | (x & 0xFFFF0000FFFF0000) >> 16;
+	x = (x & 0x00FF00FF00FF00FF) << 8  | (x & 0xFF00FF00FF00FF00) >> 8;
+	return x;
+}
+
+/* the payload as the generated code expects it, byte zero is the least
+ * significant byte and missing bytes are zero */
+static inline uint64_t load(const uint8_t *p, unsigned dlc)
+{
+	if (dlc == 8)
+		return (uint64_t)p[0]       | (uint64_t)p[1] << 8
+			| (uint64_t)p[2] << 16 | (uint64_t)p[3] << 24
+			| (uint64_t)p[4] << 32 | (uint64_t)p[5] << 40
+			| (uint64_t)p[6] << 48 | (uint64_t)p[7] << 56;
+	uint64_t x = 0;
+	for (unsigned i = 0; i < dlc; i++)
+		x |= (uint64_t)p[i] << (8 * i);
+	return x;
+}
+
+static void signal2op(const signal_t *sig, const signal_t *multiplexor, uint32_t output, decode_op_t *op)
+{
+	assert(sig);
+	assert(op);
+	const bool motorola = sig->endianess == endianess_motorola_e;
+	const long length = sig->bit_length;
+	long start = sig->start_bit;
+	if (motorola)
+		start = (8 * (7 - (start / 8))) + (start % 8) - (length - 1);
+
+	memset(op, 0, sizeof(*op));
+	op->scaling   = sig->scaling;
+	op->offset    = sig->offset;
+	op->output    = output;
+	op->switchval = sig->switchval;
+	op->flags     = (motorola ? DECODE_MOTOROLA : 0) | (sig->is_multiplexed ? DECODE_MULTIPLEXED : 0);
+	op->type      = DECODE_INVALID;
+
+	if (length < 1 || length > 64 || start < 0 || start > 63) {
+		warning("signal '%s' does not fit in a message, it will not be decoded", sig->name);
+		return;
+	}
+	if (sig->is_floating && length != 32 && length != 64) {
+		warning("floating point signal '%s' has invalid length %ld, it will not be decoded", sig->name, length);
+		return;
+	}
+	if (sig->is_multiplexed && !multiplexor) /* the generated code skips these as well */
+		return;
+	op->shift = start;
+	op->mask  = length == 64 ? UINT64_MAX : (UINT64_C(1) << length) - 1;
+	if (sig->is_floating)
+		op->type = length == 32 ? DECODE_FLOAT : DECODE_DOUBLE;
+	else if (sig->is_signed)
+		op->type = DECODE_SIGNED, op->sign = UINT64_C(1) << (length - 1);
+	else
+		op->type = DECODE_UNSIGNED;
+}
+
+static void msg2plan(const can_msg_t *msg, decode_plan_t *plan, decode_op_t *ops)
+{
+	assert(msg);
+	assert(plan);
+	const signal_t *multiplexor = NULL;
+	for (size_t i = 0; i < msg->signal_count && !multiplexor; i++)
+		if (msg->sigs[i]->is_multiplexor)
+			multiplexor = msg->sigs[i];
+
+	plan->id           = msg->id;
+	plan->dlc          = msg->dlc;
+	plan->signal_count = msg->signal_count;
+	plan->op_count     = msg->signal_count;
+	plan->ops          = ops;
+	plan->multiplexed  = multiplexor != NULL;
+	plan->names        = allocate(sizeof(*plan->names) * (msg->signal_count + 1));
+	plan->units        = allocate(sizeof(*plan->units) * (msg->signal_count + 1));
+
+	size_t op = 0;
+	if (multiplexor) {
+		signal2op(multiplexor, multiplexor, 0, &ops[op++]);
+		ops[0].flags &= ~DECODE_MULTIPLEXED;
+	}
+	for (size_t i = 0; i < msg->signal_count; i++) {
+		const signal_t *sig = msg->sigs[i];
+		plan->names[i] = duplicate(sig->name);
+		plan->units[i] = duplicate(sig->units ? sig->units : "");
+		if (sig == multiplexor) {
+			ops[0].output = i;
+			continue;
+		}
+		signal2op(sig, multiplexor, i, &ops[op++]);
+	}
+	assert(op == plan->op_count);
+}
+
+static void insert(dbcc_ctx_t *ctx, size_t index)
+{
+	assert(ctx);
+	const decode_plan_t *plan = &ctx->plans[index];
+	if (plan->id > UINT32_MAX) {
+		warning("message '%lx' has an invalid ID, it will not be decoded", plan->id);
+		return;
+	}
+	const uint32_t mask = UINT32_MAX >> ctx->shift;
+	for (uint32_t h = hash(plan->id, ctx->shift);; h = (h + 1) & mask) {
+		slot_t *s = &ctx->table[h];
+		if (!s->plan) {
+			s->id = plan->id;
+			s->plan = index + 1;
+			return;
+		}
+		if (s->id == plan->id) {
+			warning("duplicate message ID %lx, only the first will be decoded", plan->id);
+			return;
+		}
+	}
+}
+
+dbcc_ctx_t *dbcc_new(const dbc_t *dbc)
+{
+	assert(dbc);
+	dbcc_ctx_t *ctx = allocate(sizeof(*ctx));
+	size_t op_count = 0;
+	for (size_t i = 0; i < dbc->message_count; i++)
+		op_count += dbc->messages[i]->signal_count;
+	ctx->plan_count = dbc->message_count;
+	ctx->plans = allocate(sizeof(*ctx->plans) * (dbc->message_count + 1));
+	ctx->ops = allocate(sizeof(*ctx->ops) * (op_count + 1));
+
+	unsigned bits = 1;
+	while ((1ul << bits) < 2 * dbc->message_count)
+		bits++;
+	ctx->shift = 32 - bits;
+	ctx->table = allocate(sizeof(*ctx->table) << bits);
+
+	decode_op_t *ops = ctx->ops;
+	for (size_t i = 0; i < dbc->message_count; i++) {
+		msg2plan(dbc->messages[i], &ctx->plans[i], ops);
+		ops += ctx->plans[i].op_count;
+		insert(ctx, i);
+	}
+	return ctx;
+}
+
+dbc_t *dbcc_read(const char *name)
+{
+	assert(name);
+	dbc_t *dbc = NULL;
+	if (image_is(name)) {
+		image_t img;
+		if (image_open(name, &img) < 0)
+			return NULL;
+		dbc = image2dbc(&img);
+		image_close(&img);
+	} else if (parse_dbc_file_parallel(name, 0, &dbc) < 0) {
+		return NULL;
+	}
+	return dbc;
+}
+
+dbcc_ctx_t *dbcc_load(const char *name)
+{
+	assert(name);
+	dbc_t *dbc = dbcc_read(name);
+	if (!dbc)
+		return NULL;
+	dbcc_ctx_t *ctx = dbcc_new(dbc);
+	dbc_delete(dbc);
+	return ctx;
+}
+
+int dbcc_jit(dbcc_ctx_t *ctx)
+{
+	assert(ctx);
+	if (!jit_available())
+		return -1;
+	if (!ctx->jit && !(ctx->jit = jit_new(ctx->plans, ctx->plan_count)))
+		return -1;
+	return jit_compiled(ctx->jit);
+}
+
+void dbcc_delete(dbcc_ctx_t *ctx)
+{
+	if (!ctx)
+		return;
+	jit_delete(ctx->jit);
+	for (size_t i = 0; i < ctx->plan_count; i++) {
+		decode_plan_t *p = &ctx->plans[i];
+		for (size_t j = 0; j < p->signal_count; j++) {
+			free(p->names[j]);
+			free(p->units[j]);
+		}
+		free(p->names);
+		free(p->units);
+	}
+	free(ctx->plans);
+	free(ctx->ops);
+	free(ctx->table);
+	free(ctx);
+}
+
+size_t dbcc_plan_count(const dbcc_ctx_t *ctx)
+{
+	assert(ctx);
+	return ctx->plan_count;
+}
+
+const decode_plan_t *dbcc_plan_at(const dbcc_ctx_t *ctx, size_t index)
+{
+	assert(ctx);
+	return index < ctx->plan_count ? &ctx->plans[index] : NULL;
+}
+
+const decode_plan_t *dbcc_plan(const dbcc_ctx_t *ctx, unsigned long id)
+{
+	assert(ctx);
+	if (id > UINT32_MAX)
+		return NULL;
+	const uint32_t mask = UINT32_MAX >> ctx->shift;
+	for (uint32_t h = hash(id, ctx->shift);; h = (h + 1) & mask) {
+		const slot_t *s = &ctx->table[h];
+		if (!s->plan)
+			return NULL;
+		if (s->id == id)
+			return &ctx->plans[s->plan - 1];
+	}
+}
+
+int dbcc_decode_plan(const decode_plan_t *plan, const uint8_t *payload, unsigned dlc, double *out)
+{
+	assert(plan);
+	assert(payload || !dlc);
+	assert(out);
+	if (dlc < plan->dlc || dlc > 8)
+		return -1;
+	const uint64_t intel = load(payload, dlc);
+	if (plan->native)
+		return plan->native(intel, out);
+	const uint64_t words[2] = { intel, reverse_byte_order(intel) }; /* indexed by DECODE_MOTOROLA */
+	uint64_t selector = 0;
+	bool selected = !plan->multiplexed;
+	for (size_t i = 0; i < plan->op_count; i++) {
+		const decode_op_t *op = &plan->ops[i];
+		uint64_t x = (words[op->flags & DECODE_MOTOROLA] >> op->shift) & op->mask;
+		if (op->flags & DECODE_MULTIPLEXED) {
+			if (op->switchval != selector) {
+				out[op->output] = NAN;
+				continue;
+			}
+			selected = true;
+		}
+		double v = 0;
+		switch (op->type) {
+		case DECODE_UNSIGNED:
+			v = x;
+			break;
+		case DECODE_SIGNED:
+			x = (x ^ op->sign) - op->sign;
+			v = (int64_t)x;
+			break;
+		case DECODE_FLOAT: {
+			const uint32_t u = x;
+			float f = 0;
+			memcpy(&f, &u, sizeof(f));
+			v = f;
+			break;
+		}
+		case DECODE_DOUBLE:
+			memcpy(&v, &x, sizeof(v));
+			break;
+		default:
+			out[op->output] = NAN;
+			continue;
+		}
+		if (!i)
+			selector = x; /* only used if this is the multiplexor */
+		out[op->output] = v * op->scaling + op->offset;
+	}
+	return selected ? (int)plan->signal_count : -1;
+}
+
+int dbcc_decode(const dbcc_ctx_t *ctx, unsigned long id, const uint8_t *payload, unsigned dlc, double *out)
+{
+	const decode_plan_t *plan = dbcc_plan(ctx, id);
+	return plan ? dbcc_decode_plan(plan, payload, dlc, out) : -1;
+}
@@ -0,0 +1,99 @@
+#ifndef DECODE_H
+#define DECODE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "can.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* A run time decoder for CAN messages, for programs that cannot generate
+ * and compile C code every time a DBC file changes (see 'libdbcc.a' in the
+ * makefile). Each message is compiled into a flat decode plan when the
+ * context is made, one operation per signal, so decoding a message is a
+ * hash table lookup followed by a shift, mask, sign extension and scaling
+ * for each signal, with nothing looked up in the model.
+ *
+ * Signals are decoded exactly as the generated 'unpack_message' and
+ * 'decode_can_*' functions would decode them, but the minimum and maximum
+ * given for a signal are not checked and floating point signals are
+ * converted exactly, where the generated 'unpack754' gets zeros and
+ * subnormal numbers wrong. */
+
+typedef enum {
+	DECODE_UNSIGNED,
+	DECODE_SIGNED,
+	DECODE_FLOAT,    /**< IEEE-754 single precision */
+	DECODE_DOUBLE,   /**< IEEE-754 double precision */
+	DECODE_INVALID,  /**< the signal does not fit in a message, always NAN */
+} decode_type_e;
+
+enum {
+	DECODE_MOTOROLA    = 1u << 0, /**< shift 'motorola' word, intel otherwise */
+	DECODE_MULTIPLEXED = 1u << 1, /**< only present if 'switchval' matches */
+};
+
+typedef struct {
+	double scaling, offset;
+	uint64_t mask;      /**< applied after the shift */
+	uint64_t sign;      /**< top bit of a signed value, zero otherwise */
+	uint32_t switchval; /**< multiplexor value selecting this signal */
+	uint16_t output;    /**< index into the output array */
+	uint8_t shift;
+	uint8_t type;       /**< decode_type_e */
+	uint8_t flags;      /**< DECODE_* */
+} decode_op_t;
+
+/* a plan compiled to machine code (see 'jit.h'), it is given the payload
+ * as loaded by 'dbcc_decode_plan' and returns what it would */
+typedef int (*decode_native_t)(uint64_t payload, double *out);
+
+typedef struct {
+	unsigned long id;
+	unsigned dlc;           /**< shortest payload accepted */
+	size_t signal_count;    /**< size of the output array */
+	size_t op_count;
+	const decode_op_t *ops; /**< the multiplexor, if any, comes first */
+	bool multiplexed;       /**< first operation is a multiplexor */
+	char **names;           /**< signal names, by output index */
+	char **units;           /**< signal units, by output index */
+	decode_native_t native; /**< used instead of 'ops' if not NULL */
+} decode_plan_t;
+
+typedef struct dbcc_ctx dbcc_ctx_t;
+
+/* 'dbcc_new' compiles every message in 'dbc', which is not referred to
+ * afterwards, 'dbcc_load' parses a DBC file or an image (see 'image.h')
+ * and compiles that. Both return NULL on failure. 'dbcc_read' only parses,
+ * for programs that need the model as well, it is freed with 'dbc_delete'. */
+dbcc_ctx_t *dbcc_new(const dbc_t *dbc);
+dbcc_ctx_t *dbcc_load(const char *name);
+dbc_t *dbcc_read(const char *name);
+void dbcc_delete(dbcc_ctx_t *ctx);
+
+/* Compile the plans to machine code, which is used for decoding from then
+ * on. Returns the number of plans compiled, or -1 if there is no JIT for
+ * this machine, in which case the plans are still interpreted. */
+int dbcc_jit(dbcc_ctx_t *ctx);
+
+size_t dbcc_plan_count(const dbcc_ctx_t *ctx);
+const decode_plan_t *dbcc_plan_at(const dbcc_ctx_t *ctx, size_t index); /**< in file order */
+const decode_plan_t *dbcc_plan(const dbcc_ctx_t *ctx, unsigned long id); /**< NULL if unknown */
+
+/* Decode the first 'dlc' bytes of 'payload' (at most eight) into 'out',
+ * which must have room for the 'signal_count' of the message's plan. Values
+ * are in the order of the signals in the DBC file, multiplexed signals that
+ * are not selected are set to NAN. Returns the number of values written, or
+ * -1 if the ID is unknown, the payload is shorter than the message or
+ * longer than eight bytes, or the multiplexor selects no signals. */
+int dbcc_decode(const dbcc_ctx_t *ctx, unsigned long id, const uint8_t *payload, unsigned dlc, double *out);
+int dbcc_decode_plan(const decode_plan_t *plan, const uint8_t *payload, unsigned dlc, double *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
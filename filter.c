@@ -0,0 +1,638 @@
+/**@note See 'filter.h'. */
+#include "filter.h"
+#include "util.h"
+#include <assert.h>
+#include <ctype.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STANDARD_MASK (0x7FFul)
+#define EXTENDED_MASK (0x1FFFFFFFul)
+#define NO_RECEIVER   "Vector__XXX" /* written by tools for a signal nobody receives */
+#define NO_MERGE      (LONG_MAX)
+#define PREDICATE_VALUES (64u) /* keeps the jumps of a BPF block in range */
+#define TOKEN_MAX     (256u)
+#define CAN_DATA      (8u)     /* offset of the payload in a 'struct can_frame' */
+#define CAN_DLC       (4u)
+#define ACCEPT        (0xFFFFFFFFu) /* return value keeping the whole frame */
+#define FRAME_FLAGS   (0x60000000ul) /* CAN_RTR_FLAG | CAN_ERR_FLAG, no signals */
+
+typedef enum {
+	PREDICATE_NONE,
+	PREDICATE_IN,
+	PREDICATE_NOT,
+} predicate_e;
+
+typedef struct {
+	filter_t f;
+	size_t unwanted; /* passed by this filter, others may pass some of them too */
+} span_t;
+
+static int compare_ids(const void *a, const void *b)
+{
+	const uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+	return (x > y) - (x < y);
+}
+
+static int compare_names(const void *a, const void *b)
+{
+	return strcmp(*(const char* const*)a, *(const char* const*)b);
+}
+
+static size_t unique(uint32_t *ids, size_t count)
+{
+	size_t n = 0;
+	for (size_t i = 0; i < count; i++)
+		if (!n || ids[n - 1] != ids[i])
+			ids[n++] = ids[i];
+	return n;
+}
+
+static size_t lower_bound(const uint32_t *ids, size_t count, uint32_t id)
+{
+	size_t lo = 0, hi = count;
+	while (lo < hi) {
+		const size_t mid = lo + (hi - lo) / 2;
+		if (ids[mid] < id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* The lowest and highest IDs a filter can pass bound the search, which is
+ * short for the filters made by merging neighbours */
+static size_t passed(const uint32_t *ids, size_t count, const filter_t *f)
+{
+	const uint32_t lo = f->id & f->mask, hi = f->id | ~f->mask;
+	size_t n = 0;
+	for (size_t i = lower_bound(ids, count, lo); i < count && ids[i] <= hi; i++)
+		n += ((ids[i] ^ f->id) & f->mask) == 0;
+	return n;
+}
+
+static bool subsumes(const filter_t *outer, const filter_t *inner)
+{
+	return (inner->mask & outer->mask) == outer->mask && ((inner->id ^ outer->id) & outer->mask) == 0;
+}
+
+static unsigned free_bits(uint32_t mask)
+{
+	const uint32_t m = mask & FILTER_EXTENDED ? ~mask & EXTENDED_MASK : 0;
+	unsigned n = 0;
+	for (uint32_t b = m; b; b &= b - 1)
+		n++;
+	return n;
+}
+
+/* Standard and extended filters are never merged, that would clear the
+ * top bit of the mask */
+static bool merge(const span_t *a, const span_t *b, const uint32_t *other, size_t count, span_t *m)
+{
+	m->f.mask = a->f.mask & b->f.mask & ~(a->f.id ^ b->f.id);
+	m->f.id = a->f.id & m->f.mask;
+	if (!(m->f.mask & FILTER_EXTENDED))
+		return false;
+	m->unwanted = passed(other, count, &m->f);
+	return true;
+}
+
+/* Cheapest first is fewest unwanted messages added, then the narrowest mask */
+static long cost(const span_t *a, const span_t *b, const uint32_t *other, size_t count)
+{
+	span_t m;
+	if (!merge(a, b, other, count, &m))
+		return NO_MERGE;
+	const long added = (long)m.unwanted - (long)a->unwanted - (long)b->unwanted;
+	return added * 64 + free_bits(m.f.mask);
+}
+
+static void remove_span(span_t *s, long *costs, size_t *n, size_t at)
+{
+	assert(at < *n);
+	memmove(&s[at], &s[at + 1], sizeof(*s) * (*n - at - 1));
+	if (at + 1 < *n)
+		memmove(&costs[at], &costs[at + 1], sizeof(*costs) * (*n - at - 2));
+	(*n)--;
+}
+
+/* Put a merged filter at 'at', in place of the pair there, and drop any
+ * neighbours it now covers. Returns the unwanted messages no longer
+ * counted twice. */
+static size_t replace(span_t *s, long *costs, size_t *n, size_t *at, const span_t *m)
+{
+	size_t dropped = s[*at].unwanted + s[*at + 1].unwanted;
+	s[*at] = *m;
+	remove_span(s, costs, n, *at + 1);
+	while (*at + 1 < *n && subsumes(&m->f, &s[*at + 1].f)) {
+		dropped += s[*at + 1].unwanted;
+		remove_span(s, costs, n, *at + 1);
+	}
+	while (*at > 0 && subsumes(&m->f, &s[*at - 1].f)) {
+		dropped += s[*at - 1].unwanted;
+		remove_span(s, costs, n, *at - 1);
+		(*at)--;
+	}
+	return dropped;
+}
+
+int filter_compute(const dbc_t *dbc, const bool *wanted, double rate, filter_set_t *set)
+{
+	assert(dbc);
+	assert(wanted);
+	assert(set);
+	memset(set, 0, sizeof(*set));
+	uint32_t *want = allocate(sizeof(*want) * (dbc->message_count + 1));
+	uint32_t *other = allocate(sizeof(*other) * (dbc->message_count + 1));
+	size_t wants = 0, others = 0;
+	for (size_t i = 0; i < dbc->message_count; i++) {
+		const uint32_t id = dbc->messages[i]->id;
+		if (wanted[i])
+			want[wants++] = id;
+		else
+			other[others++] = id;
+	}
+	qsort(want, wants, sizeof(*want), compare_ids);
+	qsort(other, others, sizeof(*other), compare_ids);
+	wants = unique(want, wants);
+	size_t kept = 0; /* an ID may belong to a wanted and an unwanted message */
+	for (size_t i = 0; i < others; i++) {
+		const size_t at = lower_bound(want, wants, other[i]);
+		if ((at == wants || want[at] != other[i]) && (!kept || other[kept - 1] != other[i]))
+			other[kept++] = other[i];
+	}
+	others = kept;
+
+	span_t *s = allocate(sizeof(*s) * (wants + 1));
+	long *costs = allocate(sizeof(*costs) * (wants + 1));
+	size_t n = 0, total = 0;
+	/* every merge that lets nothing unwanted through is made first, in one
+	 * pass over the IDs in order */
+	for (size_t i = 0; i < wants; i++) {
+		const span_t exact = {
+			.f = { .id = want[i], .mask = FILTER_EXTENDED | (want[i] & FILTER_EXTENDED ? EXTENDED_MASK : STANDARD_MASK) },
+		};
+		span_t m;
+		s[n++] = exact;
+		if (n < 2 || !merge(&s[n - 2], &s[n - 1], other, others, &m) || m.unwanted)
+			continue;
+		size_t at = n - 2;
+		replace(s, costs, &n, &at, &m);
+	}
+
+	/* then the cheapest merges, while there is room for what they add */
+	const size_t limit = rate >= 1 ? SIZE_MAX : (size_t)(rate * wants / (1 - rate));
+	for (size_t i = 0; i + 1 < n; i++)
+		costs[i] = cost(&s[i], &s[i + 1], other, others);
+	while (n > 1) {
+		size_t best = n;
+		for (size_t i = 0; i + 1 < n; i++)
+			if (costs[i] != NO_MERGE && (best == n || costs[i] < costs[best]))
+				best = i;
+		if (best == n)
+			break;
+		span_t m;
+		merge(&s[best], &s[best + 1], other, others, &m);
+		const size_t before = s[best].unwanted + s[best + 1].unwanted;
+		if (n <= FILTER_MAX && m.unwanted > before && total + (m.unwanted - before) > limit)
+			break;
+		total += m.unwanted;
+		total -= replace(s, costs, &n, &best, &m);
+		if (best > 0)
+			costs[best - 1] = cost(&s[best - 1], &s[best], other, others);
+		if (best + 1 < n)
+			costs[best] = cost(&s[best], &s[best + 1], other, others);
+	}
+	if (n > FILTER_MAX)
+		warning("%zu receive filters are needed, more than the %u a socket can have", n, FILTER_MAX);
+
+	set->filters = allocate(sizeof(*set->filters) * (n + 1));
+	for (size_t i = 0; i < n; i++)
+		set->filters[i] = s[i].f;
+	set->count = n;
+	set->wanted = wants;
+	for (size_t i = 0; i < others; i++) /* counted once, however many pass it */
+		set->unwanted += filter_match(set->filters, n, other[i]);
+	free(costs);
+	free(s);
+	free(other);
+	free(want);
+	return 0;
+}
+
+void filter_set_free(filter_set_t *set)
+{
+	if (!set)
+		return;
+	free(set->filters);
+	memset(set, 0, sizeof(*set));
+}
+
+static bool receives(const signal_t *sig, const char *node)
+{
+	for (size_t i = 0; i < sig->ecu_count; i++)
+		if (!strcmp(sig->ecus[i], node))
+			return true;
+	return false;
+}
+
+const char **filter_nodes(const dbc_t *dbc, size_t *count)
+{
+	assert(dbc);
+	assert(count);
+	size_t n = 0, max = 8;
+	const char **nodes = allocate(sizeof(*nodes) * max);
+	for (size_t i = 0; i < dbc->message_count; i++) {
+		const can_msg_t *msg = dbc->messages[i];
+		for (size_t j = 0; j < msg->signal_count; j++) {
+			const signal_t *sig = msg->sigs[j];
+			for (size_t k = 0; k < sig->ecu_count; k++) {
+				if (!strcmp(sig->ecus[k], NO_RECEIVER))
+					continue;
+				if (n == max)
+					nodes = reallocator(nodes, sizeof(*nodes) * (max *= 2));
+				nodes[n++] = sig->ecus[k];
+			}
+		}
+	}
+	qsort(nodes, n, sizeof(*nodes), compare_names);
+	size_t u = 0;
+	for (size_t i = 0; i < n; i++)
+		if (!u || strcmp(nodes[u - 1], nodes[i]))
+			nodes[u++] = nodes[i];
+	*count = u;
+	return nodes;
+}
+
+bool *filter_node(const dbc_t *dbc, const char *node)
+{
+	assert(dbc);
+	assert(node);
+	bool *wanted = allocate(sizeof(*wanted) * (dbc->message_count + 1)), any = false;
+	for (size_t i = 0; i < dbc->message_count; i++) {
+		const can_msg_t *msg = dbc->messages[i];
+		for (size_t j = 0; j < msg->signal_count && !wanted[i]; j++)
+			wanted[i] = receives(msg->sigs[j], node);
+		any |= wanted[i];
+	}
+	if (!any) {
+		free(wanted);
+		return NULL;
+	}
+	return wanted;
+}
+
+/* A line of a manifest, for one message: 'message [signal in {v, ...}]' or
+ * 'message [signal != v]', with raw values as they are in the frame */
+typedef struct {
+	size_t message;          /* index in the DBC file */
+	const signal_t *sig;     /* NULL if every frame is wanted */
+	predicate_e type;
+	size_t count;
+	uint64_t values[PREDICATE_VALUES];
+} entry_t;
+
+typedef struct {
+	entry_t *entries;
+	size_t count, max;
+	bool predicates;         /* any entry has one */
+} manifest_t;
+
+/* the next word, number or one of '{', '}', ',' and '!=', or NULL */
+static const char *token(const char **s, char t[TOKEN_MAX])
+{
+	const char *p = *s;
+	while (isspace((unsigned char)*p))
+		p++;
+	size_t n = 0;
+	if (*p == '!' && p[1] == '=')
+		n = 2;
+	else if (isalnum((unsigned char)*p) || *p == '_')
+		while (isalnum((unsigned char)p[n]) || p[n] == '_')
+			n++;
+	else if (*p)
+		n = 1;
+	if (!n || n >= TOKEN_MAX)
+		return NULL;
+	memcpy(t, p, n);
+	t[n] = '\0';
+	*s = p + n;
+	return t;
+}
+
+static bool number(const char *s, uint64_t *v)
+{
+	char *end = NULL;
+	*v = strtoull(s, &end, 0);
+	return isdigit((unsigned char)*s) && !*end;
+}
+
+static const signal_t *find_signal(const can_msg_t *msg, const char *name)
+{
+	for (size_t i = 0; i < msg->signal_count; i++)
+		if (!strcmp(msg->sigs[i]->name, name))
+			return msg->sigs[i];
+	return NULL;
+}
+
+static int predicate(entry_t *e, const char *rest, uint64_t mask)
+{
+	char t[TOKEN_MAX];
+	if (!token(&rest, t))
+		return -1;
+	if (!strcmp(t, "!=")) {
+		e->type = PREDICATE_NOT;
+		if (!token(&rest, t) || !number(t, &e->values[e->count++]))
+			return -1;
+	} else if (!strcmp(t, "in")) {
+		e->type = PREDICATE_IN;
+		if (!token(&rest, t) || strcmp(t, "{"))
+			return -1;
+		do {
+			if (e->count == PREDICATE_VALUES || !token(&rest, t) || !number(t, &e->values[e->count++]))
+				return -1;
+		} while (token(&rest, t) && !strcmp(t, ","));
+		if (strcmp(t, "}"))
+			return -1;
+	} else {
+		return -1;
+	}
+	for (size_t i = 0; i < e->count; i++)
+		if (e->values[i] & ~mask)
+			return -1;
+	return token(&rest, t) ? -1 : 0;
+}
+
+static int manifest_line(const dbc_t *dbc, manifest_t *m, const char *line)
+{
+	char name[TOKEN_MAX], sig[TOKEN_MAX];
+	if (!token(&line, name))
+		return 0;
+	const bool whole = !token(&line, sig);
+	const size_t start = m->count;
+	uint64_t id = 0;
+	const bool numeric = number(name, &id);
+	for (size_t i = 0; i < dbc->message_count; i++) {
+		const can_msg_t *msg = dbc->messages[i];
+		if (strcmp(msg->name, name) && !(numeric && msg->id == id))
+			continue;
+		if (m->count == m->max)
+			m->entries = reallocator(m->entries, sizeof(*m->entries) * (m->max = m->max * 2 + 8));
+		entry_t *e = &m->entries[m->count++];
+		memset(e, 0, sizeof(*e));
+		e->message = i;
+		if (whole)
+			continue;
+		if (!(e->sig = find_signal(msg, sig)))
+			return -1;
+		const unsigned length = e->sig->bit_length;
+		if (predicate(e, line, length >= 64 ? UINT64_MAX : (UINT64_C(1) << length) - 1) < 0)
+			return -1;
+		m->predicates = true;
+	}
+	return m->count > start ? 0 : -1;
+}
+
+static int manifest_read(const dbc_t *dbc, const char *file, manifest_t *m)
+{
+	memset(m, 0, sizeof(*m));
+	FILE *f = fopen(file, "rb");
+	if (!f) {
+		warning("could not open manifest '%s': %s", file, emsg());
+		return -1;
+	}
+	char *text = slurp(f);
+	fclose(f);
+	if (!text) {
+		warning("could not read manifest '%s'", file);
+		return -1;
+	}
+	unsigned line = 1;
+	for (char *s = text, *next = NULL; s; s = next, line++) {
+		if ((next = strchr(s, '\n')))
+			*next++ = '\0';
+		char *hash = strchr(s, '#');
+		if (hash)
+			*hash = '\0';
+		if (manifest_line(dbc, m, s) < 0) {
+			warning("%s:%u: no such message or signal, or an invalid predicate: %s", file, line, s);
+			free(text);
+			free(m->entries);
+			return -1;
+		}
+	}
+	free(text);
+	if (!m->count) {
+		warning("manifest '%s' lists no messages", file);
+		return -1;
+	}
+	return 0;
+}
+
+bool *filter_manifest(const dbc_t *dbc, const char *file)
+{
+	assert(dbc);
+	assert(file);
+	manifest_t m;
+	if (manifest_read(dbc, file, &m) < 0)
+		return NULL;
+	bool *wanted = allocate(sizeof(*wanted) * (dbc->message_count + 1));
+	for (size_t i = 0; i < m.count; i++)
+		wanted[m.entries[i].message] = true;
+	free(m.entries);
+	return wanted;
+}
+
+enum { TO_NEXT, TO_ACCEPT, TO_END }; /* jump targets until a block is done */
+
+typedef struct {
+	filter_insn_t *insns;
+	size_t count, max;
+} bpf_t;
+
+static void emit(bpf_t *b, uint16_t code, uint32_t k, uint8_t jt, uint8_t jf, bool id)
+{
+	if (b->count == b->max)
+		b->insns = reallocator(b->insns, sizeof(*b->insns) * (b->max = b->max * 2 + 64));
+	b->insns[b->count++] = (filter_insn_t) { .code = code, .jt = jt, .jf = jf, .k = k, .id = id };
+}
+
+#define STMT(B, CODE, K)           emit((B), (CODE), (K), 0, 0, false)
+#define JUMP(B, CODE, K, JT, JF)   emit((B), (CODE), (K), (JT), (JF), false)
+
+/* the start bit of a signal in the word it is shifted out of, as in
+ * 'fix_start_bit' in '2c.c': the little endian load of the payload for
+ * Intel signals and the big endian one for Motorola signals */
+static long word_start(const signal_t *sig)
+{
+	long start = sig->start_bit;
+	if (sig->endianess == endianess_motorola_e)
+		start = (8 * (7 - (start / 8))) + (start % 8) - ((long)sig->bit_length - 1);
+	return start;
+}
+
+static bool fits(const signal_t *sig)
+{
+	const long start = word_start(sig), length = sig->bit_length;
+	return length >= 1 && length <= 64 && start >= 0 && start + length <= 64;
+}
+
+/* byte 'k' of the word is this byte of the payload */
+static uint32_t payload_byte(const signal_t *sig, long k)
+{
+	return CAN_DATA + (sig->endianess == endianess_motorola_e ? 7 - k : k);
+}
+
+/* the DLC a frame needs to hold the signal */
+static uint32_t needed(const signal_t *sig)
+{
+	const long start = word_start(sig), last = (start + sig->bit_length - 1) / 8;
+	return sig->endianess == endianess_motorola_e ? 8 - start / 8 : last + 1;
+}
+
+/* Leave the raw value of a signal in A, the bytes holding it are loaded
+ * most significant first and shifted in, unless a big endian load of two
+ * or four bytes does it */
+static int extract(bpf_t *b, const signal_t *sig)
+{
+	const long start = word_start(sig), length = sig->bit_length;
+	if (!fits(sig) || length > 32)
+		return -1;
+	const long lo = start / 8, hi = (start + length - 1) / 8, bytes = hi - lo + 1;
+	if (bytes > 4)
+		return -1;
+	if (sig->endianess == endianess_motorola_e && bytes == 4) {
+		STMT(b, FILTER_LD_W, payload_byte(sig, hi));
+	} else if (sig->endianess == endianess_motorola_e && bytes == 2) {
+		STMT(b, FILTER_LD_H, payload_byte(sig, hi));
+	} else {
+		STMT(b, FILTER_LD_B, payload_byte(sig, hi));
+		for (long k = hi - 1; k >= lo; k--) {
+			STMT(b, FILTER_LSH, 8);
+			STMT(b, FILTER_ST, 0);
+			STMT(b, FILTER_LD_B, payload_byte(sig, k));
+			STMT(b, FILTER_TAX, 0);
+			STMT(b, FILTER_LD_MEM, 0);
+			STMT(b, FILTER_OR_X, 0);
+		}
+	}
+	if (start - 8 * lo)
+		STMT(b, FILTER_RSH, start - 8 * lo);
+	if (length < 32)
+		STMT(b, FILTER_AND, (UINT32_C(1) << length) - 1);
+	return 0;
+}
+
+static const signal_t *multiplexor(const can_msg_t *msg)
+{
+	for (size_t i = 0; i < msg->signal_count; i++)
+		if (msg->sigs[i]->is_multiplexor)
+			return msg->sigs[i];
+	return NULL;
+}
+
+/* One block per line of the manifest: match the ID, check the DLC and the
+ * multiplexor, if the signal is multiplexed, and then the predicate. It
+ * ends in an accepting return and falls through to the next block if the
+ * frame is not accepted, so every jump is short. */
+static int block(bpf_t *b, const can_msg_t *msg, const entry_t *e)
+{
+	const size_t start = b->count;
+	const uint32_t id = msg->id;
+	STMT(b, FILTER_LD_W, 0);
+	emit(b, FILTER_AND, FILTER_EXTENDED | FRAME_FLAGS | (id & FILTER_EXTENDED ? EXTENDED_MASK : STANDARD_MASK), 0, 0, true);
+	emit(b, FILTER_JEQ, id, TO_NEXT, TO_END, true);
+	if (e->sig) {
+		const signal_t *mux = e->sig->is_multiplexed ? multiplexor(msg) : NULL;
+		if (!fits(e->sig) || (e->sig->is_multiplexed && !mux))
+			return -1;
+		uint32_t dlc = needed(e->sig);
+		if (mux && needed(mux) > dlc)
+			dlc = needed(mux);
+		STMT(b, FILTER_LD_B, CAN_DLC);
+		JUMP(b, FILTER_JGE, dlc, TO_NEXT, TO_END);
+		if (mux) {
+			if (extract(b, mux) < 0)
+				return -1;
+			JUMP(b, FILTER_JEQ, e->sig->switchval, TO_NEXT, TO_END);
+		}
+		if (e->type == PREDICATE_NOT && !e->values[0]) {
+			const long length = e->sig->bit_length;
+			const uint64_t bits = (length == 64 ? UINT64_MAX : (UINT64_C(1) << length) - 1) << word_start(e->sig);
+			for (long k = 0; k < 8; k++) {
+				const uint32_t byte = (bits >> (8 * k)) & 0xFF;
+				if (!byte)
+					continue;
+				STMT(b, FILTER_LD_B, payload_byte(e->sig, k));
+				JUMP(b, FILTER_JSET, byte, TO_ACCEPT, TO_NEXT);
+			}
+			b->insns[b->count - 1].jf = TO_END;
+		} else if (e->type == PREDICATE_NOT) {
+			if (extract(b, e->sig) < 0)
+				return -1;
+			JUMP(b, FILTER_JEQ, e->values[0], TO_END, TO_ACCEPT);
+		} else {
+			if (extract(b, e->sig) < 0)
+				return -1;
+			for (size_t i = 0; i < e->count; i++)
+				JUMP(b, FILTER_JEQ, e->values[i], TO_ACCEPT, TO_NEXT);
+			b->insns[b->count - 1].jf = TO_END;
+		}
+	}
+	STMT(b, FILTER_RET, ACCEPT);
+	const size_t accept = b->count - 1, end = b->count;
+	for (size_t i = start; i < end; i++) {
+		filter_insn_t *in = &b->insns[i];
+		if ((in->code & 0x07) != 0x05) /* BPF_JMP */
+			continue;
+		const size_t to[] = { [TO_NEXT] = i + 1, [TO_ACCEPT] = accept, [TO_END] = end };
+		if (to[in->jt] - i - 1 > UINT8_MAX || to[in->jf] - i - 1 > UINT8_MAX)
+			return -1;
+		in->jt = to[in->jt] - i - 1;
+		in->jf = to[in->jf] - i - 1;
+	}
+	return 0;
+}
+
+int filter_bpf(const dbc_t *dbc, const char *manifest, filter_insn_t **program, size_t *length)
+{
+	assert(dbc);
+	assert(manifest);
+	assert(program);
+	assert(length);
+	*program = NULL;
+	*length = 0;
+	manifest_t m;
+	if (manifest_read(dbc, manifest, &m) < 0)
+		return -1;
+	if (!m.predicates) {
+		free(m.entries);
+		return 0;
+	}
+	bpf_t b = { .insns = NULL };
+	for (size_t i = 0; i < m.count; i++) {
+		const can_msg_t *msg = dbc->messages[m.entries[i].message];
+		if (block(&b, msg, &m.entries[i]) < 0) {
+			warning("%s: cannot compile the predicate on '%s' in '%s', it must be in four adjacent bytes", manifest,
+					m.entries[i].sig ? m.entries[i].sig->name : "", msg->name);
+			goto fail;
+		}
+	}
+	STMT(&b, FILTER_RET, 0);
+	if (b.count > FILTER_BPF_MAX) {
+		warning("%s: the program is %zu instructions, more than the %u allowed", manifest, b.count, FILTER_BPF_MAX);
+		goto fail;
+	}
+	free(m.entries);
+	*program = b.insns;
+	*length = b.count;
+	return 0;
+fail:
+	free(m.entries);
+	free(b.insns);
+	return -1;
+}
@@ -0,0 +1,117 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "can.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Receive filters for the messages a node (or a consumer listed in a
+ * manifest) needs, in the form SocketCAN takes them with 'CAN_RAW_FILTER':
+ * a frame passes a filter if '(can_id & mask) == (id & mask)'. Extended IDs
+ * have the top bit set, as they do in the DBC file and in 'can_id', and it
+ * is always in the mask so standard and extended frames are kept apart.
+ *
+ * One exact filter per message is what the kernel checks fastest for
+ * standard IDs, but each filter costs memory per socket, there is a limit
+ * of FILTER_MAX of them, and extended IDs (and any filters that are not
+ * exact) are checked one after the other for every frame. So neighbouring
+ * filters are merged, by clearing the mask bits they differ in, for as long
+ * as the merged filters pass no more than the given fraction of messages
+ * from the DBC file that are not needed. IDs that are not in the DBC file
+ * are assumed not to be on the bus. */
+
+#define FILTER_EXTENDED (0x80000000ul) /**< CAN_EFF_FLAG */
+#define FILTER_MAX      (512u)         /**< CAN_RAW_FILTER_MAX */
+
+typedef struct {
+	uint32_t id, mask;
+} filter_t;
+
+typedef struct {
+	filter_t *filters;
+	size_t count;
+	size_t wanted;   /**< messages in the DBC file that are needed */
+	size_t unwanted; /**< other messages in the DBC file the filters pass */
+} filter_set_t;
+
+/* Nodes that receive at least one signal, sorted, the names belong to 'dbc' */
+const char **filter_nodes(const dbc_t *dbc, size_t *count);
+
+/* Which of the messages in 'dbc' are needed, in the same order, by a node
+ * (any message with a signal it receives) or by a consumer that lists the
+ * messages it needs in a file, by name or ID, one per line ('#' starts a
+ * comment). A line may go on to say which frames of the message are
+ * wanted, by the raw value of one of its signals:
+ *
+ *	Mux_Message Mux in {1, 3}
+ *	Status Fault != 0
+ *
+ * These are only checked by the program 'filter_bpf' makes, the ID filters
+ * pass every frame of the message. Returns NULL if the node receives
+ * nothing or the manifest cannot be read or is invalid. */
+bool *filter_node(const dbc_t *dbc, const char *node);
+bool *filter_manifest(const dbc_t *dbc, const char *file);
+
+/* Merge filters for the 'wanted' messages while no more than 'rate' (0 to
+ * 1) of the messages passed are unwanted, more are merged regardless if it
+ * takes that to get down to FILTER_MAX filters. */
+int filter_compute(const dbc_t *dbc, const bool *wanted, double rate, filter_set_t *set);
+void filter_set_free(filter_set_t *set);
+
+/* The classic BPF instructions used, as in <linux/filter.h>, which is not
+ * needed to build dbcc */
+enum {
+	FILTER_LD_W   = 0x20, /**< BPF_LD | BPF_W | BPF_ABS, big endian */
+	FILTER_LD_H   = 0x28, /**< BPF_LD | BPF_H | BPF_ABS, big endian */
+	FILTER_LD_B   = 0x30, /**< BPF_LD | BPF_B | BPF_ABS */
+	FILTER_LD_MEM = 0x60, /**< BPF_LD | BPF_MEM */
+	FILTER_ST     = 0x02, /**< BPF_ST */
+	FILTER_AND    = 0x54, /**< BPF_ALU | BPF_AND | BPF_K */
+	FILTER_OR_X   = 0x4c, /**< BPF_ALU | BPF_OR | BPF_X */
+	FILTER_LSH    = 0x64, /**< BPF_ALU | BPF_LSH | BPF_K */
+	FILTER_RSH    = 0x74, /**< BPF_ALU | BPF_RSH | BPF_K */
+	FILTER_TAX    = 0x07, /**< BPF_MISC | BPF_TAX */
+	FILTER_JEQ    = 0x15, /**< BPF_JMP | BPF_JEQ | BPF_K */
+	FILTER_JGE    = 0x35, /**< BPF_JMP | BPF_JGE | BPF_K */
+	FILTER_JSET   = 0x45, /**< BPF_JMP | BPF_JSET | BPF_K */
+	FILTER_RET    = 0x06, /**< BPF_RET | BPF_K */
+};
+
+#define FILTER_BPF_MAX (4096u) /**< BPF_MAXINSNS */
+
+typedef struct {
+	uint16_t code;
+	uint8_t jt, jf;
+	uint32_t k;
+	bool id; /**< 'k' is an ID or mask, the load of 'can_id' is big endian */
+} filter_insn_t;
+
+/* Compile a manifest into a classic BPF program for 'SO_ATTACH_FILTER'
+ * that passes a frame if a line for its message accepts it, so frames
+ * that would be thrown away are dropped before they are copied out of the
+ * kernel. The payload is read with the start bit and length arithmetic of
+ * the generated code, 'in' and '!=' with a value other than 0 need the
+ * signal in four adjacent bytes, '!= 0' tests the bits of any signal. A
+ * frame with a DLC too short for the signal is not accepted by the line.
+ * Sets '*length' to 0, and no program, if the manifest has no
+ * predicates. Returns -1 if it is invalid. */
+int filter_bpf(const dbc_t *dbc, const char *manifest, filter_insn_t **program, size_t *length);
+
+static inline bool filter_match(const filter_t *f, size_t count, uint32_t can_id)
+{
+	for (size_t i = 0; i < count; i++)
+		if (((can_id ^ f[i].id) & f[i].mask) == 0)
+			return true;
+	return false;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,292 @@
+/**@note See 'image.h' for the format and '2bin.c' for the writer. */
+#define _POSIX_C_SOURCE 200809L
+#include "image.h"
+#include "util.h"
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define HAVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/* an array of 'count' elements of 'size' bytes at 'offset' is in the image */
+static bool array_ok(const image_t *img, uint32_t offset, uint32_t count, size_t size)
+{
+	assert(img);
+	if (!count)
+		return true;
+	if (offset < sizeof(image_header_t) || offset % 8)
+		return false;
+	return (uint64_t)offset + (uint64_t)count * size <= img->size;
+}
+
+static bool string_ok(const image_t *img, uint32_t offset)
+{
+	assert(img);
+	if (!offset)
+		return true;
+	if (offset < sizeof(image_header_t) || offset >= img->size)
+		return false;
+	return memchr((const char*)img->header + offset, '\0', img->size - offset) != NULL;
+}
+
+static int header_ok(const image_t *img)
+{
+	assert(img);
+	const image_header_t *h = img->header;
+	if (img->size < sizeof(*h) || memcmp(h->magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)))
+		return -1;
+	if (h->byte_order != IMAGE_BYTE_ORDER) {
+		warning("image is of a different byte order");
+		return -1;
+	}
+	if (h->version != IMAGE_VERSION) {
+		warning("image version %u not supported (expected %u)", (unsigned)h->version, IMAGE_VERSION);
+		return -1;
+	}
+	if (h->size != img->size
+		|| !array_ok(img, h->messages, h->message_count, sizeof(image_message_t))
+		|| !array_ok(img, h->index,    h->message_count, sizeof(uint32_t))
+		|| !array_ok(img, h->vals,     h->val_count,     sizeof(image_val_list_t))
+		|| !array_ok(img, h->sigvals,  h->sigval_count,  sizeof(image_sigval_t)))
+		return -1;
+	return 0;
+}
+
+int image_open(const char *name, image_t *img)
+{
+	assert(name);
+	assert(img);
+	memset(img, 0, sizeof(*img));
+	errno = 0;
+#ifdef HAVE_MMAP
+	const int fd = open(name, O_RDONLY);
+	if (fd < 0)
+		goto fail;
+	struct stat st;
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(image_header_t)) {
+		close(fd);
+		goto fail;
+	}
+	void *m = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (m == MAP_FAILED)
+		goto fail;
+	img->header = m;
+	img->size = st.st_size;
+	img->mapped = true;
+#else
+	FILE *f = fopen(name, "rb");
+	if (!f)
+		goto fail;
+	char *data = slurp(f); /* 'allocate' aligns this suitably */
+	const long size = ftell(f);
+	fclose(f);
+	if (!data)
+		goto fail;
+	img->header = (const image_header_t*)data;
+	img->size = size;
+#endif
+	if (header_ok(img) < 0) {
+		warning("invalid image '%s'", name);
+		image_close(img);
+		return -1;
+	}
+	return 0;
+fail:
+	warning("could not open image '%s': %s", name, emsg());
+	return -1;
+}
+
+void image_close(image_t *img)
+{
+	if (!img || !img->header)
+		return;
+#ifdef HAVE_MMAP
+	if (img->mapped)
+		munmap((void*)img->header, img->size);
+	else
+		free((void*)img->header);
+#else
+	free((void*)img->header);
+#endif
+	memset(img, 0, sizeof(*img));
+}
+
+int image_verify(const image_t *img)
+{
+	assert(img);
+	if (header_ok(img) < 0)
+		return -1;
+	const image_header_t *h = img->header;
+	const image_val_list_t *vals = image_at(img, h->vals);
+	for (uint32_t i = 0; i < h->val_count; i++) {
+		const image_val_list_t *v = &vals[i];
+		if (!string_ok(img, v->name) || !array_ok(img, v->items, v->item_count, sizeof(image_val_item_t)))
+			return -1;
+		const image_val_item_t *items = image_at(img, v->items);
+		for (uint32_t j = 0; j < v->item_count; j++)
+			if (!string_ok(img, items[j].name))
+				return -1;
+	}
+	const image_sigval_t *sigvals = image_at(img, h->sigvals);
+	for (uint32_t i = 0; i < h->sigval_count; i++)
+		if (!string_ok(img, sigvals[i].name))
+			return -1;
+	const uint32_t *index = image_at(img, h->index);
+	const image_message_t *msgs = image_messages(img);
+	for (uint32_t i = 0; i < h->message_count; i++) {
+		const image_message_t *m = &msgs[i];
+		if (index[i] >= h->message_count)
+			return -1;
+		if (!string_ok(img, m->name) || !string_ok(img, m->ecu) || !string_ok(img, m->comment))
+			return -1;
+		if (!array_ok(img, m->signals, m->signal_count, sizeof(image_signal_t)))
+			return -1;
+		const image_signal_t *sigs = image_signals(img, m);
+		for (uint32_t j = 0; j < m->signal_count; j++) {
+			const image_signal_t *s = &sigs[j];
+			if (!string_ok(img, s->name) || !string_ok(img, s->units) || !string_ok(img, s->comment))
+				return -1;
+			if (!array_ok(img, s->ecus, s->ecu_count, sizeof(uint32_t)))
+				return -1;
+			const uint32_t *ecus = image_at(img, s->ecus);
+			for (uint32_t k = 0; k < s->ecu_count; k++)
+				if (!string_ok(img, ecus[k]))
+					return -1;
+			if (s->val_list) {
+				if (s->val_list < h->vals || (s->val_list - h->vals) % sizeof(image_val_list_t))
+					return -1;
+				if ((s->val_list - h->vals) / sizeof(image_val_list_t) >= h->val_count)
+					return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+bool image_is(const char *name)
+{
+	assert(name);
+	char magic[sizeof(IMAGE_MAGIC)] = { 0 };
+	FILE *f = fopen(name, "rb");
+	if (!f)
+		return false;
+	const bool r = fread(magic, 1, sizeof(magic), f) == sizeof(magic) && !memcmp(magic, IMAGE_MAGIC, sizeof(magic));
+	fclose(f);
+	return r;
+}
+
+const image_message_t *image_message_find(const image_t *img, unsigned long id)
+{
+	assert(img);
+	const image_header_t *h = img->header;
+	const uint32_t *index = image_at(img, h->index);
+	const image_message_t *msgs = image_messages(img);
+	size_t lo = 0, hi = h->message_count;
+	while (lo < hi) {
+		const size_t mid = lo + (hi - lo) / 2;
+		if (msgs[index[mid]].id < id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo < h->message_count && msgs[index[lo]].id == id ? &msgs[index[lo]] : NULL;
+}
+
+static char *image_duplicate(const image_t *img, uint32_t offset)
+{
+	return offset ? duplicate(image_string(img, offset)) : NULL;
+}
+
+dbc_t *image2dbc(const image_t *img)
+{
+	assert(img);
+	if (image_verify(img) < 0) {
+		warning("image is corrupt");
+		return NULL;
+	}
+	const image_header_t *h = img->header;
+	dbc_t *d = dbc_new();
+	d->use_float = !!(h->flags & IMAGE_FLAG_USE_FLOAT);
+
+	const image_val_list_t *vals = image_at(img, h->vals);
+	d->val_count = h->val_count;
+	d->vals = allocate(sizeof(*d->vals) * (h->val_count + 1));
+	for (uint32_t i = 0; i < h->val_count; i++) {
+		val_list_t *v = allocate(sizeof(*v));
+		const image_val_item_t *items = image_at(img, vals[i].items);
+		v->name = image_duplicate(img, vals[i].name);
+		v->id = vals[i].id;
+		v->val_list_item_count = vals[i].item_count;
+		v->val_list_items = allocate(sizeof(*v->val_list_items) * (vals[i].item_count + 1));
+		for (uint32_t j = 0; j < vals[i].item_count; j++) {
+			val_list_item_t *item = allocate(sizeof(*item));
+			item->name = image_duplicate(img, items[j].name);
+			item->value = items[j].value;
+			v->val_list_items[j] = item;
+		}
+		d->vals[i] = v;
+	}
+
+	const image_sigval_t *sigvals = image_at(img, h->sigvals);
+	d->sigval_count = h->sigval_count;
+	d->sigvals = allocate(sizeof(*d->sigvals) * (h->sigval_count + 1));
+	for (uint32_t i = 0; i < h->sigval_count; i++) {
+		d->sigvals[i].id = sigvals[i].id;
+		d->sigvals[i].name = image_duplicate(img, sigvals[i].name);
+		d->sigvals[i].type = sigvals[i].type;
+	}
+
+	const image_message_t *msgs = image_messages(img);
+	d->message_count = h->message_count;
+	d->messages = allocate(sizeof(*d->messages) * (h->message_count + 1));
+	for (uint32_t i = 0; i < h->message_count; i++) {
+		const image_message_t *m = &msgs[i];
+		const image_signal_t *sigs = image_signals(img, m);
+		can_msg_t *c = allocate(sizeof(*c));
+		c->name = image_duplicate(img, m->name);
+		c->ecu = image_duplicate(img, m->ecu);
+		c->comment = image_duplicate(img, m->comment);
+		c->id = m->id;
+		c->dlc = m->dlc;
+		c->signal_count = m->signal_count;
+		c->sigs = allocate(sizeof(*c->sigs) * (m->signal_count + 1));
+		for (uint32_t j = 0; j < m->signal_count; j++) {
+			const image_signal_t *s = &sigs[j];
+			const uint32_t *ecus = image_at(img, s->ecus);
+			signal_t *sig = allocate(sizeof(*sig));
+			sig->name = image_duplicate(img, s->name);
+			sig->units = image_duplicate(img, s->units);
+			sig->comment = image_duplicate(img, s->comment);
+			sig->ecu_count = s->ecu_count;
+			sig->ecus = allocate(sizeof(*sig->ecus) * (s->ecu_count + 1));
+			for (uint32_t k = 0; k < s->ecu_count; k++)
+				sig->ecus[k] = image_duplicate(img, ecus[k]);
+			sig->scaling = s->scaling;
+			sig->offset = s->offset;
+			sig->minimum = s->minimum;
+			sig->maximum = s->maximum;
+			sig->bit_length = s->bit_length;
+			sig->start_bit = s->start_bit;
+			sig->endianess = s->flags & IMAGE_SIGNAL_INTEL ? endianess_intel_e : endianess_motorola_e;
+			sig->is_signed = !!(s->flags & IMAGE_SIGNAL_SIGNED);
+			sig->is_floating = !!(s->flags & IMAGE_SIGNAL_FLOATING);
+			sig->is_multiplexor = !!(s->flags & IMAGE_SIGNAL_MULTIPLEXOR);
+			sig->is_multiplexed = !!(s->flags & IMAGE_SIGNAL_MULTIPLEXED);
+			sig->sigval = s->sigval;
+			sig->switchval = s->switchval;
+			if (s->val_list)
+				sig->val_list = d->vals[(s->val_list - h->vals) / sizeof(image_val_list_t)];
+			c->sigs[j] = sig;
+		}
+		d->messages[i] = c;
+	}
+	return d;
+}
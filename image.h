@@ -0,0 +1,146 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "can.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* A compiled DBC file: the model ('dbc_t') laid out in a single block of
+ * memory that can be mapped in and used in place, read only. References
+ * within the image are byte offsets from its start, so it can be mapped
+ * anywhere without fixing anything up, and an offset of zero means there is
+ * nothing there. Every record starts on an eight byte boundary. Images are
+ * in the byte order of the machine that wrote them, one of a different byte
+ * order or version is rejected when opened.
+ *
+ * Messages are stored in the same order as in the DBC file, so converting an
+ * image back into a 'dbc_t' gives the same output as the original file, and
+ * 'index' sorts them by ID for 'image_message_find'. */
+
+#define IMAGE_MAGIC      "DBCCIMG"
+#define IMAGE_VERSION    (1u)
+#define IMAGE_BYTE_ORDER (0x01020304u)
+
+enum {
+	IMAGE_FLAG_USE_FLOAT = 1u << 0, /**< 'dbc_t.use_float' */
+};
+
+enum {
+	IMAGE_SIGNAL_INTEL       = 1u << 0, /**< little endian, motorola otherwise */
+	IMAGE_SIGNAL_SIGNED      = 1u << 1,
+	IMAGE_SIGNAL_FLOATING    = 1u << 2,
+	IMAGE_SIGNAL_MULTIPLEXOR = 1u << 3,
+	IMAGE_SIGNAL_MULTIPLEXED = 1u << 4,
+};
+
+typedef struct {
+	char magic[8];         /**< IMAGE_MAGIC */
+	uint32_t version;      /**< IMAGE_VERSION */
+	uint32_t byte_order;   /**< IMAGE_BYTE_ORDER, as written */
+	uint32_t size;         /**< size of the whole image in bytes */
+	uint32_t flags;        /**< IMAGE_FLAG_* */
+	uint32_t message_count;
+	uint32_t messages;     /**< array of 'image_message_t' */
+	uint32_t index;        /**< array of message numbers sorted by ID */
+	uint32_t val_count;
+	uint32_t vals;         /**< array of 'image_val_list_t' */
+	uint32_t sigval_count;
+	uint32_t sigvals;      /**< array of 'image_sigval_t' */
+	uint32_t reserved;
+} image_header_t;
+
+typedef struct {
+	uint32_t name, ecu, comment; /**< strings */
+	uint32_t id;
+	uint32_t dlc;
+	uint32_t signal_count;
+	uint32_t signals;            /**< array of 'image_signal_t' */
+	uint32_t reserved;
+} image_message_t;
+
+typedef struct {
+	double scaling, offset, minimum, maximum;
+	uint32_t name, units, comment; /**< strings */
+	uint32_t ecu_count;
+	uint32_t ecus;                 /**< array of strings */
+	uint32_t bit_length;
+	uint32_t start_bit;
+	uint32_t flags;                /**< IMAGE_SIGNAL_* */
+	uint32_t sigval;
+	uint32_t switchval;
+	uint32_t val_list;             /**< an 'image_val_list_t' in 'vals' */
+	uint32_t reserved;
+} image_signal_t;
+
+typedef struct {
+	uint32_t name;       /**< string */
+	uint32_t id;
+	uint32_t item_count;
+	uint32_t items;      /**< array of 'image_val_item_t' */
+} image_val_list_t;
+
+typedef struct {
+	uint32_t name;       /**< string */
+	uint32_t value;
+} image_val_item_t;
+
+typedef struct {
+	uint32_t id;
+	uint32_t name;       /**< string */
+	uint32_t type;
+	uint32_t reserved;
+} image_sigval_t;
+
+typedef struct {
+	const image_header_t *header; /**< start of the image */
+	size_t size;
+	bool mapped;                  /**< from mmap, rather than read in */
+} image_t;
+
+/* 'image_open' only checks the header and the top level arrays, so opening
+ * does not touch the rest of the image, 'image_verify' checks that every
+ * offset and string in it is within bounds and should be used on images that
+ * might be corrupt before they are accessed. Both return -1 on failure. */
+int image_open(const char *name, image_t *img);
+void image_close(image_t *img);
+int image_verify(const image_t *img);
+bool image_is(const char *name); /**< true if 'name' looks like an image */
+
+const image_message_t *image_message_find(const image_t *img, unsigned long id);
+dbc_t *image2dbc(const image_t *img);
+
+static inline const void *image_at(const image_t *img, uint32_t offset)
+{
+	return offset ? (const char*)img->header + offset : NULL;
+}
+
+static inline const char *image_string(const image_t *img, uint32_t offset)
+{
+	return image_at(img, offset);
+}
+
+static inline const image_message_t *image_messages(const image_t *img)
+{
+	return image_at(img, img->header->messages);
+}
+
+static inline const image_signal_t *image_signals(const image_t *img, const image_message_t *msg)
+{
+	return image_at(img, msg->signals);
+}
+
+static inline const image_val_list_t *image_val_list(const image_t *img, const image_signal_t *sig)
+{
+	return image_at(img, sig->val_list);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,395 @@
+/**@note See 'jit.h'. Each plan becomes a function of the form:
+ *
+ *	int decode(uint64_t intel, double *out);
+ *
+ * called with the payload loaded as for 'dbcc_decode_plan', and the
+ * registers are used as follows, all of them are caller saved in the System
+ * V calling convention so there is no prologue or stack frame:
+ *
+ *	rdi  payload (intel word)       rsi  output array
+ *	rax  intel word                 rdx  motorola word (byte swapped)
+ *	rcx  field being decoded        r8   scratch
+ *	r9   multiplexor value          r10  scratch
+ *	r11  a multiplexed signal was selected
+ *	xmm0 value being converted
+ *
+ * Fields that do not run off the top of the word are extracted with a left
+ * shift followed by a logical or arithmetic right shift, which masks and
+ * sign extends them at the same time. Scalings and offsets are read from a
+ * constant pool after the code of each plan. The arithmetic is the same as
+ * in the interpreter (a multiply then an add, not a fused multiply add) so
+ * that both give the same results. */
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE /* for MAP_ANONYMOUS */
+#include "jit.h"
+#include "util.h"
+#include <assert.h>
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(DBCC_NO_JIT) && defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__))
+#define USE_JIT
+#include <sys/mman.h>
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#endif
+
+struct jit {
+	void *code;
+	size_t size;
+	size_t compiled;
+};
+
+size_t jit_compiled(const jit_t *jit)
+{
+	assert(jit);
+	return jit->compiled;
+}
+
+size_t jit_size(const jit_t *jit)
+{
+	assert(jit);
+	return jit->size;
+}
+
+#ifdef USE_JIT
+
+enum { RAX = 0, RCX = 1, RDX = 2, RSI = 6, RDI = 7, R8 = 8, R9 = 9, R10 = 10, R11 = 11 };
+
+typedef struct {
+	size_t at;    /**< position of a RIP relative displacement */
+	double value; /**< constant it refers to */
+} fixup_t;
+
+typedef struct {
+	uint8_t *code;
+	size_t used, max;
+	fixup_t *fixups;
+	size_t fixup_count, fixup_max;
+} emitter_t;
+
+static void bytes(emitter_t *e, const void *b, size_t length)
+{
+	assert(e);
+	if (e->used + length > e->max) {
+		e->max = (e->used + length) * 2 + 4096;
+		e->code = reallocator(e->code, e->max);
+	}
+	memcpy(e->code + e->used, b, length);
+	e->used += length;
+}
+
+#define EMIT(E, ...) do { const uint8_t b_[] = { __VA_ARGS__ }; bytes((E), b_, sizeof(b_)); } while (0)
+
+static void u32(emitter_t *e, uint32_t u)
+{
+	const uint8_t b[4] = { u, u >> 8, u >> 16, u >> 24 };
+	bytes(e, b, sizeof(b));
+}
+
+static void u64(emitter_t *e, uint64_t u)
+{
+	u32(e, u);
+	u32(e, u >> 32);
+}
+
+static void patch(emitter_t *e, size_t at, uint32_t u)
+{
+	assert(e);
+	assert(at + 4 <= e->used);
+	const uint8_t b[4] = { u, u >> 8, u >> 16, u >> 24 };
+	memcpy(e->code + at, b, sizeof(b));
+}
+
+/* a reference to a constant in the pool, for an instruction ending in a
+ * RIP relative displacement */
+static void constant(emitter_t *e, double value)
+{
+	assert(e);
+	if (e->fixup_count == e->fixup_max) {
+		e->fixup_max = e->fixup_max * 2 + 16;
+		e->fixups = reallocator(e->fixups, sizeof(*e->fixups) * e->fixup_max);
+	}
+	e->fixups[e->fixup_count++] = (fixup_t){ .at = e->used, .value = value };
+	u32(e, 0);
+}
+
+/* write out the pool for the function just emitted, constants are shared
+ * within a function */
+static void pool(emitter_t *e)
+{
+	assert(e);
+	while (e->used % 8)
+		EMIT(e, 0xCC); /* int3 */
+	const size_t start = e->used;
+	for (size_t i = 0; i < e->fixup_count; i++) {
+		size_t at = start;
+		for (; at < e->used; at += 8)
+			if (!memcmp(e->code + at, &e->fixups[i].value, 8))
+				break;
+		if (at == e->used) {
+			uint64_t u = 0;
+			memcpy(&u, &e->fixups[i].value, sizeof(u));
+			u64(e, u);
+		}
+		patch(e, e->fixups[i].at, at - (e->fixups[i].at + 4));
+	}
+	e->fixup_count = 0;
+}
+
+static void mov_r64_imm64(emitter_t *e, unsigned reg, uint64_t imm)
+{
+	EMIT(e, 0x48 | (reg >> 3), 0xB8 | (reg & 7));
+	u64(e, imm);
+}
+
+/* 'op' is the opcode of a two operand instruction in its 'r/m64, r64' form */
+static void op_r64_r64(emitter_t *e, uint8_t op, unsigned dst, unsigned src)
+{
+	EMIT(e, 0x48 | ((src >> 3) << 2) | (dst >> 3), op, 0xC0 | ((src & 7) << 3) | (dst & 7));
+}
+
+/* shifts of rcx, 'ext' selects the shift: 4 = shl, 5 = shr, 7 = sar */
+static void shift_rcx(emitter_t *e, unsigned ext, unsigned count)
+{
+	assert(count < 64);
+	if (count)
+		EMIT(e, 0x48, 0xC1, 0xC0 | (ext << 3) | RCX, count);
+}
+
+static void store_xmm0(emitter_t *e, uint32_t output)
+{
+	EMIT(e, 0xF2, 0x0F, 0x11, 0x86); /* movsd [rsi + disp32], xmm0 */
+	u32(e, output * sizeof(double));
+}
+
+static void store_nan(emitter_t *e, uint32_t output)
+{
+	EMIT(e, 0xF2, 0x0F, 0x10, 0x05); /* movsd xmm0, [rip + disp32] */
+	constant(e, NAN);
+	store_xmm0(e, output);
+}
+
+static bool op_supported(const decode_op_t *op)
+{
+	assert(op);
+	/* 'cvtsi2sd' is signed, an unsigned 64-bit field would need a
+	 * sequence of its own, leave those to the interpreter */
+	return !(op->type == DECODE_UNSIGNED && op->mask == UINT64_MAX);
+}
+
+/* decode a field into rcx, as 'x' in the interpreter */
+static void field(emitter_t *e, const decode_op_t *op)
+{
+	assert(e);
+	assert(op);
+	unsigned length = 0;
+	for (uint64_t mask = op->mask; mask; mask >>= 1)
+		length++;
+	const bool is_signed = op->type == DECODE_SIGNED;
+	op_r64_r64(e, 0x89, RCX, op->flags & DECODE_MOTOROLA ? RDX : RAX); /* mov rcx, word */
+	if (op->shift + length <= 64) {
+		shift_rcx(e, 4, 64 - op->shift - length);
+		shift_rcx(e, is_signed ? 7 : 5, 64 - length);
+		return;
+	}
+	shift_rcx(e, 5, op->shift);
+	mov_r64_imm64(e, R8, op->mask);
+	op_r64_r64(e, 0x21, RCX, R8); /* and rcx, r8 */
+	if (is_signed) {
+		mov_r64_imm64(e, R8, op->sign);
+		op_r64_r64(e, 0x31, RCX, R8); /* xor rcx, r8 */
+		op_r64_r64(e, 0x29, RCX, R8); /* sub rcx, r8 */
+	}
+}
+
+/* convert rcx to a double, scale it and store it */
+static void value(emitter_t *e, const decode_op_t *op)
+{
+	assert(e);
+	assert(op);
+	bool integer = true;
+	switch (op->type) {
+	case DECODE_UNSIGNED:
+	case DECODE_SIGNED:
+		EMIT(e, 0xF2, 0x48, 0x0F, 0x2A, 0xC1); /* cvtsi2sd xmm0, rcx */
+		break;
+	case DECODE_FLOAT:
+		EMIT(e, 0x66, 0x0F, 0x6E, 0xC1);       /* movd xmm0, ecx */
+		EMIT(e, 0xF3, 0x0F, 0x5A, 0xC0);       /* cvtss2sd xmm0, xmm0 */
+		integer = false;
+		break;
+	case DECODE_DOUBLE:
+		EMIT(e, 0x66, 0x48, 0x0F, 0x6E, 0xC1); /* movq xmm0, rcx */
+		integer = false;
+		break;
+	default:
+		assert(0);
+	}
+	/* Multiplying an integer by one does not change it, and adding zero
+	 * only changes a negative zero, which it cannot be unless it has been
+	 * multiplied by a negative number. Floating point values always go
+	 * through both, as that also quiets signalling NaNs. */
+	if (!integer || op->scaling != 1.0) {
+		EMIT(e, 0xF2, 0x0F, 0x59, 0x05); /* mulsd xmm0, [rip + disp32] */
+		constant(e, op->scaling);
+	}
+	if (!integer || op->offset != 0.0 || (!signbit(op->offset) && signbit(op->scaling))) {
+		EMIT(e, 0xF2, 0x0F, 0x58, 0x05); /* addsd xmm0, [rip + disp32] */
+		constant(e, op->offset);
+	}
+	store_xmm0(e, op->output);
+}
+
+static void op2x64(emitter_t *e, const decode_op_t *op, bool multiplexor)
+{
+	assert(e);
+	assert(op);
+	if (op->type == DECODE_INVALID && !(op->flags & DECODE_MULTIPLEXED)) {
+		store_nan(e, op->output);
+		return;
+	}
+	size_t skip = 0, done = 0;
+	if (op->flags & DECODE_MULTIPLEXED) {
+		EMIT(e, 0x41, 0xBA);            /* mov r10d, imm32 */
+		u32(e, op->switchval);
+		op_r64_r64(e, 0x39, R9, R10);   /* cmp r9, r10 */
+		EMIT(e, 0x0F, 0x85);            /* jne rel32 */
+		skip = e->used;
+		u32(e, 0);
+	}
+	if (op->type == DECODE_INVALID) {
+		store_nan(e, op->output);
+	} else {
+		field(e, op);
+		if (multiplexor)
+			op_r64_r64(e, 0x89, R9, RCX); /* mov r9, rcx */
+		value(e, op);
+	}
+	if (op->flags & DECODE_MULTIPLEXED) {
+		EMIT(e, 0x41, 0xBB, 1, 0, 0, 0); /* mov r11d, 1 */
+		EMIT(e, 0xE9);                   /* jmp rel32 */
+		done = e->used;
+		u32(e, 0);
+		patch(e, skip, e->used - (skip + 4));
+		store_nan(e, op->output);
+		patch(e, done, e->used - (done + 4));
+	}
+}
+
+static void plan2x64(emitter_t *e, const decode_plan_t *plan)
+{
+	assert(e);
+	assert(plan);
+	bool motorola = false;
+	for (size_t i = 0; i < plan->op_count; i++)
+		motorola |= !!(plan->ops[i].flags & DECODE_MOTOROLA);
+	op_r64_r64(e, 0x89, RAX, RDI);     /* mov rax, rdi */
+	if (motorola) {
+		op_r64_r64(e, 0x89, RDX, RDI); /* mov rdx, rdi */
+		EMIT(e, 0x48, 0x0F, 0xCA);     /* bswap rdx */
+	}
+	if (plan->multiplexed) {
+		EMIT(e, 0x45, 0x31, 0xC9);     /* xor r9d, r9d */
+		EMIT(e, 0x45, 0x31, 0xDB);     /* xor r11d, r11d */
+	}
+	for (size_t i = 0; i < plan->op_count; i++)
+		op2x64(e, &plan->ops[i], plan->multiplexed && i == 0);
+	EMIT(e, 0xB8);                     /* mov eax, imm32 */
+	u32(e, plan->signal_count);
+	if (plan->multiplexed) {
+		EMIT(e, 0xB9, 0xFF, 0xFF, 0xFF, 0xFF); /* mov ecx, -1 */
+		EMIT(e, 0x45, 0x85, 0xDB);     /* test r11d, r11d */
+		EMIT(e, 0x0F, 0x44, 0xC1);     /* cmovz eax, ecx */
+	}
+	EMIT(e, 0xC3);                     /* ret */
+	pool(e);
+}
+
+bool jit_available(void)
+{
+	return true;
+}
+
+jit_t *jit_new(decode_plan_t *plans, size_t count)
+{
+	assert(plans || !count);
+	emitter_t e = { .code = NULL };
+	size_t *starts = allocate(sizeof(*starts) * (count + 1));
+	bool *compiled = allocate(sizeof(*compiled) * (count + 1));
+	for (size_t i = 0; i < count; i++) {
+		compiled[i] = true;
+		for (size_t j = 0; j < plans[i].op_count; j++)
+			compiled[i] &= op_supported(&plans[i].ops[j]);
+		if (!compiled[i])
+			continue;
+		while (e.used % 16)
+			EMIT(&e, 0xCC);
+		starts[i] = e.used;
+		plan2x64(&e, &plans[i]);
+	}
+
+	jit_t *jit = NULL;
+	const size_t size = e.used ? e.used : 1;
+	errno = 0;
+	void *code = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (code == MAP_FAILED) {
+		warning("could not map memory for the JIT: %s", emsg());
+		goto done;
+	}
+	memcpy(code, e.code, e.used);
+	if (mprotect(code, size, PROT_READ | PROT_EXEC) < 0) {
+		warning("could not make JIT code executable: %s", emsg());
+		munmap(code, size);
+		goto done;
+	}
+	jit = allocate(sizeof(*jit));
+	jit->code = code;
+	jit->size = size;
+	for (size_t i = 0; i < count; i++) {
+		if (!compiled[i])
+			continue;
+		void *native = (uint8_t*)code + starts[i];
+		memcpy(&plans[i].native, &native, sizeof(native)); /* ISO C has no cast for this */
+		jit->compiled++;
+	}
+	debug("JIT compiled %zu of %zu plans into %zu bytes", jit->compiled, count, size);
+done:
+	free(e.code);
+	free(e.fixups);
+	free(starts);
+	free(compiled);
+	return jit;
+}
+
+void jit_delete(jit_t *jit)
+{
+	if (!jit)
+		return;
+	munmap(jit->code, jit->size);
+	free(jit);
+}
+
+#else
+
+bool jit_available(void)
+{
+	return false;
+}
+
+jit_t *jit_new(decode_plan_t *plans, size_t count)
+{
+	UNUSED(plans);
+	UNUSED(count);
+	return NULL;
+}
+
+void jit_delete(jit_t *jit)
+{
+	UNUSED(jit);
+}
+
+#endif
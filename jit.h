@@ -0,0 +1,38 @@
+#ifndef JIT_H
+#define JIT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "decode.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Translates decode plans (see 'decode.h') into x86-64 machine code, the
+ * code for a plan decodes a payload exactly as 'dbcc_decode_plan' would
+ * with the operations unrolled and their constants inlined. All of the
+ * code for a set of plans is written into one mapping that is made read
+ * only and executable once it is complete.
+ *
+ * The JIT is only available on x86-64 Unixen, and can be disabled with
+ * DBCC_NO_JIT, elsewhere 'jit_new' always returns NULL and plans are
+ * interpreted. */
+
+typedef struct jit jit_t;
+
+bool jit_available(void);
+
+/* Compile 'plans', setting 'native' in each plan that could be compiled
+ * and leaving the rest to be interpreted. The plans must not be used after
+ * the returned object has been deleted, unless 'native' is cleared. */
+jit_t *jit_new(decode_plan_t *plans, size_t count);
+void jit_delete(jit_t *jit);
+size_t jit_compiled(const jit_t *jit); /**< number of plans compiled */
+size_t jit_size(const jit_t *jit);     /**< bytes of code and constants */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
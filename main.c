@@ -13,7 +13,13 @@
 #include "2csv.h"
 #include "2bsm.h"
 #include "2json.h"
+#include "2bin.h"
+#include "image.h"
 #include "options.h"
+#include "pool.h"
+#include "profile.h"
+
+#define MEMO_MAX_BYTES (1024ul * 1024ul * 1024ul)
 
 typedef enum {
 	CONVERT_TO_C,
@@ -21,12 +27,13 @@ typedef enum {
 	CONVERT_TO_CSV,
 	CONVERT_TO_BSM,
 	CONVERT_TO_JSON,
+	CONVERT_TO_BIN,
 } conversion_type_e;
 
 static void usage(const char *arg0)
 {
 	assert(arg0);
-	fprintf(stderr, "%s: [-] [-hvjgtxpkuDC] [-o dir] file*\n", arg0);
+	fprintf(stderr, "%s: [-] [-hvjgtxpkusmiBfDCcn] [-T threads] [-J jobs] [-S files] [-P format] [-R percent] [-M manifest] [-o dir] file*\n", arg0);
 }
 
 static void help(void)
@@ -44,12 +51,29 @@ Options:\n\
 \t-C     convert output to CSV instead of the default C code\n\
 \t-b     convert output to BSM (beSTORM) instead of the default C code\n\
 \t-j     convert output to JSON instead of the default C code\n\
+\t-c     convert output to a compiled binary image (.dbcb) that dbcc,\n\
+\t       and other tools, can load instead of the DBC file\n\
 \t-D     use 'double' for the encode/decode type messages\n\
+\t-n     make 'dbcc_time_stamp_t' a 64-bit count of nanoseconds\n\
 \t-o dir set the output directory\n\
 \t-p     generate only print code\n\
 \t-k     generate only pack code\n\
 \t-u     generate only unpack code\n\
 \t-s     disable assert generation\n\
+\t-m     memoize parser results (packrat parsing), for pathological inputs\n\
+\t-i     only write output files whose contents have changed\n\
+\t-B     also write a benchmark for the generated C (bench_<name>.c)\n\
+\t-f     also write SocketCAN receive filters for each node (filters_<name>.h)\n\
+\t-R n   let the filters pass up to 'n' percent of messages that are not\n\
+\t       needed to use fewer of them, default 0, implies -f\n\
+\t-M file also write filters for the messages listed in 'file', implies -f,\n\
+\t        lines such as 'Message Signal in {1, 3}' or 'Message Signal != 0'\n\
+\t        also get a BPF program checking the payload\n\
+\t-T n   parse and generate C on 'n' threads, 0 (default) is one per core\n\
+\t-J n   process 'n' files at a time, 0 is one per core, default 1\n\
+\t-S n   split the generated C messages over 'n' extra source files\n\
+\t-P fmt print where the time and memory went for each file to\n\
+\t       stdout, 'fmt' is 'table' or 'json', files are processed serially\n\
 \tfile   process a DBC file\n\
 \n\
 Files must come after the arguments have been processed.\n\
@@ -78,7 +102,92 @@ static char *replace_file_type(const char *file, const char *suffix)
 	return name;
 }
 
-static int dbc2cWrapper(dbc_t *dbc, const char *dbc_file, const char *file_only, dbc2c_options_t *copts)
+/* "dir/x.dbc" -> "dir/<prefix>x.<suffix>" */
+static char *prefixed(const char *file, const char *prefix, const char *suffix)
+{
+	assert(file);
+	assert(prefix);
+	assert(suffix);
+	const char *slash = strrchr(file, '/');
+	const char *base = slash ? slash + 1 : file;
+	char *name = allocate(strlen(file) + strlen(prefix) + 1);
+	memcpy(name, file, base - file);
+	strcat(name, prefix);
+	strcat(name, base);
+	char *r = replace_file_type(name, suffix);
+	free(name);
+	return r;
+}
+
+static unsigned parse_unsigned(const char *arg)
+{
+	assert(arg);
+	char *end = NULL;
+	const unsigned long t = strtoul(arg, &end, 10);
+	if(!*arg || *end)
+		error("invalid number: %s", arg);
+	return t;
+}
+
+static int parse_file(const char *name, unsigned threads, bool memoize, dbc_t **dbc)
+{
+	assert(name);
+	assert(dbc);
+	*dbc = NULL;
+	if(image_is(name)) {
+		image_t img;
+		profile_time_t start = profile_now();
+		const int opened = image_open(name, &img);
+		profile_phase(PROFILE_SLURP, start);
+		if(opened < 0)
+			return -1;
+		start = profile_now();
+		*dbc = image2dbc(&img);
+		profile_phase(PROFILE_CONVERT, start);
+		start = profile_now();
+		image_close(&img);
+		profile_phase(PROFILE_FREE, start);
+		return 0;
+	}
+	/* the chunked parse never builds an AST for the whole file */
+	if(threads != 1 && !memoize && !verbose(LOG_DEBUG))
+		return parse_dbc_file_parallel(name, threads, dbc);
+
+	mpc_ast_arena_t *arena = mpc_ast_arena_new();
+	mpc_memo_t *memo = memoize ? mpc_memo_new(MEMO_MAX_BYTES) : NULL;
+	mpc_ast_t *ast = parse_dbc_file_by_name(name, arena, memo);
+	if(memo && verbose(LOG_DEBUG))
+		mpc_memo_print_to(memo, stderr);
+	profile_time_t start = profile_now();
+	mpc_memo_delete(memo);
+	profile_phase(PROFILE_FREE, start);
+	if(ast) {
+		if(verbose(LOG_DEBUG))
+			mpc_ast_print(ast);
+		start = profile_now();
+		*dbc = ast2dbc(ast, arena);
+		profile_phase(PROFILE_CONVERT, start);
+	}
+	start = profile_now();
+	profile_arena(arena);
+	mpc_ast_arena_delete(arena);
+	profile_phase(PROFILE_FREE, start);
+	return ast ? 0 : -1;
+}
+
+typedef struct {
+	conversion_type_e convert;
+	const char *outdir;
+	dbc2c_options_t copts;
+	unsigned threads; /**< threads to parse each file with */
+	bool memoize;
+	bool buffer;      /**< buffer the messages about each file */
+	bool incremental; /**< only write outputs that have changed */
+	char **files;
+	profile_t *profiles; /**< one per file if profiling, else NULL */
+} dbcc_options_t;
+
+static int dbc2cWrapper(dbc_t *dbc, const char *dbc_file, const char *file_only, dbc2c_options_t *copts, bool incremental)
 {
 	assert(dbc);
 	assert(dbc_file);
@@ -86,73 +195,212 @@ static int dbc2cWrapper(dbc_t *dbc, const char *dbc_file, const char *file_only,
 	char *cname = replace_file_type(dbc_file,  "c");
 	char *hname = replace_file_type(dbc_file,  "h");
 	char *fname = replace_file_type(file_only, "h");
-	FILE *c = fopen_or_die(cname, "wb");
-	FILE *h = fopen_or_die(hname, "wb");
-	const int r = dbc2c(dbc, c, h, fname, copts);
-	fclose(c);
-	fclose(h);
+	output_t *c = output_open(cname, incremental);
+	output_t *h = output_open(hname, incremental);
+	output_t **shards = allocate(sizeof(*shards) * (copts->split + 1));
+	FILE **files = allocate(sizeof(*files) * (copts->split + 1));
+	for(unsigned i = 0; i < copts->split; i++) {
+		char suffix[32];
+		snprintf(suffix, sizeof(suffix), "%u.c", i);
+		char *sname = replace_file_type(cname, suffix);
+		sname[strlen(cname) - 2] = '_'; /* "x.c" -> "x_0.c" */
+		shards[i] = output_open(sname, incremental);
+		files[i] = shards[i]->file;
+		free(sname);
+	}
+	int r = dbc2c(dbc, c->file, h->file, files, fname, copts);
+	if(copts->generate_bench) {
+		char *bname = prefixed(dbc_file, "bench_", "c");
+		output_t *b = output_open(bname, incremental);
+		if(dbc2c_bench(dbc, b->file, fname, copts) < 0)
+			r = -1;
+		if(output_close(b) < 0)
+			r = -1;
+		free(bname);
+	}
+	if(copts->generate_filters) {
+		char *ffname = prefixed(dbc_file, "filters_", "h");
+		output_t *f = output_open(ffname, incremental);
+		if(dbc2c_filters(dbc, f->file, fname, copts) < 0)
+			r = -1;
+		if(output_close(f) < 0)
+			r = -1;
+		free(ffname);
+	}
+	if(output_close(c) < 0)
+		r = -1;
+	if(output_close(h) < 0)
+		r = -1;
+	for(unsigned i = 0; i < copts->split; i++)
+		if(output_close(shards[i]) < 0)
+			r = -1;
+	free(shards);
+	free(files);
 	free(cname);
 	free(hname);
 	free(fname);
 	return r;
 }
 
-static int dbc2xmlWrapper(dbc_t *dbc, const char *dbc_file, bool use_time_stamps)
+static int dbc2xmlWrapper(dbc_t *dbc, const char *dbc_file, bool use_time_stamps, bool incremental)
 {
 	assert(dbc);
 	assert(dbc_file);
 	char *name = replace_file_type(dbc_file, "xml");
-	FILE *o = fopen_or_die(name, "wb");
-	const int r = dbc2xml(dbc, o, use_time_stamps);
-	fclose(o);
+	output_t *o = output_open(name, incremental);
+	int r = dbc2xml(dbc, o->file, use_time_stamps);
+	if(output_close(o) < 0)
+		r = -1;
 	free(name);
 	return r;
 }
 
-static int dbc2csvWrapper(dbc_t *dbc, const char *dbc_file)
+static int dbc2csvWrapper(dbc_t *dbc, const char *dbc_file, bool incremental)
 {
 	assert(dbc);
 	assert(dbc_file);
 	char *name = replace_file_type(dbc_file, "csv");
-	FILE *o = fopen_or_die(name, "wb");
-	const int r = dbc2csv(dbc, o);
-	fclose(o);
+	output_t *o = output_open(name, incremental);
+	int r = dbc2csv(dbc, o->file);
+	if(output_close(o) < 0)
+		r = -1;
 	free(name);
 	return r;
 }
 
-static int dbc2bsmWrapper(dbc_t *dbc, const char *dbc_file, bool use_time_stamps)
+static int dbc2bsmWrapper(dbc_t *dbc, const char *dbc_file, bool use_time_stamps, bool incremental)
 {
 	assert(dbc);
 	assert(dbc_file);
 	char *name = replace_file_type(dbc_file, "bsm");
-	FILE *o = fopen_or_die(name, "wb");
-	const int r = dbc2bsm(dbc, o, use_time_stamps);
-	fclose(o);
+	output_t *o = output_open(name, incremental);
+	int r = dbc2bsm(dbc, o->file, use_time_stamps);
+	if(output_close(o) < 0)
+		r = -1;
 	free(name);
 	return r;
 }
 
-static int dbc2jsonWrapper(dbc_t *dbc, const char *dbc_file, bool use_time_stamps)
+static int dbc2jsonWrapper(dbc_t *dbc, const char *dbc_file, bool use_time_stamps, bool incremental)
 {
 	assert(dbc);
 	assert(dbc_file);
 	char *name = replace_file_type(dbc_file, "json");
-	FILE *o = fopen_or_die(name, "wb");
-	const int r = dbc2json(dbc, o, use_time_stamps);
-	fclose(o);
+	output_t *o = output_open(name, incremental);
+	int r = dbc2json(dbc, o->file, use_time_stamps);
+	if(output_close(o) < 0)
+		r = -1;
 	free(name);
 	return r;
 }
 
+static int dbc2binWrapper(dbc_t *dbc, const char *dbc_file, bool incremental)
+{
+	assert(dbc);
+	assert(dbc_file);
+	char *name = replace_file_type(dbc_file, "dbcb");
+	output_t *o = output_open(name, incremental);
+	int r = dbc2bin(dbc, o->file);
+	if(output_close(o) < 0)
+		r = -1;
+	free(name);
+	return r;
+}
+
+static int process_file(const dbcc_options_t *o, char *file)
+{
+	assert(o);
+	assert(file);
+	debug("reading => %s", file);
+	dbc_t *dbc = NULL;
+	if(parse_file(file, o->threads, o->memoize, &dbc) < 0) {
+		warning("could not parse file '%s'", file);
+		return -1;
+	}
+	if(!dbc) {
+		warning("could not convert file '%s'", file);
+		return -1;
+	}
+	profile_model(dbc);
+
+	char *outpath = dbcc_basename(file);
+	if(o->outdir) {
+		outpath = allocate(strlen(outpath) + strlen(o->outdir) + 2 /* '/' + '\0'*/);
+		strcat(outpath, o->outdir);
+		strcat(outpath, "/");
+		strcat(outpath, dbcc_basename(file));
+	}
+
+	int r = 0;
+	dbc2c_options_t copts = o->copts;
+	profile_time_t start = profile_now();
+	switch(o->convert) {
+	case CONVERT_TO_C:
+		r = dbc2cWrapper(dbc, outpath, dbcc_basename(file), &copts, o->incremental);
+		break;
+	case CONVERT_TO_XML:
+		r = dbc2xmlWrapper(dbc, outpath, o->copts.use_time_stamps, o->incremental);
+		break;
+	case CONVERT_TO_CSV:
+		if(o->copts.use_time_stamps)
+			error("Cannot use time stamps when specifying CSV option");
+		r = dbc2csvWrapper(dbc, outpath, o->incremental);
+		break;
+	case CONVERT_TO_BSM:
+		r = dbc2bsmWrapper(dbc, outpath, o->copts.use_time_stamps, o->incremental);
+		break;
+	case CONVERT_TO_JSON:
+		r = dbc2jsonWrapper(dbc, outpath, o->copts.use_time_stamps, o->incremental);
+		break;
+	case CONVERT_TO_BIN:
+		r = dbc2binWrapper(dbc, outpath, o->incremental);
+		break;
+	default:
+		error("invalid conversion type: %d", o->convert);
+	}
+	profile_phase(PROFILE_BACKEND, start);
+	if(r < 0)
+		warning("conversion process failed: %u/%u", r, o->convert);
+
+	if(o->outdir)
+		free(outpath);
+	start = profile_now();
+	dbc_delete(dbc);
+	profile_phase(PROFILE_FREE, start);
+	return r;
+}
+
+static void process_file_job(void *context, size_t index, unsigned worker)
+{
+	UNUSED(worker);
+	const dbcc_options_t *o = context;
+	profile_t *p = o->profiles ? &o->profiles[index] : NULL;
+	if(o->buffer)
+		log_buffer_begin();
+	if(p)
+		profile_begin(p, o->files[index]);
+	const int r = process_file(o, o->files[index]);
+	if(p) {
+		profile_end(p);
+		p->failed = r < 0;
+	}
+	if(o->buffer)
+		log_buffer_end();
+}
+
 int main(int argc, char **argv)
 {
 	log_level_e log_level = get_log_level();
 	conversion_type_e convert = CONVERT_TO_C;
 	const char *outdir = NULL;
+	bool memoize = false, incremental = false;
+	const char *profile = NULL;
+	unsigned threads = 0, jobs = 1, percent = 0;
+	bool threads_set = false;
 	dbc2c_options_t copts = {
 		.use_time_stamps           =  false,
 		.use_doubles_for_encoding  =  false,
+		.time_stamp_ns             =  false,
 		.generate_print            =  false,
 		.generate_pack             =  false,
 		.generate_unpack           =  false,
@@ -160,7 +408,7 @@ int main(int argc, char **argv)
 	};
 	int opt = 0;
 
-	while ((opt = dbcc_getopt(argc, argv, "hvbjgxCtDpukso:")) != -1) {
+	while ((opt = dbcc_getopt(argc, argv, "hvbjgxCctDnpuksmiBfT:J:S:P:R:M:o:")) != -1) {
 		switch (opt) {
 		case 'h':
 			usage(argv[0]);
@@ -184,6 +432,9 @@ int main(int argc, char **argv)
 		case 'C':
 			convert = CONVERT_TO_CSV;
 			break;
+		case 'c':
+			convert = CONVERT_TO_BIN;
+			break;
 		case 't':
 			copts.use_time_stamps = true;
 			debug("using time stamps");
@@ -192,6 +443,10 @@ int main(int argc, char **argv)
 			copts.use_doubles_for_encoding = true;
 			debug("using doubles for encoding");
 			break;
+		case 'n':
+			copts.time_stamp_ns = true;
+			debug("using 64-bit nanosecond time stamps");
+			break;
 		case 'p':
 			copts.generate_print = true;
 			debug("generate code for print");
@@ -212,6 +467,55 @@ int main(int argc, char **argv)
 			copts.generate_asserts = false;
 			debug("asserts disabled - apparently you think silent corruption is a good thing", outdir);
 			break;
+		case 'm':
+			memoize = true;
+			debug("memoizing parser results");
+			break;
+		case 'B':
+			copts.generate_bench = true;
+			debug("generating a benchmark");
+			break;
+		case 'f':
+			copts.generate_filters = true;
+			debug("generating receive filters");
+			break;
+		case 'R':
+			percent = parse_unsigned(dbcc_optarg);
+			if(percent > 100)
+				error("invalid percentage (0-100): %s", dbcc_optarg);
+			copts.filter_rate = percent / 100.0;
+			copts.generate_filters = true;
+			debug("filters may pass %u%% unwanted messages", percent);
+			break;
+		case 'M':
+			copts.manifests = reallocator(copts.manifests, sizeof(*copts.manifests) * (copts.manifest_count + 1));
+			copts.manifests[copts.manifest_count++] = dbcc_optarg;
+			copts.generate_filters = true;
+			debug("filters for manifest: %s", dbcc_optarg);
+			break;
+		case 'i':
+			incremental = true;
+			debug("only writing changed files");
+			break;
+		case 'T':
+			threads = parse_unsigned(dbcc_optarg);
+			threads_set = true;
+			debug("parsing threads: %u", threads);
+			break;
+		case 'J':
+			jobs = parse_unsigned(dbcc_optarg);
+			debug("file jobs: %u", jobs);
+			break;
+		case 'S':
+			copts.split = parse_unsigned(dbcc_optarg);
+			debug("split into files: %u", copts.split);
+			break;
+		case 'P':
+			profile = dbcc_optarg;
+			if(strcmp(profile, "table") && strcmp(profile, "json"))
+				error("invalid profile format (expected 'table' or 'json'): %s", profile);
+			debug("profiling: %s", profile);
+			break;
 		default:
 			fprintf(stderr, "invalid options\n");
 			usage(argv[0]);
@@ -226,57 +530,34 @@ int main(int argc, char **argv)
 		copts.generate_unpack = true;
 	}
 
-	for(int i = dbcc_optind; i < argc; i++) {
-		debug("reading => %s", argv[i]);
-		mpc_ast_t *ast = parse_dbc_file_by_name(argv[i]);
-		if(!ast) {
-			warning("could not parse file '%s'", argv[i]);
-			continue;
-		}
-		if(verbose(LOG_DEBUG))
-			mpc_ast_print(ast);
-
-		dbc_t *dbc = ast2dbc(ast);
-
-		char *outpath = dbcc_basename(argv[i]);
-		if(outdir) {
-			outpath = allocate(strlen(outpath) + strlen(outdir) + 2 /* '/' + '\0'*/);
-			strcat(outpath, outdir);
-			strcat(outpath, "/");
-			strcat(outpath, dbcc_basename(argv[i]));
-		}
+	if(profile && jobs != 1) {
+		note("profiling, processing one file at a time");
+		jobs = 1;
+	}
+	if(jobs != 1 && !threads_set)
+		threads = 1; /* the files are the unit of parallelism */
+	copts.threads = threads;
 
-		int r = 0;
-		switch(convert) {
-		case CONVERT_TO_C:
-			r = dbc2cWrapper(dbc, outpath, dbcc_basename(argv[i]), &copts);
-			break;
-		case CONVERT_TO_XML:
-			r = dbc2xmlWrapper(dbc, outpath, copts.use_time_stamps);
-			break;
-		case CONVERT_TO_CSV:
-			if(copts.use_time_stamps)
-				error("Cannot use time stamps when specifying CSV option");
-			r = dbc2csvWrapper(dbc, outpath);
-			break;
-		case CONVERT_TO_BSM:
-			r = dbc2bsmWrapper(dbc, outpath, copts.use_time_stamps);
-			break;
-		case CONVERT_TO_JSON:
-			r = dbc2jsonWrapper(dbc, outpath, copts.use_time_stamps);
-			break;
-		default:
-			error("invalid conversion type: %d", convert);
-		}
-		if(r < 0)
-			warning("conversion process failed: %u/%u", r, convert);
+	dbcc_options_t o = {
+		.convert     = convert,
+		.outdir      = outdir,
+		.copts       = copts,
+		.threads     = threads,
+		.memoize     = memoize,
+		.buffer      = jobs != 1,
+		.incremental = incremental,
+		.files       = argv + dbcc_optind,
+	};
+	const size_t files = argc - dbcc_optind;
+	if(profile)
+		o.profiles = allocate(sizeof(*o.profiles) * (files + 1));
+	pool_run(files, jobs, process_file_job, &o);
 
-		if(outdir)
-			free(outpath);
-		dbc_delete(dbc);
-		mpc_ast_delete(ast);
+	int r = 0;
+	if(profile) {
+		r = profile_print(stdout, o.profiles, files, !strcmp(profile, "json")) < 0;
+		free(o.profiles);
 	}
-
-	return 0;
+	free(copts.manifests);
+	return r;
 }
-
@@ -98,6 +98,9 @@ typedef struct {
   char mem_full[MPC_INPUT_MEM_NUM];
   mpc_mem_t mem[MPC_INPUT_MEM_NUM];
 
+  mpc_ast_arena_t *arena;
+  mpc_memo_t *memo;
+
 } mpc_input_t;
 
 static mpc_input_t *mpc_input_new_string(const char *filename, const char *string) {
@@ -125,6 +128,8 @@ static mpc_input_t *mpc_input_new_string(const char *filename, const char *strin
 
   i->mem_index = 0;
   memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  i->arena = NULL;
+  i->memo = NULL;
 
   return i;
 }
@@ -155,6 +160,8 @@ static mpc_input_t *mpc_input_new_nstring(const char *filename, const char *stri
 
   i->mem_index = 0;
   memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  i->arena = NULL;
+  i->memo = NULL;
 
   return i;
 
@@ -184,6 +191,8 @@ static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
 
   i->mem_index = 0;
   memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  i->arena = NULL;
+  i->memo = NULL;
 
   return i;
 
@@ -212,6 +221,8 @@ static mpc_input_t *mpc_input_new_file(const char *filename, FILE *file) {
 
   i->mem_index = 0;
   memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  i->arena = NULL;
+  i->memo = NULL;
 
   return i;
 }
@@ -364,7 +375,7 @@ static char mpc_input_buffer_get(mpc_input_t *i) {
 }
 
 static int mpc_input_terminated(mpc_input_t *i) {
-  if (i->type == MPC_INPUT_STRING && i->state.pos == (long)strlen(i->string)) { return 1; }
+  if (i->type == MPC_INPUT_STRING && i->string[i->state.pos] == '\0') { return 1; }
   if (i->type == MPC_INPUT_FILE && feof(i->file)) { return 1; }
   if (i->type == MPC_INPUT_PIPE && feof(i->file)) { return 1; }
   return 0;
@@ -594,9 +605,8 @@ static void mpc_err_string_cat(char *buffer, int *pos, int *max, char const *fmt
   va_end(va);
 }
 
-static char char_unescape_buffer[4];
-
-static const char *mpc_err_char_unescape(char c) {
+/* 'char_unescape_buffer' is supplied by the caller so this is reentrant */
+static const char *mpc_err_char_unescape(char c, char char_unescape_buffer[4]) {
 
   char_unescape_buffer[0] = '\'';
   char_unescape_buffer[1] = ' ';
@@ -626,6 +636,7 @@ char *mpc_err_string(mpc_err_t *x) {
   int pos = 0;
   int max = 1023;
   char *buffer = calloc(1, 1024);
+  char unescaped[4];
 
   if (x->failure) {
     mpc_err_string_cat(buffer, &pos, &max,
@@ -650,7 +661,7 @@ char *mpc_err_string(mpc_err_t *x) {
   }
 
   mpc_err_string_cat(buffer, &pos, &max, " at ");
-  mpc_err_string_cat(buffer, &pos, &max, mpc_err_char_unescape(x->recieved));
+  mpc_err_string_cat(buffer, &pos, &max, mpc_err_char_unescape(x->recieved, unescaped));
   mpc_err_string_cat(buffer, &pos, &max, "\n");
 
   return realloc(buffer, strlen(buffer) + 1);
@@ -955,6 +966,281 @@ struct mpc_parser_t {
   char retained;
 };
 
+/*
+** AST Arena
+**
+** Parsing a large input with the default AST
+** functions performs a `malloc` for every node,
+** tag and contents string, and a `realloc` for
+** every child added. In arena mode all of these
+** come from large blocks which are carved up by
+** bumping a pointer. Nothing is ever freed on
+** its own - nodes thrown away by backtracking
+** stay in the arena - and the whole lot goes in
+** a single call to `mpc_ast_arena_delete`.
+**
+** Tags are interned as they are built, every
+** distinct tag string is stored once and given
+** a small integer id which is recorded in the
+** node. Lookups by id then compare integers
+** instead of calling `strcmp` on every child.
+*/
+
+enum {
+  MPC_AST_ARENA_BLOCK = 64 * 1024,
+  MPC_AST_ARENA_TAGS_MIN = 64
+};
+
+typedef union {
+  long l;
+  double d;
+  void *p;
+} mpc_ast_arena_align_t;
+
+typedef struct mpc_ast_arena_block_t {
+  struct mpc_ast_arena_block_t *next;
+  size_t used;
+  size_t size;
+  mpc_ast_arena_align_t data[1];
+} mpc_ast_arena_block_t;
+
+struct mpc_ast_arena_t {
+  mpc_ast_arena_block_t *head;
+  int tags_num;
+  int tags_slots;
+  char **tags;
+  int *tags_hash;
+  char *scratch;
+  size_t scratch_slots;
+  size_t nodes;
+  size_t bytes;
+};
+
+mpc_ast_arena_t *mpc_ast_arena_new(void) {
+  int j;
+  mpc_ast_arena_t *a = malloc(sizeof(mpc_ast_arena_t));
+  a->head = NULL;
+  a->tags_num = 0;
+  a->tags_slots = MPC_AST_ARENA_TAGS_MIN;
+  a->tags = malloc(sizeof(char*) * a->tags_slots);
+  a->tags_hash = malloc(sizeof(int) * a->tags_slots * 2);
+  for (j = 0; j < a->tags_slots * 2; j++) { a->tags_hash[j] = -1; }
+  a->scratch_slots = 128;
+  a->scratch = malloc(a->scratch_slots);
+  a->nodes = 0;
+  a->bytes = 0;
+  return a;
+}
+
+size_t mpc_ast_arena_nodes(const mpc_ast_arena_t *a) { return a->nodes; }
+size_t mpc_ast_arena_bytes(const mpc_ast_arena_t *a) { return a->bytes; }
+
+void mpc_ast_arena_delete(mpc_ast_arena_t *a) {
+  mpc_ast_arena_block_t *b, *n;
+  if (a == NULL) { return; }
+  for (b = a->head; b; b = n) {
+    n = b->next;
+    free(b);
+  }
+  free(a->tags);
+  free(a->tags_hash);
+  free(a->scratch);
+  free(a);
+}
+
+static void *mpc_ast_arena_alloc(mpc_ast_arena_t *a, size_t n) {
+
+  mpc_ast_arena_block_t *b = a->head;
+  size_t size;
+  char *p;
+
+  n = (n + sizeof(mpc_ast_arena_align_t) - 1) & ~(sizeof(mpc_ast_arena_align_t) - 1);
+
+  if (b == NULL || b->size - b->used < n) {
+    size = n > MPC_AST_ARENA_BLOCK ? n : MPC_AST_ARENA_BLOCK;
+    b = malloc(sizeof(mpc_ast_arena_block_t) + size);
+    a->bytes += sizeof(mpc_ast_arena_block_t) + size;
+    b->used = 0;
+    b->size = size;
+    /* An oversized allocation is put behind the current head so the
+    ** remainder of the current block can still be used. */
+    if (a->head && n > MPC_AST_ARENA_BLOCK) {
+      b->next = a->head->next;
+      a->head->next = b;
+    } else {
+      b->next = a->head;
+      a->head = b;
+    }
+  }
+
+  p = (char*)b->data + b->used;
+  b->used += n;
+  return p;
+}
+
+static char *mpc_ast_arena_strdup(mpc_ast_arena_t *a, const char *s) {
+  size_t l = strlen(s) + 1;
+  char *r = mpc_ast_arena_alloc(a, l);
+  memcpy(r, s, l);
+  return r;
+}
+
+static unsigned long mpc_ast_arena_hash(const char *s) {
+  unsigned long h = 2166136261ul;
+  while (*s) { h = (h ^ (unsigned char)*s++) * 16777619ul; }
+  return h;
+}
+
+static int mpc_ast_arena_find(mpc_ast_arena_t *a, const char *tag, unsigned long h) {
+  int m = a->tags_slots * 2;
+  int j = (int)(h % (unsigned long)m);
+  while (a->tags_hash[j] >= 0) {
+    if (strcmp(a->tags[a->tags_hash[j]], tag) == 0) { return j; }
+    j = (j + 1) % m;
+  }
+  return j;
+}
+
+/* Returns the id of `tag`, adding it to the table if it is new */
+static int mpc_ast_arena_intern(mpc_ast_arena_t *a, const char *tag) {
+
+  int j, k, id, m;
+  unsigned long h = mpc_ast_arena_hash(tag);
+
+  j = mpc_ast_arena_find(a, tag, h);
+  if (a->tags_hash[j] >= 0) { return a->tags_hash[j]; }
+
+  if (a->tags_num == a->tags_slots) {
+    a->tags_slots *= 2;
+    a->tags = realloc(a->tags, sizeof(char*) * a->tags_slots);
+    m = a->tags_slots * 2;
+    a->tags_hash = realloc(a->tags_hash, sizeof(int) * m);
+    for (k = 0; k < m; k++) { a->tags_hash[k] = -1; }
+    for (k = 0; k < a->tags_num; k++) {
+      a->tags_hash[mpc_ast_arena_find(a, a->tags[k], mpc_ast_arena_hash(a->tags[k]))] = k;
+    }
+    j = mpc_ast_arena_find(a, tag, h);
+  }
+
+  id = a->tags_num++;
+  a->tags[id] = mpc_ast_arena_strdup(a, tag);
+  a->tags_hash[j] = id;
+  return id;
+}
+
+static void mpc_ast_arena_set_tag(mpc_ast_arena_t *a, mpc_ast_t *n, const char *tag) {
+  n->tag_id = mpc_ast_arena_intern(a, tag);
+  n->tag = a->tags[n->tag_id];
+}
+
+/* Tags are built up front to back, `scratch` holds the result until it is interned */
+static char *mpc_ast_arena_scratch(mpc_ast_arena_t *a, size_t n) {
+  if (n > a->scratch_slots) {
+    a->scratch_slots = n;
+    a->scratch = realloc(a->scratch, a->scratch_slots);
+  }
+  return a->scratch;
+}
+
+int mpc_ast_arena_tag(mpc_ast_arena_t *a, const char *tag) {
+  int j = mpc_ast_arena_find(a, tag, mpc_ast_arena_hash(tag));
+  return a->tags_hash[j];
+}
+
+static mpc_ast_t *mpc_ast_arena_node(mpc_ast_arena_t *a, const char *tag, const char *contents) {
+  mpc_ast_t *r = mpc_ast_arena_alloc(a, sizeof(mpc_ast_t));
+  a->nodes++;
+  mpc_ast_arena_set_tag(a, r, tag);
+  r->contents = mpc_ast_arena_strdup(a, contents);
+  r->state = mpc_state_new();
+  r->children_num = 0;
+  r->children = NULL;
+  return r;
+}
+
+static mpc_val_t *mpcf_input_fold_ast(mpc_input_t *i, int n, mpc_val_t **xs) {
+
+  int j, k, m = 0;
+  mpc_ast_t **as = (mpc_ast_t**)xs;
+  mpc_ast_t *r, *c;
+  size_t tl, cl;
+  char *tag;
+
+  if (n == 0) { return NULL; }
+  if (n == 1) { return xs[0]; }
+  if (n == 2 && xs[1] == NULL) { return xs[0]; }
+  if (n == 2 && xs[0] == NULL) { return xs[1]; }
+
+  /* Unlike `mpcf_fold_ast` the number of children is counted up front
+  ** so the children array is allocated exactly once. */
+  for (j = 0; j < n; j++) {
+    if (as[j] == NULL) { continue; }
+    m += as[j]->children_num >= 2 ? as[j]->children_num : 1;
+  }
+
+  r = mpc_ast_arena_node(i->arena, ">", "");
+  r->children = m ? mpc_ast_arena_alloc(i->arena, sizeof(mpc_ast_t*) * m) : NULL;
+
+  for (j = 0; j < n; j++) {
+
+    if (as[j] == NULL) { continue; }
+
+    if (as[j]->children_num == 0) {
+      r->children[r->children_num++] = as[j];
+    } else if (as[j]->children_num == 1) {
+      c = as[j]->children[0];
+      tl = strlen(as[j]->tag) - 1;
+      cl = strlen(c->tag) + 1;
+      tag = mpc_ast_arena_scratch(i->arena, tl + cl);
+      memcpy(tag, as[j]->tag, tl);
+      memcpy(tag + tl, c->tag, cl);
+      mpc_ast_arena_set_tag(i->arena, c, tag);
+      r->children[r->children_num++] = c;
+    } else {
+      for (k = 0; k < as[j]->children_num; k++) {
+        r->children[r->children_num++] = as[j]->children[k];
+      }
+    }
+
+  }
+
+  if (r->children_num) {
+    r->state = r->children[0]->state;
+  }
+
+  return r;
+}
+
+static mpc_val_t *mpcf_input_add_root(mpc_input_t *i, mpc_ast_t *a) {
+  mpc_ast_t *r;
+  if (a == NULL) { return a; }
+  if (a->children_num == 0) { return a; }
+  if (a->children_num == 1) { return a; }
+  r = mpc_ast_arena_node(i->arena, ">", "");
+  r->children = mpc_ast_arena_alloc(i->arena, sizeof(mpc_ast_t*));
+  r->children[r->children_num++] = a;
+  return r;
+}
+
+static mpc_val_t *mpcf_input_add_tag(mpc_input_t *i, mpc_ast_t *a, const char *t) {
+  size_t tl, al;
+  char *tag;
+  if (a == NULL) { return a; }
+  tl = strlen(t);
+  al = strlen(a->tag) + 1;
+  tag = mpc_ast_arena_scratch(i->arena, tl + 1 + al);
+  memcpy(tag, t, tl);
+  tag[tl] = '|';
+  memcpy(tag + tl + 1, a->tag, al);
+  mpc_ast_arena_set_tag(i->arena, a, tag);
+  return a;
+}
+
+static mpc_val_t *mpcf_input_tag(mpc_input_t *i, mpc_ast_t *a, const char *t) {
+  mpc_ast_arena_set_tag(i->arena, a, t);
+  return a;
+}
+
 static mpc_val_t *mpcf_input_nth_free(mpc_input_t *i, int n, mpc_val_t **xs, int x) {
   int j;
   for (j = 0; j < n; j++) { if (j != x) { mpc_free(i, xs[j]); } }
@@ -995,6 +1281,7 @@ static mpc_val_t *mpc_parse_fold(mpc_input_t *i, mpc_fold_t f, int n, mpc_val_t
   if (f == mpcf_trd_free)  { return mpcf_input_trd_free(i, n, xs); }
   if (f == mpcf_strfold)   { return mpcf_input_strfold(i, n, xs); }
   if (f == mpcf_state_ast) { return mpcf_input_state_ast(i, n, xs); }
+  if (f == mpcf_fold_ast && i->arena) { return mpcf_input_fold_ast(i, n, xs); }
   for (j = 0; j < n; j++) { xs[j] = mpc_export(i, xs[j]); }
   return f(j, xs);
 }
@@ -1005,7 +1292,7 @@ static mpc_val_t *mpcf_input_free(mpc_input_t *i, mpc_val_t *x) {
 }
 
 static mpc_val_t *mpcf_input_str_ast(mpc_input_t *i, mpc_val_t *c) {
-  mpc_ast_t *a = mpc_ast_new("", c);
+  mpc_ast_t *a = i->arena ? mpc_ast_arena_node(i->arena, "", c) : mpc_ast_new("", c);
   mpc_free(i, c);
   return a;
 }
@@ -1013,18 +1300,282 @@ static mpc_val_t *mpcf_input_str_ast(mpc_input_t *i, mpc_val_t *c) {
 static mpc_val_t *mpc_parse_apply(mpc_input_t *i, mpc_apply_t f, mpc_val_t *x) {
   if (f == mpcf_free)     { return mpcf_input_free(i, x); }
   if (f == mpcf_str_ast)  { return mpcf_input_str_ast(i, x); }
+  if (i->arena && f == (mpc_apply_t)mpc_ast_add_root) { return mpcf_input_add_root(i, x); }
   return f(mpc_export(i, x));
 }
 
 static mpc_val_t *mpc_parse_apply_to(mpc_input_t *i, mpc_apply_to_t f, mpc_val_t *x, mpc_val_t *d) {
+  if (i->arena && f == (mpc_apply_to_t)mpc_ast_tag) { return mpcf_input_tag(i, x, d); }
+  if (i->arena && f == (mpc_apply_to_t)mpc_ast_add_tag) { return mpcf_input_add_tag(i, x, d); }
   return f(mpc_export(i, x), d);
 }
 
 static void mpc_parse_dtor(mpc_input_t *i, mpc_dtor_t d, mpc_val_t *x) {
   if (d == free) { mpc_free(i, x); return; }
+  if (i->arena && d == (mpc_dtor_t)mpc_ast_delete) { return; }
   d(mpc_export(i, x));
 }
 
+/*
+** Packrat Memoization
+**
+** Grammars built with `mpca_lang` can backtrack
+** over the same input many times, re-running a
+** rule at a position it has already been tried
+** at. When parsing with a memo table the result
+** of every named rule (those made with `mpc_new`)
+** is recorded against the input position and
+** replayed on the next attempt, which bounds the
+** work done to the number of (rule, position)
+** pairs.
+**
+** Results are ASTs so this is only active in
+** arena mode; each stored and replayed result is
+** a copy as the caller may retag the nodes it is
+** handed. As most rules are only ever tried once
+** at any position, the first attempt just marks
+** the position as seen and a result is recorded
+** only when the rule is tried there again. Errors raised inside a rule are stored
+** as well, so a failing parse reports much the
+** same error, although the list of alternatives
+** may be in a different order. Once `max_bytes`
+** is used no further results are recorded.
+*/
+
+enum {
+  MPC_MEMO_SLOTS_MIN = 1024,
+  MPC_MEMO_RULES_MAX = 256
+};
+
+typedef struct {
+  int success;
+  mpc_state_t end;
+  char last;
+  mpc_ast_t *output;
+  mpc_err_t *error;
+  mpc_err_t *inner;
+} mpc_memo_result_t;
+
+typedef struct {
+  mpc_parser_t *p;
+  long pos;
+  int flags;
+  mpc_memo_result_t *result; /* NULL if the position has only been seen */
+} mpc_memo_entry_t;
+
+typedef struct {
+  mpc_parser_t *p;
+  char *name; /* copied, the parser may be gone before the statistics are printed */
+  unsigned long hits;
+  unsigned long misses;
+} mpc_memo_rule_t;
+
+struct mpc_memo_t {
+  size_t max_bytes;
+  size_t bytes;
+  unsigned long dropped;
+  int entries_num;
+  int recorded_num;
+  int entries_slots;
+  mpc_memo_entry_t *entries;
+  mpc_memo_rule_t rules[MPC_MEMO_RULES_MAX];
+};
+
+static mpc_err_t *mpc_err_copy(mpc_err_t *x, size_t *bytes) {
+  int j;
+  mpc_err_t *c;
+  if (x == NULL) { return NULL; }
+  c = malloc(sizeof(mpc_err_t));
+  *c = *x;
+  c->filename = malloc(strlen(x->filename) + 1);
+  strcpy(c->filename, x->filename);
+  c->failure = NULL;
+  if (x->failure) {
+    c->failure = malloc(strlen(x->failure) + 1);
+    strcpy(c->failure, x->failure);
+  }
+  c->expected = x->expected_num ? malloc(sizeof(char*) * x->expected_num) : NULL;
+  for (j = 0; j < x->expected_num; j++) {
+    c->expected[j] = malloc(strlen(x->expected[j]) + 1);
+    strcpy(c->expected[j], x->expected[j]);
+    *bytes += strlen(x->expected[j]) + 1 + sizeof(char*);
+  }
+  *bytes += sizeof(mpc_err_t) + strlen(x->filename) + 1;
+  return c;
+}
+
+static mpc_ast_t *mpc_ast_arena_copy(mpc_ast_arena_t *a, mpc_ast_t *x, size_t *bytes) {
+  int j;
+  mpc_ast_t *c;
+  if (x == NULL) { return NULL; }
+  /* Tags are interned and contents never change, so both are shared */
+  c = mpc_ast_arena_alloc(a, sizeof(mpc_ast_t));
+  a->nodes++;
+  *c = *x;
+  *bytes += sizeof(mpc_ast_t);
+  if (x->children_num) {
+    c->children = mpc_ast_arena_alloc(a, sizeof(mpc_ast_t*) * x->children_num);
+    *bytes += sizeof(mpc_ast_t*) * x->children_num;
+    for (j = 0; j < x->children_num; j++) {
+      c->children[j] = mpc_ast_arena_copy(a, x->children[j], bytes);
+    }
+  }
+  return c;
+}
+
+mpc_memo_t *mpc_memo_new(size_t max_bytes) {
+  mpc_memo_t *m = calloc(1, sizeof(mpc_memo_t));
+  m->max_bytes = max_bytes;
+  m->entries_slots = MPC_MEMO_SLOTS_MIN;
+  m->entries = calloc(m->entries_slots, sizeof(mpc_memo_entry_t));
+  m->bytes = sizeof(mpc_memo_t) + sizeof(mpc_memo_entry_t) * m->entries_slots;
+  return m;
+}
+
+void mpc_memo_delete(mpc_memo_t *m) {
+  int j;
+  if (m == NULL) { return; }
+  for (j = 0; j < m->entries_slots; j++) {
+    if (m->entries[j].result == NULL) { continue; }
+    if (m->entries[j].result->error) { mpc_err_delete(m->entries[j].result->error); }
+    if (m->entries[j].result->inner) { mpc_err_delete(m->entries[j].result->inner); }
+    free(m->entries[j].result);
+  }
+  for (j = 0; j < MPC_MEMO_RULES_MAX; j++) { free(m->rules[j].name); }
+  free(m->entries);
+  free(m);
+}
+
+void mpc_memo_print_to(mpc_memo_t *m, FILE *f) {
+  int j;
+  unsigned long hits = 0, misses = 0;
+  fprintf(f, "%-24s %12s %12s\n", "rule", "hits", "misses");
+  for (j = 0; j < MPC_MEMO_RULES_MAX; j++) {
+    if (m->rules[j].p == NULL) { continue; }
+    fprintf(f, "%-24s %12lu %12lu\n", m->rules[j].name, m->rules[j].hits, m->rules[j].misses);
+    hits += m->rules[j].hits;
+    misses += m->rules[j].misses;
+  }
+  fprintf(f, "%-24s %12lu %12lu\n", "total", hits, misses);
+  fprintf(f, "entries %d, results %d, bytes %lu/%lu, not recorded %lu\n", m->entries_num,
+    m->recorded_num, (unsigned long)m->bytes, (unsigned long)m->max_bytes, m->dropped);
+}
+
+static unsigned long mpc_memo_hash(mpc_parser_t *p, long pos, int flags) {
+  unsigned long h = (unsigned long)(size_t)p;
+  h ^= h >> 17;
+  h = h * 31 + (unsigned long)pos;
+  h = h * 31 + (unsigned long)flags;
+  return h * 2654435761ul;
+}
+
+static mpc_memo_entry_t *mpc_memo_slot(mpc_memo_t *m, mpc_parser_t *p, long pos, int flags) {
+  int j = (int)(mpc_memo_hash(p, pos, flags) % (unsigned long)m->entries_slots);
+  while (m->entries[j].p) {
+    if (m->entries[j].p == p && m->entries[j].pos == pos && m->entries[j].flags == flags) { break; }
+    j = (j + 1) % m->entries_slots;
+  }
+  return &m->entries[j];
+}
+
+static mpc_memo_rule_t *mpc_memo_rule(mpc_memo_t *m, mpc_parser_t *p) {
+  int j = (int)(mpc_memo_hash(p, 0, 0) % MPC_MEMO_RULES_MAX), k;
+  for (k = 0; k < MPC_MEMO_RULES_MAX; k++, j = (j + 1) % MPC_MEMO_RULES_MAX) {
+    if (m->rules[j].p == p) { return &m->rules[j]; }
+    if (m->rules[j].p == NULL) {
+      m->rules[j].p = p;
+      m->rules[j].name = malloc(strlen(p->name) + 1);
+      strcpy(m->rules[j].name, p->name);
+      return &m->rules[j];
+    }
+  }
+  return NULL;
+}
+
+static int mpc_memo_grow(mpc_memo_t *m) {
+  int j, slots = m->entries_slots;
+  size_t bytes = sizeof(mpc_memo_entry_t) * slots;
+  mpc_memo_entry_t *old = m->entries, *e;
+  if (m->bytes + bytes * 2 > m->max_bytes) { return 0; }
+  m->entries_slots = slots * 2;
+  m->entries = calloc(m->entries_slots, sizeof(mpc_memo_entry_t));
+  m->bytes += bytes;
+  for (j = 0; j < slots; j++) {
+    if (old[j].p == NULL) { continue; }
+    e = mpc_memo_slot(m, old[j].p, old[j].pos, old[j].flags);
+    *e = old[j];
+  }
+  free(old);
+  return 1;
+}
+
+static int mpc_parse_step(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e);
+
+static int mpc_parse_memo(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e) {
+
+  mpc_memo_t *m = i->memo;
+  mpc_memo_rule_t *rule = mpc_memo_rule(m, p);
+  mpc_memo_entry_t *t;
+  mpc_memo_result_t *q;
+  mpc_err_t *inner = NULL;
+  size_t bytes = 0;
+  long pos = i->state.pos;
+  int flags = (i->suppress > 0) | ((i->backtrack > 0) << 1);
+  int x;
+
+  t = mpc_memo_slot(m, p, pos, flags);
+
+  if (t->result) {
+    q = t->result;
+    if (rule) { rule->hits++; }
+    i->state = q->end;
+    i->last = q->last;
+    if (q->inner) { *e = mpc_err_merge(i, *e, mpc_err_copy(q->inner, &bytes)); }
+    if (q->success) {
+      r->output = mpc_ast_arena_copy(i->arena, q->output, &bytes);
+    } else {
+      r->error = mpc_err_copy(q->error, &bytes);
+    }
+    return q->success;
+  }
+
+  if (rule) { rule->misses++; }
+
+  x = mpc_parse_step(i, p, r, &inner);
+
+  /* The recursive call may have grown the table */
+  t = mpc_memo_slot(m, p, pos, flags);
+  if (t->p == NULL) {
+    if (m->entries_num * 2 >= m->entries_slots) {
+      if (!mpc_memo_grow(m)) {
+        m->dropped++;
+        goto done;
+      }
+      t = mpc_memo_slot(m, p, pos, flags);
+    }
+    t->p = p;
+    t->pos = pos;
+    t->flags = flags;
+    m->entries_num++;
+  } else if (m->bytes >= m->max_bytes) {
+    m->dropped++;
+  } else {
+    q = t->result = malloc(sizeof(mpc_memo_result_t));
+    m->recorded_num++;
+    q->success = x;
+    q->end = i->state;
+    q->last = i->last;
+    q->output = x ? mpc_ast_arena_copy(i->arena, r->output, &bytes) : NULL;
+    q->error = x ? NULL : mpc_err_copy(r->error, &bytes);
+    q->inner = mpc_err_copy(inner, &bytes);
+    m->bytes += bytes + sizeof(mpc_memo_result_t);
+  }
+
+done:
+  if (inner) { *e = mpc_err_merge(i, *e, inner); }
+  return x;
+}
+
 enum {
   MPC_PARSE_STACK_MIN = 4
 };
@@ -1036,6 +1587,11 @@ enum {
   else { MPC_FAILURE(NULL); }
 
 static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e) {
+  if (i->memo && p->name) { return mpc_parse_memo(i, p, r, e); }
+  return mpc_parse_step(i, p, r, e);
+}
+
+static int mpc_parse_step(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e) {
 
   int j = 0, k = 0;
   mpc_result_t results_stk[MPC_PARSE_STACK_MIN];
@@ -1310,6 +1866,20 @@ int mpc_parse(const char *filename, const char *string, mpc_parser_t *p, mpc_res
   return x;
 }
 
+int mpc_parse_arena(const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r, mpc_ast_arena_t *a) {
+  return mpc_parse_memo_arena(filename, string, p, r, a, NULL);
+}
+
+int mpc_parse_memo_arena(const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r, mpc_ast_arena_t *a, mpc_memo_t *m) {
+  int x;
+  mpc_input_t *i = mpc_input_new_string(filename, string);
+  i->arena = a;
+  i->memo = a ? m : NULL;
+  x = mpc_parse_input(i, p, r);
+  mpc_input_delete(i);
+  return x;
+}
+
 int mpc_nparse(const char *filename, const char *string, size_t length, mpc_parser_t *p, mpc_result_t *r) {
   int x;
   mpc_input_t *i = mpc_input_new_nstring(filename, string, length);
@@ -2896,6 +3466,7 @@ mpc_ast_t *mpc_ast_new(const char *tag, const char *contents) {
 
   a->tag = malloc(strlen(tag) + 1);
   strcpy(a->tag, tag);
+  a->tag_id = -1;
 
   a->contents = malloc(strlen(contents) + 1);
   strcpy(a->contents, contents);
@@ -3040,6 +3611,25 @@ int mpc_ast_get_index_lb(mpc_ast_t *ast, const char *tag, int lb) {
   return -1;
 }
 
+int mpc_ast_get_index_id(mpc_ast_t *ast, int id, int lb) {
+  int i;
+
+  if (id < 0) { return -1; }
+
+  for(i=lb; i<ast->children_num; i++) {
+    if(ast->children[i]->tag_id == id) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+mpc_ast_t *mpc_ast_get_child_id(mpc_ast_t *ast, int id, int lb) {
+  int i = mpc_ast_get_index_id(ast, id, lb);
+  return i < 0 ? NULL : ast->children[i];
+}
+
 mpc_ast_t *mpc_ast_get_child(mpc_ast_t *ast, const char *tag) {
   return mpc_ast_get_child_lb(ast, tag, 0);
 }
@@ -65,7 +65,15 @@ typedef union {
 struct mpc_parser_t;
 typedef struct mpc_parser_t mpc_parser_t;
 
+struct mpc_ast_arena_t;
+typedef struct mpc_ast_arena_t mpc_ast_arena_t;
+
+struct mpc_memo_t;
+typedef struct mpc_memo_t mpc_memo_t;
+
 int mpc_parse(const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r);
+int mpc_parse_arena(const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r, mpc_ast_arena_t *a);
+int mpc_parse_memo_arena(const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r, mpc_ast_arena_t *a, mpc_memo_t *m);
 int mpc_nparse(const char *filename, const char *string, size_t length, mpc_parser_t *p, mpc_result_t *r);
 int mpc_parse_file(const char *filename, FILE *file, mpc_parser_t *p, mpc_result_t *r);
 int mpc_parse_pipe(const char *filename, FILE *pipe, mpc_parser_t *p, mpc_result_t *r);
@@ -282,6 +290,7 @@ mpc_parser_t *mpc_re_mode(const char *re, int mode);
 
 typedef struct mpc_ast_t {
   char *tag;
+  int tag_id;
   char *contents;
   mpc_state_t state;
   int children_num;
@@ -305,6 +314,42 @@ int mpc_ast_get_index(mpc_ast_t *ast, const char *tag);
 int mpc_ast_get_index_lb(mpc_ast_t *ast, const char *tag, int lb);
 mpc_ast_t *mpc_ast_get_child(mpc_ast_t *ast, const char *tag);
 mpc_ast_t *mpc_ast_get_child_lb(mpc_ast_t *ast, const char *tag, int lb);
+int mpc_ast_get_index_id(mpc_ast_t *ast, int id, int lb);
+mpc_ast_t *mpc_ast_get_child_id(mpc_ast_t *ast, int id, int lb);
+
+/*
+** AST Arena: when parsing with `mpc_parse_arena` every node, tag, contents
+** string and children array of the resulting AST is bump allocated from the
+** arena. Such trees must not be passed to `mpc_ast_delete`, they are all
+** released at once by `mpc_ast_arena_delete`.
+**
+** Arena nodes also carry an interned `tag_id`, `mpc_ast_arena_tag` maps a
+** tag string to that id (or -1 if no node was ever given that tag) for use
+** with `mpc_ast_get_index_id` and `mpc_ast_get_child_id`. Nodes not built in
+** an arena have a `tag_id` of -1.
+**
+** `mpc_ast_arena_nodes` is the number of nodes ever built in the arena,
+** including those of alternatives that were backtracked out of, and
+** `mpc_ast_arena_bytes` the memory it holds.
+*/
+
+mpc_ast_arena_t *mpc_ast_arena_new(void);
+void mpc_ast_arena_delete(mpc_ast_arena_t *a);
+int mpc_ast_arena_tag(mpc_ast_arena_t *a, const char *tag);
+size_t mpc_ast_arena_nodes(const mpc_ast_arena_t *a);
+size_t mpc_ast_arena_bytes(const mpc_ast_arena_t *a);
+
+/*
+** Packrat Memoization: passing a memo table to `mpc_parse_memo_arena`
+** records the result of each named rule at each input position so it is
+** only ever parsed once, using at most `max_bytes` for the table. A table
+** holds results for a single input and is only used together with an arena.
+** `mpc_memo_print_to` writes per rule hit and miss counts.
+*/
+
+mpc_memo_t *mpc_memo_new(size_t max_bytes);
+void mpc_memo_delete(mpc_memo_t *m);
+void mpc_memo_print_to(mpc_memo_t *m, FILE *f);
 
 typedef enum {
   mpc_ast_trav_order_pre,
@@ -1,9 +1,13 @@
 #include "parse.h"
+#include "pool.h"
+#include "profile.h"
+#include "scan.h"
 #include "util.h"
 #include <assert.h>
+#include <string.h>
 
-static mpc_ast_t *_parse_dbc_string(const char *file_name, const char *string);
-static mpc_ast_t *_parse_dbc_file_by_handle(const char *name, FILE *handle);
+static mpc_ast_t *_parse_dbc_string(const char *file_name, const char *string, mpc_ast_arena_t *arena, mpc_memo_t *memo);
+static mpc_ast_t *_parse_dbc_file_by_handle(const char *name, FILE *handle, mpc_ast_arena_t *arena, mpc_memo_t *memo);
 
 #define X_MACRO_PARSE_VARS\
 	X(spaces,               "s")\
@@ -121,64 +125,66 @@ const char *parse_get_grammar(void)
 	return dbc_grammar;
 }
 
-mpc_ast_t *parse_dbc_file_by_name(const char *name)
+mpc_ast_t *parse_dbc_file_by_name(const char *name, mpc_ast_arena_t *arena, mpc_memo_t *memo)
 {
 	assert(name);
 	mpc_ast_t *ast = NULL;
 	FILE *input = fopen(name, "rb");
 	if(!input)
 		goto end;
-	ast = _parse_dbc_file_by_handle(name, input);
+	ast = _parse_dbc_file_by_handle(name, input, arena, memo);
 end:
 	if(input)
 		fclose(input);
 	return ast;
 }
 
-mpc_ast_t *parse_dbc_file_by_handle(FILE *handle)
+mpc_ast_t *parse_dbc_file_by_handle(FILE *handle, mpc_ast_arena_t *arena, mpc_memo_t *memo)
 {
 	assert(handle);
-	return _parse_dbc_file_by_handle("<FILE*>", handle);
+	return _parse_dbc_file_by_handle("<FILE*>", handle, arena, memo);
 }
 
-static mpc_ast_t *_parse_dbc_file_by_handle(const char *name, FILE *handle)
+static mpc_ast_t *_parse_dbc_file_by_handle(const char *name, FILE *handle, mpc_ast_arena_t *arena, mpc_memo_t *memo)
 {
 	assert(name);
 	assert(handle);
 	mpc_ast_t *ast = NULL;
 	char *istring = NULL;
-	if(!(istring = slurp(handle)))
+	const profile_time_t start = profile_now();
+	istring = slurp(handle);
+	profile_phase(PROFILE_SLURP, start);
+	if(!istring)
 		goto end;
-	ast = _parse_dbc_string(name, istring);
+	ast = _parse_dbc_string(name, istring, arena, memo);
 end:
 	free(istring);
 	return ast;
 }
 
-mpc_ast_t *parse_dbc_string(const char *string)
+mpc_ast_t *parse_dbc_string(const char *string, mpc_ast_arena_t *arena, mpc_memo_t *memo)
 {
 	assert(string);
-	return _parse_dbc_string("<string>", string);
+	return _parse_dbc_string("<string>", string, arena, memo);
 }
 
-enum cleanup_length_e
+enum parser_e
 {
-#define X(CVAR, NAME) _ignore_me_ ## CVAR,
+#define X(CVAR, NAME) PARSER_ ## CVAR,
 	X_MACRO_PARSE_VARS
-	CLEANUP_LENGTH
+	PARSER_COUNT
 #undef X
 };
 
-static mpc_ast_t *_parse_dbc_string(const char *file_name, const char *string)
+static void grammar_new(mpc_parser_t *p[PARSER_COUNT])
 {
-	assert(file_name);
-	assert(string);
-	#define X(CVAR, NAME) mpc_parser_t *CVAR = mpc_new((NAME));
+	assert(p);
+	#define X(CVAR, NAME) p[PARSER_ ## CVAR] = mpc_new((NAME));
 	X_MACRO_PARSE_VARS
 	#undef X
 
 	/**@todo process more of the DBC format */
-	#define X(CVAR, NAME) CVAR,
+	#define X(CVAR, NAME) p[PARSER_ ## CVAR],
 	mpc_err_t *language_error = mpca_lang(MPCA_LANG_WHITESPACE_SENSITIVE, dbc_grammar, X_MACRO_PARSE_VARS NULL);
 	#undef X
 
@@ -187,21 +193,354 @@ static mpc_ast_t *_parse_dbc_string(const char *file_name, const char *string)
 		mpc_err_delete(language_error);
 		exit(EXIT_FAILURE);
 	}
+}
+
+static void grammar_delete(mpc_parser_t *p[PARSER_COUNT])
+{
+	assert(p);
+#define X(CVAR, NAME) p[PARSER_ ## CVAR],
+	mpc_cleanup(PARSER_COUNT,
+		X_MACRO_PARSE_VARS NULL
+		);
+#undef X
+}
+
+/* Parse errors go through the logger rather than straight to stdout, like
+ * 'mpc_err_print' does, so they stay with the other messages about a file */
+static void parse_error(mpc_err_t *e)
+{
+	assert(e);
+	char *s = mpc_err_string(e);
+	const size_t length = strlen(s);
+	if(length && s[length - 1] == '\n')
+		s[length - 1] = '\0';
+	warning("%s", s);
+	free(s);
+	mpc_err_delete(e);
+}
+
+static mpc_ast_t *_parse_dbc_string(const char *file_name, const char *string, mpc_ast_arena_t *arena, mpc_memo_t *memo)
+{
+	assert(file_name);
+	assert(string);
+	mpc_parser_t *p[PARSER_COUNT];
+	profile_time_t start = profile_now();
+	grammar_new(p);
+	profile_phase(PROFILE_GRAMMAR, start);
 
 	mpc_result_t r;
 	mpc_ast_t *ast = NULL;
-	if (mpc_parse(file_name, string, dbc, &r)) {
+	start = profile_now();
+	const int parsed = arena ?
+		mpc_parse_memo_arena(file_name, string, p[PARSER_dbc], &r, arena, memo) :
+		mpc_parse(file_name, string, p[PARSER_dbc], &r);
+	profile_phase(PROFILE_PARSE, start);
+	if (parsed)
 		ast = r.output;
+	else
+		parse_error(r.error);
+
+	start = profile_now();
+	grammar_delete(p);
+	profile_phase(PROFILE_FREE, start);
+	return ast;
+}
+
+/* Below this size splitting the file up costs more than it saves */
+#define PARSE_PARALLEL_MIN_BYTES (256ul*1024ul)
+/* Chunks per thread, more chunks balance the load better at the cost of
+ * more, smaller, arenas */
+#define PARSE_CHUNKS_PER_THREAD  (4u)
+
+static bool is_space(char c)
+{
+	return c == ' ' || c == '\t';
+}
+
+static bool is_message_line(const char *l)
+{
+	return !strncmp(l, "BO_", 3) && is_space(l[3]);
+}
+
+static bool is_signal_line(const char *l)
+{
+	while(is_space(*l))
+		l++;
+	return !strncmp(l, "SG_", 3) && is_space(l[3]);
+}
+
+static bool is_blank_line(const char *l)
+{
+	return l[0] == '\n' || (l[0] == '\r' && l[1] == '\n');
+}
+
+/* Find the messages section, the run of lines the 'messages' rule consumes,
+ * without parsing it: 'BO_' lines each followed by its 'SG_' lines, with
+ * blank lines between messages. '*begin' and '*end' are set to the bounds of
+ * the section and '*starts' to the offset of each 'BO_' line in it, the count
+ * of which is returned. Anything that does not look like a message ends the
+ * section, which is also where the grammar would stop. Only the starts of
+ * lines are looked at, which the structural index finds for us. */
+static size_t scan_messages(const char *s, size_t length, size_t *begin, size_t *end, size_t **starts)
+{
+	assert(s && begin && end && starts);
+	*begin = 0;
+	*end = 0;
+	*starts = NULL;
+	scan_index_t idx;
+	if(scan_index(&idx, s, length, SCAN_KERNEL_AUTO, false) < 0) {
+		scan_index_free(&idx);
+		return 0;
+	}
+	size_t count = 0, max = 0, r = 0;
+	size_t *st = NULL;
+	bool in_section = false, in_message = false;
+	for(; r < idx.record_count; r++) {
+		const char *l = s + idx.records[r];
+		if(is_message_line(l)) {
+			if(!in_section)
+				*begin = idx.records[r];
+			in_section = true;
+			if(count == max) {
+				max = max ? max * 2 : 1024;
+				st = reallocator(st, sizeof(*st) * max);
+			}
+			st[count++] = idx.records[r];
+			in_message = true;
+		} else if(in_section) {
+			if(in_message && is_signal_line(l)) {
+				/* signal within message */
+			} else if(is_blank_line(l)) {
+				in_message = false;
+			} else {
+				break;
+			}
+		}
+	}
+	if(in_section)
+		*end = r < idx.record_count ? idx.records[r] : length;
+	*starts = st;
+	scan_index_free(&idx);
+	return count;
+}
+
+typedef struct {
+	const char *text;     /**< whole file */
+	const size_t *bounds; /**< chunk 'i' is [bounds[i], bounds[i+1]) of 'text' */
+	mpc_parser_t *chunk;  /**< a 'messages' rule that must match a whole chunk */
+	const dbc_t *dbc;     /**< converted file without its messages */
+	can_msg_t ***msgs;    /**< messages converted from each chunk */
+	size_t *counts;       /**< number of messages in each chunk */
+	bool *failed;         /**< true if a chunk did not parse */
+} parallel_t;
+
+static void parse_chunk(void *context, size_t index, unsigned worker)
+{
+	UNUSED(worker);
+	parallel_t *p = context;
+	const size_t length = p->bounds[index + 1] - p->bounds[index];
+	char *chunk = allocate(length + 1);
+	memcpy(chunk, p->text + p->bounds[index], length);
+
+	mpc_ast_arena_t *arena = mpc_ast_arena_new();
+	mpc_result_t r;
+	if(mpc_parse_arena("<chunk>", chunk, p->chunk, &r, arena)) {
+		p->msgs[index] = ast2msgs(p->dbc, r.output, arena, &p->counts[index]);
 	} else {
-		mpc_err_print(r.error);
 		mpc_err_delete(r.error);
+		p->failed[index] = true;
 	}
+	profile_arena(arena);
+	mpc_ast_arena_delete(arena);
+	free(chunk);
+}
 
-#define X(CVAR, NAME) CVAR,
-	mpc_cleanup(CLEANUP_LENGTH,
-		X_MACRO_PARSE_VARS NULL
-		);
-#undef X
-	return ast;
+/* Does the start of the 'dbc' rule, up to its messages, match the first
+ * 'length' bytes of 'string' exactly */
+static bool head_parses(mpc_parser_t *p[PARSER_COUNT], const char *string, size_t length, mpc_ast_arena_t *arena)
+{
+	assert(p);
+	assert(string);
+	mpc_parser_t *head = mpc_new("head");
+	mpc_err_t *language_error = mpca_lang(MPCA_LANG_WHITESPACE_SENSITIVE,
+		" head : <version> <symbols> <bs> <ecus> <values>* <n>* ; \n",
+		head, p[PARSER_version], p[PARSER_symbols], p[PARSER_bs], p[PARSER_ecus],
+		p[PARSER_values], p[PARSER_newline], NULL);
+	if (language_error != NULL) {
+		mpc_err_print(language_error);
+		mpc_err_delete(language_error);
+		exit(EXIT_FAILURE);
+	}
+	mpc_parser_t *whole = mpc_whole(head, mpcf_dtor_null);
+	char *text = allocate(length + 1);
+	memcpy(text, string, length);
+	mpc_result_t r;
+	profile_time_t start = profile_now();
+	const int parsed = mpc_parse_arena("<head>", text, whole, &r, arena);
+	profile_phase(PROFILE_PARSE, start);
+	if(!parsed)
+		mpc_err_delete(r.error);
+	free(text);
+	mpc_delete(whole);
+	mpc_cleanup(1, head);
+	return parsed;
 }
 
+/* Parse 'string' with its messages section split into chunks, returns NULL
+ * if the file has to be parsed in one go instead, the errors are then
+ * reported by that. */
+static dbc_t *_parse_dbc_string_parallel(const char *file_name, const char *string, unsigned threads)
+{
+	assert(file_name);
+	assert(string);
+	dbc_t *dbc = NULL;
+	mpc_ast_arena_t *arena = NULL;
+	mpc_parser_t *chunk = NULL;
+	char *rest = NULL;
+	size_t begin = 0, end = 0, *starts = NULL;
+	profile_time_t start = profile_now();
+	const size_t length = strlen(string);
+	const size_t count = scan_messages(string, length, &begin, &end, &starts);
+	profile_phase(PROFILE_PARSE, start);
+	if(length < PARSE_PARALLEL_MIN_BYTES || count < 2)
+		goto end;
+
+	mpc_parser_t *p[PARSER_COUNT];
+	start = profile_now();
+	grammar_new(p);
+	profile_phase(PROFILE_GRAMMAR, start);
+
+	/* the serial parse only gets to the messages if what comes before them
+	 * is matched, up to 'begin', by what the 'dbc' rule has before them */
+	arena = mpc_ast_arena_new();
+	if(!head_parses(p, string, begin, arena)) {
+		debug("the messages section does not follow the header");
+		grammar_delete(p);
+		goto end;
+	}
+
+	/* everything but the messages, the 'messages' rule matches nothing */
+	rest = allocate(length - (end - begin) + 1);
+	memcpy(rest, string, begin);
+	memcpy(rest + begin, string + end, length - end);
+	mpc_result_t r;
+	start = profile_now();
+	const int parsed = mpc_parse_arena(file_name, rest, p[PARSER_dbc], &r, arena);
+	profile_phase(PROFILE_PARSE, start);
+	if(!parsed) {
+		mpc_err_delete(r.error);
+		grammar_delete(p);
+		goto end;
+	}
+	mpc_ast_t *ast = r.output;
+	start = profile_now();
+	dbc_t *d = ast2dbc_begin(ast, arena);
+	profile_phase(PROFILE_CONVERT, start);
+
+	/* split at message boundaries into chunks of roughly equal size */
+	const unsigned workers = pool_threads(threads, count);
+	size_t chunks = workers * PARSE_CHUNKS_PER_THREAD;
+	if(chunks > count)
+		chunks = count;
+	const size_t target = (end - begin) / chunks;
+	size_t *bounds = allocate(sizeof(*bounds) * (chunks + 1));
+	size_t n = 0;
+	bounds[n++] = begin;
+	for(size_t i = 1; i < count && n < chunks; i++)
+		if(starts[i] >= bounds[n - 1] + target)
+			bounds[n++] = starts[i];
+	bounds[n] = end;
+	chunks = n;
+
+	chunk = mpc_whole(p[PARSER_messages], mpcf_dtor_null);
+	parallel_t par = {
+		.text   = string,
+		.bounds = bounds,
+		.chunk  = chunk,
+		.dbc    = d,
+		.msgs   = allocate(sizeof(*par.msgs) * chunks),
+		.counts = allocate(sizeof(*par.counts) * chunks),
+		.failed = allocate(sizeof(*par.failed) * chunks),
+	};
+	debug("parsing %zu messages in %zu chunks on %u threads", count, chunks, workers);
+	start = profile_now();
+	pool_run(chunks, workers, parse_chunk, &par);
+	profile_phase(PROFILE_PARSE, start);
+
+	/* merge in file order, so the result is the same as for a serial parse */
+	bool failed = false;
+	size_t total = 0;
+	for(size_t i = 0; i < chunks; i++) {
+		failed |= par.failed[i];
+		total += par.counts[i];
+	}
+	can_msg_t **msgs = allocate(sizeof(*msgs) * (total + 1));
+	total = 0;
+	for(size_t i = 0; i < chunks; i++) {
+		if(par.failed[i])
+			continue;
+		memcpy(msgs + total, par.msgs[i], sizeof(*msgs) * par.counts[i]);
+		total += par.counts[i];
+		free(par.msgs[i]);
+	}
+	start = profile_now();
+	d = ast2dbc_end(d, ast, arena, msgs, total);
+	profile_phase(PROFILE_CONVERT, start);
+	if(failed)
+		dbc_delete(d);
+	else
+		dbc = d;
+
+	start = profile_now();
+	free(par.msgs);
+	free(par.counts);
+	free(par.failed);
+	free(bounds);
+	mpc_delete(chunk);
+	grammar_delete(p);
+	profile_phase(PROFILE_FREE, start);
+end:
+	start = profile_now();
+	profile_arena(arena);
+	mpc_ast_arena_delete(arena);
+	free(rest);
+	free(starts);
+	profile_phase(PROFILE_FREE, start);
+	return dbc;
+}
+
+int parse_dbc_file_parallel(const char *name, unsigned threads, dbc_t **dbc)
+{
+	assert(name);
+	assert(dbc);
+	*dbc = NULL;
+	char *istring = NULL;
+	FILE *input = fopen(name, "rb");
+	if(!input)
+		return -1;
+	profile_time_t start = profile_now();
+	istring = slurp(input);
+	fclose(input);
+	profile_phase(PROFILE_SLURP, start);
+	if(!istring)
+		return -1;
+
+	int r = 0;
+	if(!(*dbc = _parse_dbc_string_parallel(name, istring, threads))) {
+		debug("parsing '%s' serially", name);
+		mpc_ast_arena_t *arena = mpc_ast_arena_new();
+		mpc_ast_t *ast = _parse_dbc_string(name, istring, arena, NULL);
+		start = profile_now();
+		if(ast)
+			*dbc = ast2dbc(ast, arena);
+		else
+			r = -1;
+		profile_phase(PROFILE_CONVERT, start);
+		start = profile_now();
+		profile_arena(arena);
+		mpc_ast_arena_delete(arena);
+		profile_phase(PROFILE_FREE, start);
+	}
+	free(istring);
+	return r;
+}
@@ -6,13 +6,26 @@ extern "C" {
 #endif
 
 #include "mpc.h"
+#include "can.h"
 #include <stdio.h>
 
-mpc_ast_t *parse_dbc_file_by_name(const char *name);
-mpc_ast_t *parse_dbc_file_by_handle(FILE *handle);
-mpc_ast_t *parse_dbc_string(const char *string);
+/* If 'arena' is not NULL the returned AST is allocated from it and must be
+ * released with 'mpc_ast_arena_delete', otherwise use 'mpc_ast_delete'.
+ * 'memo' is an optional packrat memo table for the parse, it is only used
+ * if an arena is given and should not be reused for another input. */
+mpc_ast_t *parse_dbc_file_by_name(const char *name, mpc_ast_arena_t *arena, mpc_memo_t *memo);
+mpc_ast_t *parse_dbc_file_by_handle(FILE *handle, mpc_ast_arena_t *arena, mpc_memo_t *memo);
+mpc_ast_t *parse_dbc_string(const char *string, mpc_ast_arena_t *arena, mpc_memo_t *memo);
 const char *parse_get_grammar(void);
 
+/* Parse and convert a file, the messages section of a large file is split
+ * into chunks that are parsed and converted on 'threads' threads (0 for one
+ * per core) and merged back in file order; the result is the same as from
+ * 'ast2dbc'. Files that are small, or that cannot be split, are parsed in one
+ * go. Returns -1 if the file could not be read or parsed, '*dbc' is set to
+ * the result of the conversion otherwise. */
+int parse_dbc_file_parallel(const char *name, unsigned threads, dbc_t **dbc);
+
 #ifdef __cplusplus
 }
 #endif
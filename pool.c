@@ -0,0 +1,95 @@
+/**@note Threads are an optional extra, the program must behave identically
+ * when built with 'DBCC_NO_THREADS' defined or on a platform without POSIX
+ * threads, just slower. */
+#define _POSIX_C_SOURCE 200809L
+#include "pool.h"
+#include <assert.h>
+#include <stdlib.h>
+
+#if !defined(DBCC_NO_THREADS) && (defined(__unix__) || defined(__APPLE__))
+#define USE_PTHREADS
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#define POOL_THREADS_MAX (256u)
+
+unsigned pool_cores(void)
+{
+#ifdef USE_PTHREADS
+	const long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	if(cores > 0)
+		return cores > POOL_THREADS_MAX ? POOL_THREADS_MAX : cores;
+#endif
+	return 1;
+}
+
+unsigned pool_threads(unsigned threads, size_t count)
+{
+	if(!threads)
+		threads = pool_cores();
+	if(threads > POOL_THREADS_MAX)
+		threads = POOL_THREADS_MAX;
+	if(threads > count)
+		threads = count;
+	return threads ? threads : 1;
+}
+
+#ifdef USE_PTHREADS
+typedef struct {
+	pthread_mutex_t lock;
+	size_t next, count;
+	pool_job_t job;
+	void *context;
+} pool_t;
+
+typedef struct {
+	pool_t *pool;
+	unsigned worker;
+} pool_worker_t;
+
+static void *pool_worker(void *arg)
+{
+	pool_worker_t *w = arg;
+	pool_t *p = w->pool;
+	for(;;) {
+		pthread_mutex_lock(&p->lock);
+		const size_t index = p->next < p->count ? p->next++ : p->count;
+		pthread_mutex_unlock(&p->lock);
+		if(index >= p->count)
+			break;
+		p->job(p->context, index, w->worker);
+	}
+	return NULL;
+}
+#endif
+
+void pool_run(size_t count, unsigned threads, pool_job_t job, void *context)
+{
+	assert(job);
+	threads = pool_threads(threads, count);
+#ifdef USE_PTHREADS
+	if(threads > 1) {
+		pool_t p = { .next = 0, .count = count, .job = job, .context = context };
+		pthread_t tids[POOL_THREADS_MAX];
+		pool_worker_t workers[POOL_THREADS_MAX];
+		pthread_mutex_init(&p.lock, NULL);
+		unsigned started = 0;
+		/* worker 0 is the calling thread */
+		for(unsigned i = 1; i < threads; i++) {
+			workers[i] = (pool_worker_t){ .pool = &p, .worker = i };
+			if(pthread_create(&tids[i], NULL, pool_worker, &workers[i]))
+				break;
+			started = i;
+		}
+		workers[0] = (pool_worker_t){ .pool = &p, .worker = 0 };
+		pool_worker(&workers[0]);
+		for(unsigned i = 1; i <= started; i++)
+			pthread_join(tids[i], NULL);
+		pthread_mutex_destroy(&p.lock);
+		return;
+	}
+#endif
+	for(size_t i = 0; i < count; i++)
+		job(context, i, 0);
+}
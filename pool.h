@@ -0,0 +1,32 @@
+#ifndef POOL_H
+#define POOL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+/* A job is called once for each index in [0, count), 'worker' is in
+ * [0, threads) and identifies the thread running it, so per thread state can
+ * be kept in an array indexed by it. */
+typedef void (*pool_job_t)(void *context, size_t index, unsigned worker);
+
+/* Run 'count' jobs on up to 'threads' threads (0 for one per core) and wait
+ * for all of them to finish. Jobs are handed out in index order but may
+ * complete in any order. Without thread support the jobs are run in order
+ * on the calling thread. */
+void pool_run(size_t count, unsigned threads, pool_job_t job, void *context);
+
+/* number of online cores, at least 1 */
+unsigned pool_cores(void);
+
+/* resolve a requested thread count (0 for one per core) to the number of
+ * workers 'pool_run' would use for 'count' jobs */
+unsigned pool_threads(unsigned threads, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
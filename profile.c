@@ -0,0 +1,195 @@
+/**@note See 'profile.h'. */
+#define _POSIX_C_SOURCE 200809L
+#include "profile.h"
+#include "util.h"
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define HAVE_CLOCK_GETTIME
+#define HAVE_RUSAGE
+#include <sys/resource.h>
+#endif
+
+#ifdef __GNUC__
+#define ATOMIC_ADD(X, V) __atomic_fetch_add(&(X), (V), __ATOMIC_RELAXED)
+#else
+#define ATOMIC_ADD(X, V) ((X) += (V))
+#endif
+
+static profile_t *current; /* the file being processed */
+
+static const char *phase_names[PROFILE_PHASES] = {
+	[PROFILE_SLURP]   = "slurp",
+	[PROFILE_GRAMMAR] = "grammar",
+	[PROFILE_PARSE]   = "parse",
+	[PROFILE_CONVERT] = "convert",
+	[PROFILE_BACKEND] = "backend",
+	[PROFILE_FREE]    = "free",
+};
+
+static profile_time_t now(void)
+{
+	profile_time_t t = { .wall = 0 };
+#ifdef HAVE_CLOCK_GETTIME
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	t.wall = ts.tv_sec + ts.tv_nsec * 1e-9;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	t.cpu = ts.tv_sec + ts.tv_nsec * 1e-9;
+#else
+	t.wall = t.cpu = (double)clock() / CLOCKS_PER_SEC;
+#endif
+	return t;
+}
+
+static long peak_rss(void)
+{
+#ifdef HAVE_RUSAGE
+	struct rusage u;
+	if (getrusage(RUSAGE_SELF, &u) < 0)
+		return -1;
+#ifdef __APPLE__
+	return u.ru_maxrss / 1024; /* bytes, not kilobytes */
+#else
+	return u.ru_maxrss;
+#endif
+#else
+	return -1;
+#endif
+}
+
+void profile_begin(profile_t *p, const char *file)
+{
+	assert(p);
+	assert(file);
+	assert(!current);
+	memset(p, 0, sizeof(*p));
+	p->file = file;
+	allocation_totals(&p->allocations, &p->allocated);
+	current = p;
+	p->total = now();
+}
+
+void profile_end(profile_t *p)
+{
+	assert(p);
+	assert(p == current);
+	const profile_time_t end = now();
+	p->total.wall = end.wall - p->total.wall;
+	p->total.cpu  = end.cpu  - p->total.cpu;
+	size_t allocations = 0, allocated = 0;
+	allocation_totals(&allocations, &allocated);
+	p->allocations = allocations - p->allocations;
+	p->allocated   = allocated   - p->allocated;
+	p->peak_rss    = peak_rss();
+	current = NULL;
+}
+
+profile_time_t profile_now(void)
+{
+	if (!current)
+		return (profile_time_t) { .wall = 0 };
+	return now();
+}
+
+void profile_phase(profile_phase_e phase, profile_time_t start)
+{
+	assert(phase < PROFILE_PHASES);
+	if (!current)
+		return;
+	const profile_time_t end = now();
+	current->phase[phase].wall += end.wall - start.wall;
+	current->phase[phase].cpu  += end.cpu  - start.cpu;
+}
+
+void profile_arena(const mpc_ast_arena_t *arena)
+{
+	if (!current || !arena)
+		return;
+	ATOMIC_ADD(current->ast_nodes, mpc_ast_arena_nodes(arena));
+	ATOMIC_ADD(current->ast_bytes, mpc_ast_arena_bytes(arena));
+}
+
+void profile_model(const dbc_t *dbc)
+{
+	if (!current || !dbc)
+		return;
+	current->messages = dbc->message_count;
+	current->value_tables = dbc->val_count;
+	for (size_t i = 0; i < dbc->message_count; i++)
+		current->signals += dbc->messages[i]->signal_count;
+	for (size_t i = 0; i < dbc->val_count; i++)
+		current->values += dbc->vals[i]->val_list_item_count;
+}
+
+static int print_table(FILE *o, const profile_t *p)
+{
+	assert(o);
+	assert(p);
+	fprintf(o, "file: %s%s\n", p->file, p->failed ? " (failed)" : "");
+	fprintf(o, "  %-8s %12s %12s\n", "phase", "wall/ms", "cpu/ms");
+	for (size_t i = 0; i < PROFILE_PHASES; i++)
+		fprintf(o, "  %-8s %12.3f %12.3f\n", phase_names[i], p->phase[i].wall * 1e3, p->phase[i].cpu * 1e3);
+	fprintf(o, "  %-8s %12.3f %12.3f\n", "total", p->total.wall * 1e3, p->total.cpu * 1e3);
+	fprintf(o, "  ast nodes:    %zu (%zu bytes)\n", p->ast_nodes, p->ast_bytes);
+	fprintf(o, "  model:        %zu messages, %zu signals, %zu value tables, %zu values\n",
+			p->messages, p->signals, p->value_tables, p->values);
+	fprintf(o, "  allocations:  %zu (%zu bytes)\n", p->allocations, p->allocated);
+	return fprintf(o, "  peak rss:     %ld KiB\n", p->peak_rss);
+}
+
+static int print_json_string(FILE *o, const char *s)
+{
+	assert(o);
+	assert(s);
+	fputc('"', o);
+	for (; *s; s++) {
+		const unsigned char c = *s;
+		if (c == '"' || c == '\\')
+			fprintf(o, "\\%c", c);
+		else if (c < 0x20)
+			fprintf(o, "\\u%04x", c);
+		else
+			fputc(c, o);
+	}
+	return fputc('"', o) == EOF ? -1 : 0;
+}
+
+static int print_json(FILE *o, const profile_t *p)
+{
+	assert(o);
+	assert(p);
+	fputs("\t{\n\t\t\"file\": ", o);
+	print_json_string(o, p->file);
+	fprintf(o, ",\n\t\t\"failed\": %s,\n\t\t\"phases\": {\n", p->failed ? "true" : "false");
+	for (size_t i = 0; i < PROFILE_PHASES; i++)
+		fprintf(o, "\t\t\t\"%s\": { \"wall\": %.9f, \"cpu\": %.9f }%s\n",
+				phase_names[i], p->phase[i].wall, p->phase[i].cpu, i + 1 < PROFILE_PHASES ? "," : "");
+	fprintf(o, "\t\t},\n\t\t\"total\": { \"wall\": %.9f, \"cpu\": %.9f },\n", p->total.wall, p->total.cpu);
+	fprintf(o, "\t\t\"ast_nodes\": %zu,\n\t\t\"ast_bytes\": %zu,\n", p->ast_nodes, p->ast_bytes);
+	fprintf(o, "\t\t\"messages\": %zu,\n\t\t\"signals\": %zu,\n", p->messages, p->signals);
+	fprintf(o, "\t\t\"value_tables\": %zu,\n\t\t\"values\": %zu,\n", p->value_tables, p->values);
+	fprintf(o, "\t\t\"allocations\": %zu,\n\t\t\"allocated_bytes\": %zu,\n", p->allocations, p->allocated);
+	return fprintf(o, "\t\t\"peak_rss_kib\": %ld\n\t}", p->peak_rss);
+}
+
+int profile_print(FILE *output, const profile_t *profiles, size_t count, bool json)
+{
+	assert(output);
+	assert(profiles || !count);
+	if (json)
+		fputs("[\n", output);
+	for (size_t i = 0; i < count; i++) {
+		if (json) {
+			print_json(output, &profiles[i]);
+			fputs(i + 1 < count ? ",\n" : "\n", output);
+		} else {
+			print_table(output, &profiles[i]);
+		}
+	}
+	if (json)
+		fputs("]\n", output);
+	return ferror(output) ? -1 : 0;
+}
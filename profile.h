@@ -0,0 +1,69 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "can.h"
+#include "mpc.h"
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Where the time and memory goes when processing a file (see the '-P'
+ * option). The parser and the program record phases against the profile
+ * of the file being processed, if there is one, and do nothing otherwise.
+ * There is only one such profile at a time, files have to be processed one
+ * after another while profiling, although each file may still be parsed on
+ * several threads.
+ *
+ * CPU time is that of the whole process, so it includes the time spent on
+ * worker threads and can exceed the wall clock time. When the messages of a
+ * file are parsed in parallel they are also converted as each chunk is
+ * parsed, that conversion is counted as parsing. */
+
+typedef enum {
+	PROFILE_SLURP,   /**< reading the file in */
+	PROFILE_GRAMMAR, /**< building the parser from the grammar */
+	PROFILE_PARSE,   /**< running the parser */
+	PROFILE_CONVERT, /**< turning the AST (or an image) into a 'dbc_t' */
+	PROFILE_BACKEND, /**< generating and writing the output */
+	PROFILE_FREE,    /**< releasing the AST, the parser and the model */
+	PROFILE_PHASES,
+} profile_phase_e;
+
+typedef struct {
+	double wall, cpu; /**< seconds */
+} profile_time_t;
+
+typedef struct {
+	const char *file;
+	bool failed;
+	profile_time_t phase[PROFILE_PHASES];
+	profile_time_t total;     /**< from 'profile_begin' to 'profile_end' */
+	size_t ast_nodes;         /**< including those backtracked out of */
+	size_t ast_bytes;         /**< held by the AST arenas */
+	size_t messages, signals, value_tables, values;
+	size_t allocations;       /**< calls to 'allocate' and 'reallocator' */
+	size_t allocated;         /**< bytes requested by those calls */
+	long peak_rss;            /**< peak resident set size of the process so far in KiB, -1 if unknown */
+} profile_t;
+
+void profile_begin(profile_t *p, const char *file);
+void profile_end(profile_t *p);
+
+/* 'profile_phase' adds the time since 'start', from 'profile_now', to a
+ * phase of the current profile */
+profile_time_t profile_now(void);
+void profile_phase(profile_phase_e phase, profile_time_t start);
+void profile_arena(const mpc_ast_arena_t *arena); /**< call before deleting it */
+void profile_model(const dbc_t *dbc);
+
+int profile_print(FILE *output, const profile_t *profiles, size_t count, bool json);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,289 @@
+/**@note The index is built 64 bytes at a time: a kernel classifies a block
+ * into bitmasks of newlines, quotes and separators, one bit per byte, and
+ * the rest is done on the masks. Which bytes are inside of a string is the
+ * prefix XOR of the quote mask, DBC strings have no escape sequences. The
+ * kernels must produce identical masks, only the scalar one is portable. */
+#include "scan.h"
+#include "util.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define SCAN_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SCAN_AVX2
+#include <immintrin.h>
+#endif
+
+#ifdef __GNUC__
+#define SCAN_INLINE static inline __attribute__((always_inline))
+#else
+#define SCAN_INLINE static inline
+#endif
+
+#define SCAN_BLOCK (64u)
+#define SCAN_SLACK (4u)
+
+enum {
+	CLASS_NEWLINE   = 1u << 0,
+	CLASS_QUOTE     = 1u << 1,
+	CLASS_SEPARATOR = 1u << 2,
+};
+
+#define X_MACRO_SEPARATORS\
+	X(':') X(';') X('|') X('@') X(',') X('(') X(')') X('[') X(']')
+
+typedef struct {
+	uint64_t newline, quote, separator;
+} scan_masks_t;
+
+static const uint8_t scan_class[256] = {
+	['\n'] = CLASS_NEWLINE,
+	['"']  = CLASS_QUOTE,
+#define X(C) [C] = CLASS_SEPARATOR,
+	X_MACRO_SEPARATORS
+#undef X
+};
+
+SCAN_INLINE void classify_scalar(const char *b, scan_masks_t *m)
+{
+	uint64_t nl = 0, qu = 0, sp = 0;
+	for(unsigned i = 0; i < SCAN_BLOCK; i++) {
+		const unsigned c = scan_class[(uint8_t)b[i]];
+		nl |= (uint64_t)(c & CLASS_NEWLINE) << i;
+		qu |= (uint64_t)((c & CLASS_QUOTE) >> 1) << i;
+		sp |= (uint64_t)((c & CLASS_SEPARATOR) >> 2) << i;
+	}
+	m->newline = nl;
+	m->quote = qu;
+	m->separator = sp;
+}
+
+#ifdef SCAN_SSE2
+SCAN_INLINE void classify_sse2(const char *b, scan_masks_t *m)
+{
+	m->newline = m->quote = m->separator = 0;
+	for(unsigned i = 0; i < SCAN_BLOCK; i += 16) {
+		const __m128i v = _mm_loadu_si128((const __m128i*)(b + i));
+		__m128i sp = _mm_setzero_si128();
+#define X(C) sp = _mm_or_si128(sp, _mm_cmpeq_epi8(v, _mm_set1_epi8(C)));
+		X_MACRO_SEPARATORS
+#undef X
+		m->newline   |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))) << i;
+		m->quote     |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('"'))) << i;
+		m->separator |= (uint64_t)(uint16_t)_mm_movemask_epi8(sp) << i;
+	}
+}
+#endif
+
+#ifdef SCAN_AVX2
+__attribute__((target("avx2")))
+SCAN_INLINE void classify_avx2(const char *b, scan_masks_t *m)
+{
+	m->newline = m->quote = m->separator = 0;
+	for(unsigned i = 0; i < SCAN_BLOCK; i += 32) {
+		const __m256i v = _mm256_loadu_si256((const __m256i*)(b + i));
+		__m256i sp = _mm256_setzero_si256();
+#define X(C) sp = _mm256_or_si256(sp, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(C)));
+		X_MACRO_SEPARATORS
+#undef X
+		m->newline   |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'))) << i;
+		m->quote     |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"'))) << i;
+		m->separator |= (uint64_t)(uint32_t)_mm256_movemask_epi8(sp) << i;
+	}
+}
+#endif
+
+SCAN_INLINE unsigned ctz64(uint64_t x)
+{
+#ifdef __GNUC__
+	return __builtin_ctzll(x);
+#else
+	unsigned n = 0;
+	for(; !(x & 1); x >>= 1)
+		n++;
+	return n;
+#endif
+}
+
+/* bit 'i' of the result is the XOR of bits 0 to 'i' of 'x' */
+SCAN_INLINE uint64_t prefix_xor(uint64_t x)
+{
+	x ^= x << 1;
+	x ^= x << 2;
+	x ^= x << 4;
+	x ^= x << 8;
+	x ^= x << 16;
+	x ^= x << 32;
+	return x;
+}
+
+SCAN_INLINE unsigned popcount64(uint64_t x)
+{
+#ifdef __GNUC__
+	return __builtin_popcountll(x);
+#else
+	unsigned n = 0;
+	for(; x; x &= x - 1)
+		n++;
+	return n;
+#endif
+}
+
+/* offsets are written four at a time whether there are that many or not,
+ * which avoids a hard to predict branch per bit, hence 'SCAN_SLACK' */
+SCAN_INLINE void emit(uint32_t *out, size_t *count, uint32_t base, uint64_t bits)
+{
+	if(!bits)
+		return;
+	uint32_t *o = out + *count;
+	*count += popcount64(bits);
+	do {
+		for(int i = 0; i < 4; i++) {
+			o[i] = base + (bits ? ctz64(bits) : 0);
+			bits &= bits - 1;
+		}
+		o += 4;
+	} while(bits);
+}
+
+typedef struct {
+	size_t records_max, structurals_max;
+	uint64_t in_string; /**< all ones if the previous block ended inside of a string */
+	bool structurals;   /**< index structurals as well as records */
+} scan_state_t;
+
+/* make room for the worst case output of a block */
+static void scan_reserve(scan_index_t *idx, scan_state_t *st)
+{
+	if(st->records_max - idx->record_count < SCAN_BLOCK + SCAN_SLACK) {
+		st->records_max = st->records_max * 2 + SCAN_BLOCK + SCAN_SLACK;
+		idx->records = reallocator(idx->records, sizeof(*idx->records) * st->records_max);
+	}
+	if(st->structurals && st->structurals_max - idx->structural_count < SCAN_BLOCK + SCAN_SLACK) {
+		st->structurals_max = st->structurals_max * 2 + SCAN_BLOCK + SCAN_SLACK;
+		idx->structurals = reallocator(idx->structurals, sizeof(*idx->structurals) * st->structurals_max);
+	}
+}
+
+SCAN_INLINE void scan_masks(scan_index_t *idx, scan_state_t *st, uint32_t base, const scan_masks_t *m)
+{
+	const uint64_t in_string = prefix_xor(m->quote) ^ st->in_string;
+	st->in_string = 0 - (in_string >> 63);
+	/* records start after a newline, 'emit' gives the newline offset */
+	emit(idx->records, &idx->record_count, base + 1, m->newline & ~in_string);
+	if(st->structurals)
+		emit(idx->structurals, &idx->structural_count, base, (m->separator & ~in_string) | m->quote);
+}
+
+/* index 'blocks' blocks of 's', which is at offset 'base' in the input */
+typedef void (*scan_kernel_t)(scan_index_t *idx, scan_state_t *st, const char *s, size_t blocks, size_t base);
+
+#define SCAN_KERNEL(NAME, CLASSIFY)\
+	static void NAME(scan_index_t *idx, scan_state_t *st, const char *s, size_t blocks, size_t base)\
+	{\
+		for(size_t i = 0; i < blocks; i++) {\
+			scan_masks_t m;\
+			scan_reserve(idx, st);\
+			CLASSIFY(s + i * SCAN_BLOCK, &m);\
+			scan_masks(idx, st, base + i * SCAN_BLOCK, &m);\
+		}\
+	}
+
+SCAN_KERNEL(scan_scalar, classify_scalar)
+#ifdef SCAN_SSE2
+SCAN_KERNEL(scan_sse2, classify_sse2)
+#endif
+#ifdef SCAN_AVX2
+__attribute__((target("avx2")))
+SCAN_KERNEL(scan_avx2, classify_avx2)
+#endif
+
+static scan_kernel_t scan_kernel(scan_kernel_e kernel)
+{
+	switch(kernel) {
+	case SCAN_KERNEL_AUTO:
+		if(scan_kernel_available(SCAN_KERNEL_AVX2))
+			return scan_kernel(SCAN_KERNEL_AVX2);
+		if(scan_kernel_available(SCAN_KERNEL_SSE2))
+			return scan_kernel(SCAN_KERNEL_SSE2);
+		return scan_scalar;
+	case SCAN_KERNEL_SCALAR:
+		return scan_scalar;
+#ifdef SCAN_SSE2
+	case SCAN_KERNEL_SSE2:
+		return scan_sse2;
+#endif
+#ifdef SCAN_AVX2
+	case SCAN_KERNEL_AVX2:
+		return scan_kernel_available(kernel) ? scan_avx2 : NULL;
+#endif
+	default:
+		return NULL;
+	}
+}
+
+bool scan_kernel_available(scan_kernel_e kernel)
+{
+	switch(kernel) {
+	case SCAN_KERNEL_AUTO:
+	case SCAN_KERNEL_SCALAR:
+		return true;
+#ifdef SCAN_SSE2
+	case SCAN_KERNEL_SSE2:
+		return true;
+#endif
+#ifdef SCAN_AVX2
+	case SCAN_KERNEL_AVX2:
+		return __builtin_cpu_supports("avx2");
+#endif
+	default:
+		return false;
+	}
+}
+
+const char *scan_kernel_name(scan_kernel_e kernel)
+{
+	static const char *names[SCAN_KERNEL_COUNT] = { "auto", "scalar", "sse2", "avx2" };
+	return kernel < SCAN_KERNEL_COUNT ? names[kernel] : "invalid";
+}
+
+int scan_index(scan_index_t *idx, const char *s, size_t length, scan_kernel_e kernel, bool structurals)
+{
+	assert(idx);
+	assert(s);
+	memset(idx, 0, sizeof(*idx));
+	scan_kernel_t k = scan_kernel(kernel);
+	if(!k || length >= UINT32_MAX)
+		return -1;
+	scan_state_t st = { .structurals = structurals };
+	scan_reserve(idx, &st);
+	idx->records[idx->record_count++] = 0;
+
+	const size_t blocks = length / SCAN_BLOCK;
+	k(idx, &st, s, blocks, 0);
+	const size_t tail = length % SCAN_BLOCK;
+	if(tail) { /* pad the last block with something unstructured */
+		char last[SCAN_BLOCK];
+		memset(last, ' ', sizeof(last));
+		memcpy(last, s + blocks * SCAN_BLOCK, tail);
+		k(idx, &st, last, 1, blocks * SCAN_BLOCK);
+	}
+	/* a newline at the very end does not start a record */
+	if(idx->record_count && idx->records[idx->record_count - 1] == length)
+		idx->record_count--;
+	return 0;
+}
+
+void scan_index_free(scan_index_t *idx)
+{
+	if(!idx)
+		return;
+	free(idx->records);
+	free(idx->structurals);
+	memset(idx, 0, sizeof(*idx));
+}
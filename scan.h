@@ -0,0 +1,46 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* The first stage of parsing: a single pass over the input that finds the
+ * start of every record (line) and every structural character, so later
+ * stages can jump between them instead of looking at each byte. Newlines and
+ * separators inside of double quoted strings are not structural. */
+
+typedef enum {
+	SCAN_KERNEL_AUTO,   /**< fastest kernel available on this machine */
+	SCAN_KERNEL_SCALAR, /**< portable C */
+	SCAN_KERNEL_SSE2,   /**< x86, 16 bytes at a time */
+	SCAN_KERNEL_AVX2,   /**< x86, 32 bytes at a time */
+	SCAN_KERNEL_COUNT
+} scan_kernel_e;
+
+typedef struct {
+	uint32_t *records;       /**< offset of the start of each line, the first is 0 */
+	size_t record_count;     /**< number of records */
+	uint32_t *structurals;   /**< offsets of quotes, and of ':;|@,()[]' outside of them */
+	size_t structural_count; /**< number of structurals */
+} scan_index_t;
+
+/* Index 'length' bytes of 's', the structurals are only found if
+ * 'structurals' is true, most of the time goes on writing them out. Returns
+ * -1 if the kernel is not available or the input is too large (offsets are
+ * 32-bit), 0 on success. The index must be released with 'scan_index_free'
+ * either way. */
+int scan_index(scan_index_t *idx, const char *s, size_t length, scan_kernel_e kernel, bool structurals);
+void scan_index_free(scan_index_t *idx);
+bool scan_kernel_available(scan_kernel_e kernel);
+const char *scan_kernel_name(scan_kernel_e kernel);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
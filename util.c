@@ -1,3 +1,4 @@
+#define _POSIX_C_SOURCE 200809L
 #include "util.h"
 #include <assert.h>
 #include <errno.h>
@@ -5,8 +6,67 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <time.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define HAVE_MEMSTREAM
+#endif
+
+#if !defined(DBCC_NO_THREADS) && (defined(__unix__) || defined(__APPLE__))
+#define USE_PTHREADS
+#include <pthread.h>
+#endif
+
+#ifdef __GNUC__
+#define ATOMIC_LOAD(X)     __atomic_load_n(&(X), __ATOMIC_RELAXED)
+#define ATOMIC_STORE(X, V) __atomic_store_n(&(X), (V), __ATOMIC_RELAXED)
+#define ATOMIC_ADD(X, V)   __atomic_fetch_add(&(X), (V), __ATOMIC_RELAXED)
+#else
+#define ATOMIC_LOAD(X)     (X)
+#define ATOMIC_STORE(X, V) ((X) = (V))
+#define ATOMIC_ADD(X, V)   ((X) += (V))
+#endif
 
 static log_level_e log_level = LOG_NOTES;
+static size_t allocations, allocated; /* see 'allocation_totals' */
+
+typedef struct {
+	char *s;
+	size_t length, max;
+} log_buffer_t;
+
+#ifdef USE_PTHREADS
+static pthread_mutex_t log_lock  = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t exit_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t log_once   = PTHREAD_ONCE_INIT;
+static pthread_key_t log_key;
+
+static void log_key_create(void)
+{
+	pthread_key_create(&log_key, NULL);
+}
+
+static log_buffer_t *log_buffer_get(void)
+{
+	pthread_once(&log_once, log_key_create);
+	return pthread_getspecific(log_key);
+}
+
+static void log_buffer_set(log_buffer_t *b)
+{
+	pthread_once(&log_once, log_key_create);
+	pthread_setspecific(log_key, b);
+}
+
+#define LOCK(L)   pthread_mutex_lock(&(L))
+#define UNLOCK(L) pthread_mutex_unlock(&(L))
+#else
+static log_buffer_t *log_buffer;
+static log_buffer_t *log_buffer_get(void) { return log_buffer; }
+static void log_buffer_set(log_buffer_t *b) { log_buffer = b; }
+#define LOCK(L)
+#define UNLOCK(L)
+#endif
 
 bool is_integer(double i)
 {
@@ -28,17 +88,18 @@ double fractional(double x)
 
 bool verbose(log_level_e level)
 {
-	return level <= log_level && log_level != LOG_NO_MESSAGES;
+	const log_level_e ll = ATOMIC_LOAD(log_level);
+	return level <= ll && ll != LOG_NO_MESSAGES;
 }
 
 void set_log_level(log_level_e level)
 {
-	log_level = level;
+	ATOMIC_STORE(log_level, level);
 }
 
 log_level_e get_log_level(void)
 {
-	return log_level;
+	return ATOMIC_LOAD(log_level);
 }
 
 const char *emsg(void)
@@ -46,14 +107,74 @@ const char *emsg(void)
 	return errno ? strerror(errno) : "unknown reason";
 }
 
+static void log_buffer_append(log_buffer_t *b, const char *fmt, va_list ap)
+{
+	assert(b && fmt);
+	va_list aq;
+	va_copy(aq, ap);
+	const int n = vsnprintf(NULL, 0, fmt, aq);
+	va_end(aq);
+	if(n < 0)
+		return;
+	if(b->length + n + 1 > b->max) {
+		b->max = (b->length + n + 1) * 2;
+		b->s = realloc(b->s, b->max);
+		if(!b->s) { /* cannot call 'error', it logs */
+			fputs("error: log buffer allocation failed\n", stderr);
+			exit(EXIT_FAILURE);
+		}
+	}
+	vsnprintf(b->s + b->length, n + 1, fmt, ap);
+	b->length += n;
+}
+
+static void log_buffer_printf(log_buffer_t *b, const char *fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	log_buffer_append(b, fmt, ap);
+	va_end(ap);
+}
+
+void log_buffer_begin(void)
+{
+	assert(!log_buffer_get());
+	log_buffer_set(allocate(sizeof(log_buffer_t)));
+}
+
+void log_buffer_end(void)
+{
+	log_buffer_t *b = log_buffer_get();
+	if(!b)
+		return;
+	log_buffer_set(NULL);
+	if(b->length) {
+		LOCK(log_lock);
+		fwrite(b->s, 1, b->length, stderr);
+		fflush(stderr);
+		UNLOCK(log_lock);
+	}
+	free(b->s);
+	free(b);
+}
+
 static void logmsg(log_level_e ll, const char *prefix, const char *fmt, va_list ap)
 {
 	assert(prefix && fmt && ll < LOG_ALL_MESSAGES);
 	if(!verbose(ll))
 		return;
+	log_buffer_t *b = log_buffer_get();
+	if(b) {
+		log_buffer_printf(b, "%s", prefix);
+		log_buffer_append(b, fmt, ap);
+		log_buffer_printf(b, "\n");
+		return;
+	}
+	LOCK(log_lock);
 	fputs(prefix , stderr);
 	vfprintf(stderr, fmt, ap);
 	fputc('\n', stderr);
+	UNLOCK(log_lock);
 }
 
 #define LOG_INTERAL(LEVEL, PREFIX, FMT)\
@@ -70,6 +191,10 @@ void error(const char *fmt, ...)
 {
 	assert(fmt);
 	LOG_INTERAL(LOG_ERRORS, "error: ", fmt);
+	/* only the first thread to fail gets to flush its messages and exit,
+	 * any others block here until it has */
+	LOCK(exit_lock);
+	log_buffer_end();
 	exit(EXIT_FAILURE);
 }
 
@@ -101,8 +226,89 @@ FILE *fopen_or_die(const char *name, const char *mode)
 	return r;
 }
 
+output_t *output_open(const char *name, bool only_if_changed)
+{
+	assert(name);
+	output_t *o = allocate(sizeof(*o));
+	o->name = duplicate(name);
+#ifdef HAVE_MEMSTREAM
+	if(only_if_changed) {
+		errno = 0;
+		o->file = open_memstream(&o->data, &o->length);
+		if(!o->file)
+			error("open_memstream failed: %s", emsg());
+		o->staged = true;
+		return o;
+	}
+#else
+	UNUSED(only_if_changed);
+#endif
+	o->file = fopen_or_die(name, "wb");
+	return o;
+}
+
+/* compare a file against 'length' bytes of 'data', a file that cannot be
+ * read is different to everything */
+static bool same_contents(const char *name, const char *data, size_t length)
+{
+	assert(name);
+	assert(data);
+	FILE *f = fopen(name, "rb");
+	if(!f)
+		return false;
+	char block[64 * 1024];
+	bool same = true;
+	for(;;) {
+		const size_t n = fread(block, 1, sizeof(block), f);
+		if(n > length || memcmp(block, data, n)) {
+			same = false;
+			break;
+		}
+		data += n;
+		length -= n;
+		if(n < sizeof(block)) {
+			same = !ferror(f) && length == 0;
+			break;
+		}
+	}
+	fclose(f);
+	return same;
+}
+
+int output_close(output_t *o)
+{
+	if(!o)
+		return 0;
+	int r = 0;
+	errno = 0;
+	if(fclose(o->file) < 0) {
+		warning("problem writing to '%s': %s", o->name, emsg());
+		r = -1;
+	}
+	if(o->staged && r == 0) {
+		if(same_contents(o->name, o->data, o->length)) {
+			debug("unchanged => %s", o->name);
+		} else {
+			FILE *f = fopen_or_die(o->name, "wb");
+			errno = 0;
+			if(fwrite(o->data, 1, o->length, f) != o->length) {
+				warning("problem writing to '%s': %s", o->name, emsg());
+				r = -1;
+			}
+			if(fclose(f) < 0)
+				r = -1;
+		}
+	}
+	free(o->data);
+	free(o->name);
+	free(o);
+	return r;
+}
+
 void *allocate(size_t sz)
 {
+	ATOMIC_ADD(allocations, 1);
+	ATOMIC_ADD(allocated, sz);
 	errno = 0;
 	void *r = calloc(sz, 1);
 	if(!r)
@@ -112,12 +318,22 @@ void *allocate(size_t sz)
 
 void *reallocator(void *p, size_t n)
 {
+	ATOMIC_ADD(allocations, 1);
+	ATOMIC_ADD(allocated, n);
 	void *r = realloc(p, n);
 	if(!r)
 		error("reallocator failed: %s", emsg());
 	return r;
 }
 
+void allocation_totals(size_t *count, size_t *bytes)
+{
+	assert(count);
+	assert(bytes);
+	*count = ATOMIC_LOAD(allocations);
+	*bytes = ATOMIC_LOAD(allocated);
+}
+
 char *duplicate(const char *s)
 {
 	assert(s);
@@ -149,7 +365,7 @@ char *slurp(FILE *f)
 	return b;
 fail:
 	free(b);
-	fprintf(stderr, "slurp failed: %s", emsg());
+	warning("slurp failed: %s", emsg());
 	return NULL;
 }
 
@@ -190,4 +406,18 @@ char *dbcc_basename(char *s)
 	return s+i;
 }
 
-
+/* the current local time, formatted like 'asctime' does but reentrant */
+const char *time_stamp(char buffer[TIME_STAMP_LENGTH])
+{
+	assert(buffer);
+	const time_t now = time(NULL);
+	struct tm tm;
+#ifdef USE_PTHREADS
+	localtime_r(&now, &tm);
+#else
+	tm = *localtime(&now);
+#endif
+	if(!strftime(buffer, TIME_STAMP_LENGTH, "%a %b %e %H:%M:%S %Y\n", &tm))
+		buffer[0] = '\0';
+	return buffer;
+}
@@ -10,6 +10,7 @@ extern "C" {
 #include <stdint.h>
 
 #define UNUSED(X) ((void)(X))
+#define TIME_STAMP_LENGTH (32)
 
 typedef enum {
 	LOG_NO_MESSAGES,
@@ -20,6 +21,17 @@ typedef enum {
 	LOG_ALL_MESSAGES,
 } log_level_e;
 
+/* An output file that can be staged in memory and then only written out if
+ * it differs from what is already on disk, so that the time stamps of
+ * generated files do not change (and trigger rebuilds) needlessly. */
+typedef struct {
+	FILE *file;    /**< write the output here */
+	char *name;
+	char *data;    /**< contents, if staged */
+	size_t length; /**< length of contents, if staged */
+	bool staged;
+} output_t;
+
 bool is_integer(double i);
 double fractional(double x);
 bool is_power_of_two(uint64_t n);
@@ -31,12 +43,23 @@ void error(const char *fmt, ...);
 void warning(const char *fmt, ...);
 void note(const char *fmt, ...);
 void debug(const char *fmt, ...);
+/* Messages logged by the calling thread between these are collected and
+ * written out together at the end (or by 'error'), so the messages about
+ * one file are not interleaved with those about another. */
+void log_buffer_begin(void);
+void log_buffer_end(void);
 FILE *fopen_or_die(const char *name, const char *mode);
+output_t *output_open(const char *name, bool only_if_changed);
+int output_close(output_t *o); /**< returns -1 if any write failed */
 void *allocate(size_t sz);
 char *duplicate(const char *s);
 void *reallocator(void *p, size_t n);
+/* totals of the calls made to 'allocate' and 'reallocator' so far, and of
+ * the bytes they were asked for */
+void allocation_totals(size_t *count, size_t *bytes);
 char *slurp(FILE *f);
 char *dbcc_basename(char *s);
+const char *time_stamp(char buffer[TIME_STAMP_LENGTH]);
 
 #ifdef __cplusplus
 }